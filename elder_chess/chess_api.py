@@ -1,13 +1,19 @@
-from .elder_chess_native import Board, Move
+from .elder_chess_native import Board, Move, GameServer
 from .mcts_player import MCTSPlayer
 from .elder_chess_game_server import ElderChessGameServer
 from .tensorflow_policy import PolicyValueNet
 
 from xmlrpc.server import SimpleXMLRPCServer
 import argparse
+import threading
 
 parser = argparse.ArgumentParser()
 parser.add_argument('--model', type=str, default="models/best_policy.model", help='model path')
+parser.add_argument('--port', type=int, default=1027, help='port to listen on')
+parser.add_argument('--native', action='store_true',
+                    help='serve the same operations with the native GameServer (line protocol, see game_client.py) instead of XML-RPC')
+parser.add_argument('--search-threads', type=int, default=4, help='searches the native server runs at once')
+parser.add_argument('--max-queued', type=int, default=64, help='searches the native server queues before refusing more')
 args = parser.parse_args()
 
 FLIP = 0
@@ -40,12 +46,14 @@ class MyObject:
         self.boards = {}
         self.mcts_players = {}
 
-    def start_game(self, id, n_playout=10000):
+    def start_game(self, id, n_playout=10000, move_time=5.):
         self.boards[id] = Board()
         if id in self.mcts_players:
             self.mcts_players[id].reset_player()
         else:
-            self.mcts_players[id] = MCTSPlayer(self.policy_value_net.policy_value, c_puct=5, n_playout=n_playout, is_selfplay=False)
+            self.mcts_players[id] = MCTSPlayer(self.policy_value_net.policy_value, c_puct=5, n_playout=n_playout, is_selfplay=False,
+                                               move_time=move_time, early_stop=True, time_extension=1.5,
+                                               ponder=True, ponder_cpu_share=0.5)
 
     def _get_game(self, id):
         if id not in self.boards or id not in self.mcts_players:
@@ -86,6 +94,8 @@ class MyObject:
             if board.is_env_move():
                 env_move = board.env_do_move()
                 mcts_player.other_do_move(board, env_move)
+            if not board.game_ended():
+                mcts_player.start_pondering(board)
         return str(move)
 
     def display_board(self, id):
@@ -100,10 +110,25 @@ class MyObject:
         board, _ = self._get_game(id)
         return board.game_ended()
 
-obj = MyObject()
-server = SimpleXMLRPCServer(("127.0.0.1", 1027), allow_none=True)
-server.register_instance(obj)
-
-print("Listening on port 1027")
-server.serve_forever()
+if args.native:
+    policy_value_net = PolicyValueNet(model_file=args.model)
+    server = GameServer(policy_value_net.policy_value, port=args.port, search_threads=args.search_threads,
+                        max_queued=args.max_queued, n_playout=10000, move_time=5., early_stop=True, extension=1.5)
+    # serve() runs without the GIL, keeping the main thread free for Ctrl-C
+    serving = threading.Thread(target=server.serve, daemon=True)
+    serving.start()
+    print("Listening on port", args.port)
+    try:
+        while serving.is_alive():
+            serving.join(1.)
+    except KeyboardInterrupt:
+        server.stop()
+        serving.join()
+else:
+    obj = MyObject()
+    server = SimpleXMLRPCServer(("127.0.0.1", args.port), allow_none=True)
+    server.register_instance(obj)
+
+    print("Listening on port", args.port)
+    server.serve_forever()
 
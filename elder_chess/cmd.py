@@ -1,6 +1,7 @@
 import argparse, subprocess, os
 from .human_player import HumanPlayer
 from .mcts_player import MCTSPlayer
+from .expectimax_player import ExpectimaxPlayer
 from .elder_chess_game_server import ElderChessGameServer
 from .elder_chess_native import Board
 
@@ -10,6 +11,12 @@ def mcts_player(name=""):
     policy_value_net = PolicyValueNet(model_file="models/best_policy.model")
     return MCTSPlayer(policy_value_net.policy_value, c_puct=5, n_playout=10000, is_selfplay=False, name=name)
 
+def rollout_player(name=""):
+    return MCTSPlayer("rollout", c_puct=5, n_playout=2000, is_selfplay=False, name=name, n_rollouts=8)
+
+def heuristic_player(name=""):
+    return MCTSPlayer("heuristic", c_puct=5, n_playout=10000, is_selfplay=False, name=name)
+
 def mcts_player_at_branch(git_commit, n_playout, name='', tmp_repo_path='./tmp/AEC'):
     build_dir = "build_" + git_commit
     subprocess.check_call(['git', 'fetch', '--all'], cwd=tmp_repo_path)
@@ -36,7 +43,10 @@ def player_argument(args):
     print(args)
     player_dict = {
         "HumanPlayer": HumanPlayer,
-        "MCTSPlayer": mcts_player
+        "MCTSPlayer": mcts_player,
+        "ExpectimaxPlayer": ExpectimaxPlayer,
+        "RolloutPlayer": rollout_player,
+        "HeuristicPlayer": heuristic_player
     }
     player_str = args[0]
     if player_str not in player_dict:
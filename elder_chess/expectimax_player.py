@@ -0,0 +1,27 @@
+from .elder_chess_native import Expectimax
+
+class ExpectimaxPlayer(object):
+    """AI player based on the native expectimax (Star2 alpha-beta) search"""
+
+    def __init__(self, move_time=1., max_depth=127, tt_bits=20, name=""):
+        """searches by iterative deepening for move_time seconds, or until
+        max_depth or the exact game value is reached"""
+        self.engine = Expectimax(tt_bits)
+        self.move_time = move_time
+        self.max_depth = max_depth
+        self.name = name
+
+    def reset_player(self):
+        self.engine.clear()
+
+    def other_do_move(self, nextBoard, move):
+        pass
+
+    def get_action(self, board, return_prob=False):
+        result = self.engine.search(board, self.move_time, self.max_depth)
+        print("depth {} value {:.3f}{} nodes {}".format(
+            result["depth"], result["value"], " (exact)" if result["exact"] else "", result["nodes"]))
+        return result["move"]
+
+    def __str__(self):
+        return "ExpectimaxPlayer" + self.name
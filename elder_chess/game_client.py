@@ -0,0 +1,91 @@
+import re
+import socket
+import threading
+
+
+class GameServerError(Exception):
+    pass
+
+
+class GameClient(object):
+    """Client of the native GameServer (chess_api.py --native), with the
+    methods of the XML-RPC one, so it can stand in for its ServerProxy.
+    Threads may share a client: every call waits for its own answer only,
+    so one game's search does not hold up calls for the others.
+    Game ids must not contain whitespace.
+    """
+
+    def __init__(self, host="127.0.0.1", port=1027):
+        self._socket = socket.create_connection((host, port))
+        self._lock = threading.Lock()
+        self._pending = {}
+        self._next_tag = 0
+        self._reader = threading.Thread(target=self._read, daemon=True)
+        self._reader.start()
+
+    def close(self):
+        self._socket.shutdown(socket.SHUT_RDWR)
+        self._socket.close()
+
+    def start_game(self, id, n_playout=10000, move_time=5.):
+        self._call("start_game", id, n_playout, move_time)
+
+    def check_game_started(self, id):
+        return self._call("check_game_started", id) == "1"
+
+    def make_move(self, id, move_str):
+        return self._call("make_move", id, move_str) == "1"
+
+    def ai_make_move(self, id, deadline=None):
+        """the move played, as str(Move); deadline in seconds bounds queueing and search"""
+        if deadline is None:
+            return self._call("ai_make_move", id)
+        return self._call("ai_make_move", id, deadline)
+
+    def display_board(self, id):
+        escaped = self._call("display_board", id)
+        return re.sub(r"\\(.)", lambda m: "\n" if m.group(1) == "n" else m.group(1), escaped)
+
+    def get_winner(self, id):
+        return int(self._call("get_winner", id))
+
+    def game_ended(self, id):
+        return self._call("game_ended", id) == "1"
+
+    def end_game(self, id):
+        self._call("end_game", id)
+
+    def stats(self):
+        return {k: float(v) for k, v in (kv.split("=") for kv in self._call("stats").split())}
+
+    def _call(self, op, *args):
+        slot = [threading.Event(), None]
+        with self._lock:
+            self._next_tag += 1
+            tag = str(self._next_tag)
+            self._pending[tag] = slot
+            line = " ".join([tag, op] + [str(a) for a in args]) + "\n"
+            self._socket.sendall(line.encode("utf-8"))
+        slot[0].wait()
+        if slot[1] is None:
+            raise GameServerError("connection closed")
+        status, _, result = slot[1].partition(" ")
+        if status != "OK":
+            raise GameServerError(result)
+        return result
+
+    def _read(self):
+        try:
+            for line in self._socket.makefile("r", encoding="utf-8"):
+                tag, _, answer = line.rstrip("\n").partition(" ")
+                with self._lock:
+                    slot = self._pending.pop(tag, None)
+                if slot is not None:
+                    slot[1] = answer
+                    slot[0].set()
+        except OSError:
+            pass
+        with self._lock:
+            pending, self._pending = self._pending, {}
+        for slot in pending.values():
+            slot[0].set()
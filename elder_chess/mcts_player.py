@@ -1,4 +1,4 @@
-from .elder_chess_native import MCTS, BatchMCTS, move_probs_to_one_hot
+from .elder_chess_native import MCTS, BatchMCTS, SelfPlayRunner, Tablebase, EvalCache, move_probs_to_one_hot
 import numpy as np
 
 class MCTSPlayer(object):
@@ -10,11 +10,69 @@ class MCTSPlayer(object):
                  is_selfplay=False, 
                  name="",
                  num_parallel_workers=4,
-                 parallel_mcts_eval_batch_size=256
+                 parallel_mcts_eval_batch_size=256,
+                 move_time=0.,
+                 early_stop=False,
+                 time_extension=1.,
+                 ponder=False,
+                 ponder_cpu_share=0.5,
+                 endgame_solver_hidden=-1,
+                 endgame_solver_nodes=20000,
+                 tablebase=None,
+                 exact_chance=False,
+                 n_rollouts=8,
+                 eval_cache_bits=0,
+                 gumbel_considered=0,
+                 seed=None
         ):
-        self.mcts = MCTS(policy_value_function, c_puct, n_playout)
-        self.batch_mcts = BatchMCTS(policy_value_function, float(c_puct), n_playout, num_parallel_workers, parallel_mcts_eval_batch_size)
+        """policy_value_function is either a python network or the name of a
+        native evaluator: "rollout" (n_rollouts random games per leaf) or
+        "heuristic" (material and mobility), both searched without the GIL.
+        move_time (seconds, 0 for none) and n_playout both bound each search;
+        early_stop ends it once the best move can no longer be overtaken, and
+        time_extension lets unsettled positions search up to that many times longer.
+        With ponder, start_pondering keeps searching while the opponent thinks.
+        Leaves with at most endgame_solver_hidden face down pieces (-1: off) are
+        solved exactly by the expectimax engine when it can within endgame_solver_nodes.
+        tablebase (a Tablebase or the path of one) gives the exact value of
+        the positions it covers instead of the network.
+        exact_chance evaluates every outcome of a new flip and backs up their
+        expectation instead of sampling one.
+        eval_cache_bits > 0 (at most 22) shares network evaluations between
+        symmetric positions in a 2**eval_cache_bits entry cache of 336 bytes
+        an entry, self.eval_cache; clear it whenever the network's weights change.
+        gumbel_considered > 0 picks the move by Gumbel sequential halving over
+        that many sampled root moves, for small n_playout; the search then
+        returns its improved policy and no Dirichlet noise is added.
+        seed (an int) makes both searches, the move sampling and self_play
+        repeat exactly, whatever num_parallel_workers, as long as the network
+        answers a position the same in any batch and no move_time cuts
+        searches short.
+        """
+        if isinstance(tablebase, str):
+            tablebase = Tablebase(tablebase)
+        self.eval_cache = None
+        if isinstance(policy_value_function, str):
+            self.mcts = MCTS(policy_value_function, c_puct, n_playout, n_rollouts)
+            self.batch_mcts = BatchMCTS(policy_value_function, float(c_puct), n_playout, num_parallel_workers, parallel_mcts_eval_batch_size, n_rollouts)
+        else:
+            if eval_cache_bits > 0:
+                self.eval_cache = EvalCache(eval_cache_bits)
+            self.mcts = MCTS(policy_value_function, c_puct, n_playout, self.eval_cache)
+            self.batch_mcts = BatchMCTS(policy_value_function, float(c_puct), n_playout, num_parallel_workers, parallel_mcts_eval_batch_size, self.eval_cache)
+        for search in (self.mcts, self.batch_mcts):
+            search.set_search_limits(seconds=move_time, early_stop=early_stop, extension=time_extension)
+            search.set_endgame_solver(endgame_solver_hidden, endgame_solver_nodes, tablebase)
+            search.set_exact_chance(exact_chance)
+            search.set_gumbel_root(gumbel_considered)
+            if seed is not None:
+                search.set_seed(seed)
+        self._random = np.random if seed is None else np.random.RandomState(seed)
+        self._seeded = seed is not None
         self._is_selfplay = is_selfplay
+        self._gumbel = gumbel_considered > 0
+        self._ponder = ponder
+        self._ponder_cpu_share = ponder_cpu_share
         self.name = name
 
     def reset_player(self):
@@ -23,6 +81,12 @@ class MCTSPlayer(object):
     def other_do_move(self, nextBoard, move):
         self.mcts.update_with_move(nextBoard, move)
 
+    def start_pondering(self, board):
+        """search board, the position after our move, in the background until
+        the opponent's move arrives through other_do_move"""
+        if self._ponder:
+            self.mcts.start_ponder(board, self._ponder_cpu_share)
+
     def get_action(self, board, return_prob=False):
         # the pi vector returned by MCTS as in the alphaGo Zero paper
         if len(board.get_moves()) > 0:
@@ -41,21 +105,32 @@ class MCTSPlayer(object):
             ret.append(self.sample_move(moves, probs, small_temp=small_temp, update_mcts=False, return_prob=return_prob))
         return ret
 
+    def self_play(self, n_games, data_buffer=None, record_writer=None):
+        """play n_games against itself with the batched search, all natively.
+        Returns a dict of packed arrays (board_states, hiddens, remaining_steps,
+        probs, outcomes, game_indices, winners); positions are also added to
+        data_buffer and finished games appended to record_writer if given.
+        """
+        runner = SelfPlayRunner(self.batch_mcts, dirichlet_weight=0.25 if self._is_selfplay else 0.)
+        # unseeded, the runner draws its seed from the native module's generator
+        seed = int(self._random.randint(2**31)) if self._seeded else None
+        return runner.play(n_games, data_buffer, record_writer, seed)
+
     def sample_move(self, moves, probs, small_temp=False, update_mcts=False, return_prob=False, board=None):
         probs = np.array(probs)
-        if self._is_selfplay and small_temp:
+        if self._is_selfplay and small_temp and not self._gumbel:
             # add Dirichlet Noise for exploration (needed for
             # self-play training)
-            move_index = np.random.choice(
+            move_index = self._random.choice(
                 len(moves),
-                p=0.75*probs + 0.25*np.random.dirichlet(0.03*np.ones(len(probs)))
+                p=0.75*probs + 0.25*self._random.dirichlet(0.03*np.ones(len(probs)))
             )
         else:
             # with the default temp=1e-3, it is almost equivalent
             # to choosing the move with the highest prob
             if not self._is_selfplay:
                 print(probs, small_temp)
-            move_index = np.random.choice(len(moves), p=probs)
+            move_index = self._random.choice(len(moves), p=probs)
             # reset the root node
         if update_mcts:
             self.mcts.update_with_move_index(board, move_index)
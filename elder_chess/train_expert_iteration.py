@@ -1,8 +1,6 @@
 from __future__ import print_function
-import random
 import numpy as np
-from collections import defaultdict, deque
-from .elder_chess_native import Board
+from .elder_chess_native import Board, ReplayBuffer, Arena
 from .elder_chess_game_server import ElderChessGameServer
 from .mcts_player import MCTSPlayer
 from .nn_player import NNPlayer
@@ -21,7 +19,8 @@ class TrainPipeline():
         self.c_puct = 5
         self.buffer_size = 500000
         self.batch_size = 256  # mini-batch size for training
-        self.data_buffer = deque(maxlen=self.buffer_size)
+        # every stored position is sampled under its 8 board symmetries
+        self.data_buffer = ReplayBuffer(self.buffer_size // 8)
         self.play_batch_size = 1024
         self.epochs = 5  # num of train_steps for each update
         self.num_updates = 10000
@@ -45,42 +44,19 @@ class TrainPipeline():
                                       is_selfplay=True)
         self.nn_player = NNPlayer(self.policy_value_net.policy_value, is_selfplay=True)
         self.backup_policy()
+        # training batches are sampled in place into these arrays
+        self.state_batch = (
+                np.zeros((self.batch_size, 9, 4, 4), dtype=np.float32),
+                np.zeros((self.batch_size, 2, 4), dtype=np.float32),
+                np.zeros((self.batch_size, 1), dtype=np.float32)
+        )
+        self.mcts_probs_batch = np.zeros((self.batch_size, 5 * 4 * 4), dtype=np.float32)
+        self.winner_batch = np.zeros(self.batch_size, dtype=np.float32)
 
     def backup_policy(self):
         self.policy_value_net.save_model("models/current_policy.model")
         self.duplicate_policy_value_net.restore_model("models/current_policy.model")
 
-    def rotate_moves(self, moves):
-        moves = np.rot90(moves, 1, (1, 2))
-        f, u, d, l, r = moves
-        return np.array([f, r, l, u, d])
-
-    def flip_moves(self, moves):
-        f, u, d, l, r = moves
-        return np.array([np.fliplr(f), np.fliplr(u), np.fliplr(d), np.fliplr(r), np.fliplr(l)])
-
-    def get_equi_data(self, play_data):
-        """augment the data set by rotation and flipping
-        play_data: [(state, mcts_prob, winner_z), ..., ...]
-        """
-        extend_data = []
-        for (board_state, hidden_pieces, remaining), mcts_prob, winner in play_data:
-            remaining = np.array([remaining])
-            for _ in range(4):
-                # rotate counterclockwise
-                board_state = np.array([np.rot90(s, 1) for s in board_state])
-                mcts_prob = self.rotate_moves(mcts_prob)
-                extend_data.append(((board_state, hidden_pieces, remaining),
-                                    mcts_prob.flatten(),
-                                    winner))
-                # flip horizontally
-                board_state_f = np.array([np.fliplr(s) for s in board_state])
-                mcts_prob_f = self.flip_moves(mcts_prob)
-                extend_data.append(((board_state_f, hidden_pieces, remaining),
-                                    mcts_prob_f.flatten(),
-                                    winner))
-        return extend_data
-
     def collect_selfplay_data(self, n_games=1):
         """collect self-play data for training"""
 
@@ -125,23 +101,22 @@ class TrainPipeline():
         del traces
 
         # Label with expert
-        move_and_probs = self.mcts_player.get_action_batch([data[1] for data in play_data], return_prob=True)
+        boards = [data[1] for data in play_data]
+        move_and_probs = self.mcts_player.get_action_batch(boards, return_prob=True)
 
-        play_data = [(data[0], probs, data[2]) for (m, probs), data in zip(move_and_probs, play_data)]
-        
-        play_data_extended = self.get_equi_data(play_data)
-        self.data_buffer.extend(play_data_extended)
+        self.data_buffer.extend(
+                boards,
+                np.array([probs.ravel() for m, probs in move_and_probs]),
+                np.array([data[2] for data in play_data])
+        )
 
     def policy_update(self):
         """update the policy-value net"""
-        mini_batch = random.sample(self.data_buffer, self.batch_size)
-        state_batch = (
-                [data[0][0] for data in mini_batch], 
-                [data[0][1] for data in mini_batch], 
-                [data[0][2] for data in mini_batch]
-        )
-        mcts_probs_batch = [data[1] for data in mini_batch]
-        winner_batch = [data[2] for data in mini_batch]
+        state_batch = self.state_batch
+        board_states, hiddens, remaining_steps = state_batch
+        self.data_buffer.sample_into(board_states, hiddens, remaining_steps, self.mcts_probs_batch, self.winner_batch)
+        mcts_probs_batch = self.mcts_probs_batch
+        winner_batch = self.winner_batch
         old_probs, old_v = self.policy_value_net.policy_value(state_batch)
         for i in range(self.epochs):
             loss, entropy = self.policy_value_net.train_step(
@@ -184,7 +159,8 @@ class TrainPipeline():
 
     def policy_evaluate(self, n_games=10):
         """
-        Evaluate the trained policy by playing against the pure MCTS player
+        Evaluate the trained policy by playing against the previous one,
+        in pairs of games sharing their flip outcomes, all at once
         Note: this is only for monitoring the progress of training
         """
         current_mcts_player = MCTSPlayer(self.policy_value_net.policy_value,
@@ -193,17 +169,11 @@ class TrainPipeline():
         old_mcts_player = MCTSPlayer(self.duplicate_policy_value_net.policy_value,
                                          c_puct=self.c_puct,
                                          n_playout=400, name="Old")
-        win_cnt = {None: 0, current_mcts_player: 0, old_mcts_player: 0}
-        for i in range(n_games):
-            if i % 2 == 0:
-                p1, p2 = current_mcts_player, old_mcts_player
-            else:
-                p1, p2 = old_mcts_player, current_mcts_player
-            winner = self.game.start_play(p1, p2, is_shown=True)
-            win_cnt[winner] += 1
-        win_ratio = 1.0*(win_cnt[current_mcts_player] + 0.5*win_cnt[None]) / n_games
-        print("win: {}, lose: {}, tie:{}".format(win_cnt[current_mcts_player], win_cnt[old_mcts_player], win_cnt[None]))
-        return win_ratio
+        arena = Arena(current_mcts_player.batch_mcts, old_mcts_player.batch_mcts)
+        result = arena.play(max(1, n_games // 2))
+        print("win: {}, lose: {}, tie:{}, score: {:.3f} +- {:.3f}".format(
+            result["wins"], result["losses"], result["draws"], result["score"], result["score_margin"]))
+        return result["score"]
 
     def run(self):
         """run the training pipeline"""
@@ -9,7 +9,7 @@ from __future__ import print_function
 import random
 import numpy as np
 from collections import defaultdict, deque
-from .elder_chess_native import Board
+from .elder_chess_native import Board, Arena
 from .elder_chess_game_server import ElderChessGameServer
 from .mcts_player import MCTSPlayer
 # from policy_value_net import PolicyValueNet  # Theano and Lasagne
@@ -93,13 +93,16 @@ class TrainPipeline():
 
     def collect_selfplay_data(self, n_games=1):
         """collect self-play data for training"""
-        for i in range(n_games):
-            winner, play_data = self.game.start_self_play(self.mcts_player)
-            play_data = list(play_data)[:]
-            self.episode_len = len(play_data)
-            # augment the data
-            play_data_extended = self.get_equi_data(play_data)
-            self.data_buffer.extend(play_data_extended)
+        data = self.mcts_player.self_play(n_games)
+        self.episode_len = len(data["outcomes"]) // n_games
+        play_data = zip(
+                zip(data["board_states"], data["hiddens"], data["remaining_steps"][:, 0]),
+                data["probs"].reshape(-1, 5, 4, 4),
+                data["outcomes"]
+        )
+        # augment the data
+        play_data_extended = self.get_equi_data(play_data)
+        self.data_buffer.extend(play_data_extended)
 
     def policy_update(self):
         """update the policy-value net"""
@@ -153,7 +156,8 @@ class TrainPipeline():
 
     def policy_evaluate(self, n_games=10):
         """
-        Evaluate the trained policy by playing against the pure MCTS player
+        Evaluate the trained policy by playing against the previous one,
+        in pairs of games sharing their flip outcomes, all at once
         Note: this is only for monitoring the progress of training
         """
         current_mcts_player = MCTSPlayer(self.policy_value_net.policy_value,
@@ -162,17 +166,11 @@ class TrainPipeline():
         old_mcts_player = MCTSPlayer(self.duplicate_policy_value_net.policy_value,
                                          c_puct=self.c_puct,
                                          n_playout=self.n_playout, name="Old")
-        win_cnt = {None: 0, current_mcts_player: 0, old_mcts_player: 0}
-        for i in range(n_games):
-            if i % 2 == 0:
-                p1, p2 = current_mcts_player, old_mcts_player
-            else:
-                p1, p2 = old_mcts_player, current_mcts_player
-            winner = self.game.start_play(p1, p2, is_shown=True)
-            win_cnt[winner] += 1
-        win_ratio = 1.0*(win_cnt[current_mcts_player] + 0.5*win_cnt[None]) / n_games
-        print("win: {}, lose: {}, tie:{}".format(win_cnt[current_mcts_player], win_cnt[old_mcts_player], win_cnt[None]))
-        return win_ratio
+        arena = Arena(current_mcts_player.batch_mcts, old_mcts_player.batch_mcts)
+        result = arena.play(max(1, n_games // 2))
+        print("win: {}, lose: {}, tie:{}, score: {:.3f} +- {:.3f}".format(
+            result["wins"], result["losses"], result["draws"], result["score"], result["score_margin"]))
+        return result["score"]
 
     def run(self):
         """run the training pipeline"""
@@ -0,0 +1,233 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "mcts.h"
+
+namespace elder_chess {
+
+/*
+	Plays two searches against each other over many concurrent games, for
+	gating a new model against the current one. Games come in pairs that
+	share the seed of their flip outcomes and swap colours, so luck of the
+	draw largely cancels out within a pair. Every move, all games waiting on
+	one side go to its BatchMCTS in a single search, and the two sides
+	search at the same time.
+*/
+template<typename State>
+class Arena final {
+
+public:
+
+	struct Options {
+		// moves are sampled proportionally to visits until step sampled_plies, then the most visited is played
+		int sampled_plies = 0;
+	};
+
+	/* Counted for the first search */
+	struct Result {
+		int wins = 0;
+		int draws = 0;
+		int losses = 0;
+		double score = 0.;			// (wins + draws / 2) / games
+		double score_margin = 0.;	// half width of the 95% confidence interval of score, from the spread of the pair scores
+		double elo = 0.;
+		double elo_low = 0.;
+		double elo_high = 0.;
+		// per game, same encoding as Board::get_winner; games 2k and 2k+1 are
+		// pair k, with the first search playing PLAYER_0 and PLAYER_1 respectively
+		std::vector<int> winners;
+		std::vector<uint64_t> seeds;	// per pair, seed of the flip outcomes
+	};
+
+	Arena(mcts::BatchMCTS<State>& first, mcts::BatchMCTS<State>& second, const Options& options) :
+		_first(first),
+		_second(second),
+		_options(options)
+	{ }
+
+	template<typename RandomEngine>
+	Result play(std::size_t n_pairs, const State& initial_state, RandomEngine* engine);
+
+private:
+
+	template<typename RandomEngine>
+	std::size_t _select_move(const State& state, const std::vector<double>& probs, RandomEngine* engine) const;
+
+	static void _summarize(Result& result);
+
+	mcts::BatchMCTS<State>& _first;
+	mcts::BatchMCTS<State>& _second;
+	Options _options;
+};
+
+template<typename State>
+template<typename RandomEngine>
+typename Arena<State>::Result Arena<State>::play(std::size_t n_pairs, const State& initial_state, RandomEngine* engine) {
+	std::size_t n_games = 2 * n_pairs;
+	Result ret;
+	ret.winners.resize(n_games, Side(Sides::NONE));
+	std::vector<prng::Xoshiro256> env_engines;
+	for(std::size_t i = 0; i < n_pairs; i++) {
+		ret.seeds.push_back((*engine)());
+		env_engines.emplace_back(ret.seeds.back());
+		env_engines.emplace_back(ret.seeds.back());
+	}
+
+	std::vector<State> states(n_games, initial_state);
+	std::vector<std::size_t> active;
+	for(std::size_t g = 0; g < n_games; g++) {
+		if(states[g].is_env_move()) {
+			states[g].env_do_move(&env_engines[g]);
+		}
+		active.push_back(g);
+	}
+
+	std::vector<std::size_t> games[2];
+	std::vector<State> side_states[2];
+	std::vector<bool> small_temp[2];
+	std::vector<std::pair<std::vector<typename State::Move>, std::vector<double>>> move_probs[2];
+	mcts::BatchMCTS<State>* searches[2] = { &_first, &_second };
+
+	while(!active.empty()) {
+		for(int s = 0; s < 2; s++) {
+			games[s].clear();
+			side_states[s].clear();
+			small_temp[s].clear();
+			move_probs[s].clear();
+		}
+		for(std::size_t g : active) {
+			if(states[g].game_ended()) {
+				continue;
+			}
+			// the first search plays PLAYER_0 in even games
+			int s = states[g].get_current_player() == Side(g % 2) ? 0 : 1;
+			games[s].push_back(g);
+			side_states[s].push_back(states[g]);
+			small_temp[s].push_back(states[g].get_total_steps() >= _options.sampled_plies);
+		}
+
+		auto search = [&](int s) {
+			if(!games[s].empty()) {
+				searches[s]->reset();
+				move_probs[s] = searches[s]->get_move_probs(side_states[s], small_temp[s]);
+			}
+		};
+		if(&_first != &_second && !games[0].empty() && !games[1].empty()) {
+			std::exception_ptr error;
+			std::thread other([&]() {
+				try {
+					search(1);
+				} catch(...) {
+					error = std::current_exception();
+				}
+			});
+			try {
+				search(0);
+			} catch(...) {
+				other.join();
+				throw;
+			}
+			other.join();
+			if(error) {
+				std::rethrow_exception(error);
+			}
+		} else {
+			search(0);
+			search(1);
+		}
+
+		for(int s = 0; s < 2; s++) {
+			for(std::size_t i = 0; i < games[s].size(); i++) {
+				State& state = states[games[s][i]];
+				const std::vector<typename State::Move>& moves = move_probs[s][i].first;
+				state.do_move(moves[_select_move(state, move_probs[s][i].second, engine)]);
+				if(state.is_env_move()) {
+					state.env_do_move(&env_engines[games[s][i]]);
+				}
+			}
+		}
+
+		std::size_t n_active = 0;
+		for(std::size_t g : active) {
+			if(states[g].game_ended()) {
+				ret.winners[g] = states[g].get_winner();
+			} else {
+				active[n_active++] = g;
+			}
+		}
+		active.resize(n_active);
+	}
+	searches[0]->reset();
+	searches[1]->reset();
+
+	_summarize(ret);
+	return ret;
+}
+
+template<typename State>
+template<typename RandomEngine>
+std::size_t Arena<State>::_select_move(const State& state, const std::vector<double>& probs, RandomEngine* engine) const {
+	if(state.get_total_steps() >= _options.sampled_plies) {
+		return std::max_element(probs.begin(), probs.end()) - probs.begin();
+	}
+	std::discrete_distribution<std::size_t> dist(probs.begin(), probs.end());
+	return dist(*engine);
+}
+
+template<typename State>
+void Arena<State>::_summarize(Result& result) {
+	std::size_t n_pairs = result.seeds.size();
+	double sum = 0., sum_sq = 0.;
+	for(std::size_t k = 0; k < n_pairs; k++) {
+		double pair_score = 0.;
+		for(int s = 0; s < 2; s++) {
+			int winner = result.winners[2 * k + s];
+			if(winner == Sides::DRAW) {
+				result.draws++;
+				pair_score += 0.5;
+			} else if(winner == s) {
+				result.wins++;
+				pair_score += 1.;
+			} else {
+				result.losses++;
+			}
+		}
+		pair_score /= 2.;
+		sum += pair_score;
+		sum_sq += pair_score * pair_score;
+	}
+	if(n_pairs == 0) {
+		return;
+	}
+	result.score = sum / n_pairs;
+	if(n_pairs > 1) {
+		double variance = std::max(0., (sum_sq - sum * sum / n_pairs) / (n_pairs - 1));
+		result.score_margin = 1.96 * std::sqrt(variance / n_pairs);
+	} else {
+		result.score_margin = 1.;
+	}
+	auto elo = [](double score) {
+		if(score <= 0.) {
+			return -std::numeric_limits<double>::infinity();
+		} else if(score >= 1.) {
+			return std::numeric_limits<double>::infinity();
+		}
+		return -400. * std::log10(1. / score - 1.);
+	};
+	result.elo = elo(result.score);
+	result.elo_low = elo(result.score - result.score_margin);
+	result.elo_high = elo(result.score + result.score_margin);
+}
+
+}
+
+#endif
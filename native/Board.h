@@ -1,34 +1,54 @@
 #ifndef BOARD_H
 #define BOARD_H
 
+#include <cstdint>
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
 #include <unordered_set>
 
 #include "mcts.h"
 
 #include "hashed_vector.hpp"
+#include "prng.hpp"
 #include "Piece.h"
 #include "Move.h"
+#include "Symmetry.h"
 
 namespace elder_chess {
 
+template<bool dynamic_steps>
+class BoardBatch;
+
+namespace zobrist {
+struct Keys;
+}
+
 template<bool dynamic_steps>
 class Board final /* : public State */ {
 
 public:
 	
-	using Move = Move;
+	using Move = elder_chess::Move;
 
 	static const Move no_move;
 
 	static const int DEFAULT_MAX_STEPS = dynamic_steps ? 8 : 40 ;
 	static const int SIDE = 4;
+	static const bool DYNAMIC_STEPS = dynamic_steps;
 
 	Board():Board(DEFAULT_MAX_STEPS) { }
 
 	Board(int maxSteps);
 
+	/*
+		A position with every piece face up: squares holds the pieces and empty
+		squares, to_move plays next with remaining_steps left.
+	*/
+	static Board revealed(const Piece (&squares)[4][4], Side to_move, int remaining_steps, int maxSteps = DEFAULT_MAX_STEPS);
+
 	Board(const Board& other) = default;
 
 	Board& operator=(const Board& other) = default;
@@ -59,12 +79,19 @@ public:
 		return steps;
 	}
 
+	inline int get_max_steps() const {
+		return maxSteps;
+	}
+
 	inline void do_move(Move m);
 
 	inline std::vector<Move> get_moves() const;
 
 	inline std::vector<std::pair<Move, double>> get_env_move_weights() const;
 
+	/* Most outcomes a flip can have from here on: the kinds of piece still hidden */
+	inline std::size_t max_env_moves() const { return hiddenPieces.size(); }
+
 	inline bool is_env_move() const;
 
 	inline bool game_ended() const;
@@ -98,8 +125,42 @@ public:
 		return ret;
 	}
 
+	inline int get_num_hidden() const {
+		return hiddenPiecesCount;
+	}
+
+	/* Pieces of side with this value still on the board, face down ones included */
+	inline int get_num_on_board(Side side, int value) const {
+		return onBoardPieces[side][value];
+	}
+
+	/* Moves side's face up pieces have, whoever is to move; flips not counted */
+	inline int get_num_piece_moves(Side side) const;
+
+	/*
+		Zobrist key of everything the rest of the game depends on: the squares,
+		the pieces still hidden, the side to move, a pending flip and the
+		remaining steps, so transpositions reached by different move orders
+		share a key.
+	*/
+	inline uint64_t hash() const;
+
+	/* hash() of this position seen through Symmetry transform t */
+	inline uint64_t hash(int transform) const;
+
+	/*
+		The smallest hash over the 8 transforms, shared by every position the
+		rules cannot tell apart from this one. transform receives the one that
+		gives it: policy entry i here is entry
+		Symmetry::tables().move_index_map[transform][i] of the canonical position.
+	*/
+	inline uint64_t canonical_hash(int* transform = nullptr) const;
+
 private:
 
+	// stores its games field by field
+	friend class BoardBatch<dynamic_steps>;
+
 	inline bool _canEat(const Piece& from, const Piece& to) const;
 
 	inline bool _piecesDominating(Side player) const;
@@ -117,6 +178,11 @@ private:
 
 	inline void _sync_on_board(int x, int y);
 
+	static inline int _square_code(const Piece& p);
+
+	/* The part of the hash the symmetries leave alone */
+	inline uint64_t _hash_unplaced(const zobrist::Keys& keys) const;
+
 	int player_to_move = 0;
 	Move about_to_flip = Move(Move::Type::NONE, 0, 0);
 
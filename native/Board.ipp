@@ -122,6 +122,19 @@ std::vector<Move> Board<ds>::_scanAvailableMoves(Side side) const {
 	return moves;
 }
 
+template<bool ds>
+int Board<ds>::get_num_piece_moves(Side side) const {
+	int n = 0;
+	for(int i = 0; i < SIDE; i++) {
+		for(int j = 0; j < SIDE; j++) {
+			if(!board[i][j].isHidden() && !board[i][j].isEmpty() && board[i][j].getSide() == side) {
+				n += _checkMoveable(i, j, -1, 0) + _checkMoveable(i, j, +1, 0) + _checkMoveable(i, j, 0, -1) + _checkMoveable(i, j, 0, +1);
+			}
+		}
+	}
+	return n;
+}
+
 template<bool ds>
 void Board<ds>::_removeHidden(Piece p) {
 	int foundIdx = -1;
@@ -263,8 +276,7 @@ template<bool ds>
 template<typename RandomEngine>
 Move Board<ds>::env_do_move(RandomEngine* engine) {
 	assert(_currentIsEnvironment());
-	std::uniform_int_distribution<int> rnds(0, hiddenPiecesCount - 1);
-    int rnd = rnds(*engine);
+    int rnd = (int)prng::below(*engine, hiddenPiecesCount);
     Piece p;
     for(int i=0; i < hiddenPieces.size(); i++) {
         if(rnd < hiddenPiecesCounts[i]) {
@@ -320,8 +332,7 @@ Move Board<ds>::do_random_move(RandomEngine *engine) {
 		return env_do_move(engine);
 	} else {
 		std::vector<Move> moves = _scanAvailableMoves(get_current_player());
-		std::uniform_int_distribution<int> rnds(0, moves.size() - 1);
-        Move m = moves[rnds(*engine)];
+        Move m = moves[prng::below(*engine, moves.size())];
         do_move(m);
         return m;
 	}
@@ -349,6 +360,37 @@ Board<ds>::Board(int maxSteps) :
 	}
 }
 
+template<bool ds>
+Board<ds> Board<ds>::revealed(const Piece (&squares)[4][4], Side to_move, int remaining_steps, int maxSteps) {
+	if(to_move != Sides::PLAYER_0 && to_move != Sides::PLAYER_1) {
+		throw std::invalid_argument("to_move must be a player");
+	}
+	Board board(maxSteps);
+	board.hiddenPieces.clear();
+	board.hiddenPiecesCounts.clear();
+	board.hiddenPiecesCount = 0;
+	for(int i = 0; i < 4; i++) {
+		board.onBoardPieces[Sides::PLAYER_0][i] = 0;
+		board.onBoardPieces[Sides::PLAYER_1][i] = 0;
+	}
+	for(int i = 0; i < SIDE; i++) {
+		for(int j = 0; j < SIDE; j++) {
+			const Piece& p = squares[i][j];
+			if(p.isHidden()) {
+				throw std::invalid_argument("revealed positions have no hidden pieces");
+			}
+			board.board[i][j] = p;
+			if(!p.isEmpty()) {
+				board.onBoardPieces[p.getSide()][p.value]++;
+			}
+		}
+	}
+	board.player_to_move = to_move;
+	board.remaining_steps = remaining_steps;
+	board.steps = ds ? 0 : maxSteps - remaining_steps;
+	return board;
+}
+
 template<bool ds>
 void Board<ds>::print(std::ostream &os) const {
 	os << "turn " << steps << "  Rem: " << get_remaining_steps() <<std::endl;
@@ -388,6 +430,121 @@ void Board<ds>::print(std::ostream &os) const {
 	os << std::endl;
 }
 
+namespace zobrist {
+
+struct Keys {
+	uint64_t square[4][4][10];	// empty, hidden, then side * 4 + value
+	uint64_t hidden[8][17];		// side * 4 + value, by how many are left
+	uint64_t player[4];			// player_to_move + 2
+	uint64_t flip[4][4];
+	uint64_t steps;				// multiplier for remaining steps
+
+	Keys() {
+		// splitmix64, so the keys are the same on every platform
+		uint64_t state = 0x9e3779b97f4a7c15ULL;
+		auto next = [&state]() {
+			uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			return z ^ (z >> 31);
+		};
+		auto fill = [&next](uint64_t* keys, std::size_t n) {
+			for(std::size_t i = 0; i < n; i++) {
+				keys[i] = next();
+			}
+		};
+		fill(&square[0][0][0], sizeof(square) / sizeof(uint64_t));
+		fill(&hidden[0][0], sizeof(hidden) / sizeof(uint64_t));
+		fill(player, 4);
+		fill(&flip[0][0], sizeof(flip) / sizeof(uint64_t));
+		steps = next() | 1;
+	}
+
+	static inline const Keys& get() {
+		static const Keys instance;
+		return instance;
+	}
+};
+
+}
+
+template<bool ds>
+uint64_t Board<ds>::hash() const {
+	const zobrist::Keys& keys = zobrist::Keys::get();
+	uint64_t h = _hash_unplaced(keys);
+	for(int i = 0; i < SIDE; i++) {
+		for(int j = 0; j < SIDE; j++) {
+			h ^= keys.square[i][j][_square_code(board[i][j])];
+		}
+	}
+	if(about_to_flip.type == Move::Type::FLIP) {
+		h ^= keys.flip[about_to_flip.x][about_to_flip.y];
+	}
+	return h;
+}
+
+template<bool ds>
+uint64_t Board<ds>::hash(int transform) const {
+	const zobrist::Keys& keys = zobrist::Keys::get();
+	const int (&square_map)[Symmetry::NUM_SQUARES] = Symmetry::tables().square_map[transform];
+	uint64_t h = _hash_unplaced(keys);
+	for(int s = 0; s < Symmetry::NUM_SQUARES; s++) {
+		int t = square_map[s];
+		h ^= keys.square[t / 4][t % 4][_square_code(board[s / 4][s % 4])];
+	}
+	if(about_to_flip.type == Move::Type::FLIP) {
+		int t = square_map[about_to_flip.x * 4 + about_to_flip.y];
+		h ^= keys.flip[t / 4][t % 4];
+	}
+	return h;
+}
+
+template<bool ds>
+uint64_t Board<ds>::canonical_hash(int* transform) const {
+	const zobrist::Keys& keys = zobrist::Keys::get();
+	const Symmetry& symmetry = Symmetry::tables();
+	int codes[Symmetry::NUM_SQUARES];
+	for(int s = 0; s < Symmetry::NUM_SQUARES; s++) {
+		codes[s] = _square_code(board[s / 4][s % 4]);
+	}
+	uint64_t unplaced = _hash_unplaced(keys);
+	uint64_t best = 0;
+	int best_transform = 0;
+	for(int t = 0; t < Symmetry::NUM_TRANSFORMS; t++) {
+		const int (&square_map)[Symmetry::NUM_SQUARES] = symmetry.square_map[t];
+		uint64_t h = unplaced;
+		for(int s = 0; s < Symmetry::NUM_SQUARES; s++) {
+			h ^= keys.square[square_map[s] / 4][square_map[s] % 4][codes[s]];
+		}
+		if(about_to_flip.type == Move::Type::FLIP) {
+			int f = square_map[about_to_flip.x * 4 + about_to_flip.y];
+			h ^= keys.flip[f / 4][f % 4];
+		}
+		if(t == 0 || h < best) {
+			best = h;
+			best_transform = t;
+		}
+	}
+	if(transform != nullptr) {
+		*transform = best_transform;
+	}
+	return best;
+}
+
+template<bool ds>
+int Board<ds>::_square_code(const Piece& p) {
+	return p.isEmpty() ? 0 : p.isHidden() ? 1 : 2 + p.getSide() * 4 + p.value;
+}
+
+template<bool ds>
+uint64_t Board<ds>::_hash_unplaced(const zobrist::Keys& keys) const {
+	uint64_t h = keys.player[player_to_move + 2];
+	for(int i = 0; i < hiddenPieces.size(); i++) {
+		h ^= keys.hidden[hiddenPieces[i].getSide() * 4 + hiddenPieces[i].value][std::min(hiddenPiecesCounts[i], 16)];
+	}
+	return h ^ (keys.steps * (uint64_t)(get_remaining_steps() + 1));
+}
+
 template<bool ds>
 const Move Board<ds>::no_move = Move(Move::Type::NONE, -1, -1);
 
@@ -0,0 +1,490 @@
+#ifndef BOARD_BATCH_H
+#define BOARD_BATCH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "Board.h"
+#include "CompactState.h"
+#include "Symmetry.h"
+#include "prng.hpp"
+#include "threading.hpp"
+
+namespace elder_chess {
+
+/*
+	Many games of Board<dynamic_steps> stored as arrays of their fields, for
+	stepping them all at once. Each board is one 64-bit word of 4-bit square
+	codes (square x * 4 + y in bits 4 * (x * 4 + y); 0 empty, 1 hidden,
+	2 + 4 * side + value a piece) and the hidden pieces are one word of 4-bit
+	counts (side * 4 + value). The rules work on 16-bit masks of the squares
+	that are pulled out of the board word with shifts, so a whole game is a
+	handful of word operations and no branches per square.
+
+	Side to move, pending flips and the step counters follow Board, which
+	this has to agree with move for move. Moves are policy indices
+	(Symmetry::move_index: type * 16 + x * 4 + y). Every operation runs over
+	the games on up to n_threads threads.
+*/
+template<bool dynamic_steps>
+class BoardBatch final {
+
+public:
+
+	typedef Board<dynamic_steps> State;
+
+	static const int NUM_MOVE_INDICES = Symmetry::NUM_MOVE_INDICES;
+
+	/* n games at their start */
+	explicit BoardBatch(std::size_t n, int max_steps = State::DEFAULT_MAX_STEPS, std::size_t n_threads = 1);
+
+	/* All boards must share max_steps */
+	explicit BoardBatch(const std::vector<State>& boards, std::size_t n_threads = 1);
+
+	BoardBatch(const BoardBatch&) = delete;
+	BoardBatch& operator=(const BoardBatch&) = delete;
+
+	inline std::size_t size() const { return _squares.size(); }
+	inline int max_steps() const { return _max_steps; }
+
+	State board(std::size_t i) const;
+	void set_board(std::size_t i, const State& board);
+	std::vector<State> boards() const;
+
+	/*
+		Plays move_indices[i] in game i; a negative index leaves the game as it
+		is. applied[i] tells whether the move was legal and played.
+	*/
+	void do_moves(const int* move_indices, uint8_t* applied);
+
+	/* Every game waiting on a flip gets its outcome, drawn from hash(seed, game) */
+	void env_step(uint64_t seed);
+
+	/* NUM_MOVE_INDICES flags per game; none for games waiting on a flip */
+	void legal_masks(uint8_t* masks) const;
+
+	/* Board::get_winner of every game */
+	void winners(int* winners) const;
+
+	/* Board::get_current_player of every game */
+	void current_players(int* players) const;
+
+	/* fill_compact_state of every game, in float */
+	void encode(float* board_states, float* hiddens, float* remaining_steps) const;
+
+private:
+
+	static const uint64_t NIBBLES = 0x1111111111111111ULL;
+	static const uint16_t COLUMN_0 = 0x1111;
+	static const uint16_t COLUMN_3 = 0x8888;
+	static const uint8_t EMPTY = 0;
+	static const uint8_t HIDDEN = 1;
+
+	/* Bit x * 4 + y set for every square of a kind */
+	struct Squares {
+		uint16_t empty;
+		uint16_t hidden;
+		uint16_t pieces[2][4];
+	};
+
+	static inline uint8_t _code(Side side, int value) {
+		return 2 + 4 * side + value;
+	}
+
+	static inline uint8_t _square(uint64_t word, int k) {
+		return (word >> (4 * k)) & 0xf;
+	}
+
+	static inline uint64_t _set_square(uint64_t word, int k, uint8_t code) {
+		return (word & ~(0xfULL << (4 * k))) | ((uint64_t)code << (4 * k));
+	}
+
+	/* The squares holding code */
+	static inline uint16_t _mask(uint64_t word, uint8_t code) {
+		uint64_t x = word ^ (NIBBLES * code);
+		x |= x >> 1;
+		x |= x >> 2;
+		// bit 4k now clear exactly for the squares holding code; gather those bits into 16
+		uint64_t m = ~x & NIBBLES;
+		m = (m | (m >> 3)) & 0x0303030303030303ULL;
+		m = (m | (m >> 6)) & 0x000F000F000F000FULL;
+		m = (m | (m >> 12)) & 0x000000FF000000FFULL;
+		m = (m | (m >> 24)) & 0xFFFFULL;
+		return (uint16_t)m;
+	}
+
+	static inline Squares _squares_of(uint64_t word) {
+		Squares ret;
+		ret.empty = _mask(word, EMPTY);
+		ret.hidden = _mask(word, HIDDEN);
+		for(Side side : { Sides::PLAYER_0, Sides::PLAYER_1 }) {
+			for(int value = 0; value < 4; value++) {
+				ret.pieces[side][value] = _mask(word, _code(side, value));
+			}
+		}
+		return ret;
+	}
+
+	/* Squares side can move a piece from, for UP, DOWN, LEFT and RIGHT */
+	static inline void _sources(const Squares& sq, Side side, uint16_t (&from)[4]) {
+		// opponent values each value can take, see Board::_canEat
+		static const uint8_t TAKES[4] = { 0x9, 0x3, 0x7, 0xe };
+		from[0] = from[1] = from[2] = from[3] = 0;
+		for(int value = 0; value < 4; value++) {
+			uint16_t src = sq.pieces[side][value];
+			if(src == 0) {
+				continue;
+			}
+			uint16_t to = sq.empty;
+			for(int t = 0; t < 4; t++) {
+				if(TAKES[value] & (1 << t)) {
+					to |= sq.pieces[1 - side][t];
+				}
+			}
+			from[0] |= src & (uint16_t)(to << 4);
+			from[1] |= src & (uint16_t)(to >> 4);
+			from[2] |= src & (uint16_t)(to << 1) & ~COLUMN_0;
+			from[3] |= src & (uint16_t)(to >> 1) & ~COLUMN_3;
+		}
+	}
+
+	static inline int _popcount(uint32_t x) {
+		return __builtin_popcount(x);
+	}
+
+	static inline int _num_moves(const Squares& sq, Side side) {
+		uint16_t from[4];
+		_sources(sq, side, from);
+		return _popcount(sq.hidden) + _popcount(from[0]) + _popcount(from[1]) + _popcount(from[2]) + _popcount(from[3]);
+	}
+
+	static inline int _hidden_count(uint32_t hidden, Side side, int value) {
+		return (hidden >> (4 * (side * 4 + value))) & 0xf;
+	}
+
+	inline int _remaining(std::size_t i) const {
+		return dynamic_steps ? _remaining_steps[i] : _max_steps - _steps[i];
+	}
+
+	bool _dominating(const Squares& sq, uint32_t hidden, Side side) const;
+
+	int _winner(std::size_t i) const;
+
+	bool _do_move(std::size_t i, int move_index);
+
+	/* Runs f(i) for every game, split over the threads */
+	template<typename F>
+	void _for_each_game(F f) const;
+
+	std::vector<uint64_t> _squares;
+	std::vector<uint32_t> _hidden;
+	std::vector<int8_t> _player;		// as Board: -side - 1 while side's flip waits for its outcome
+	std::vector<uint8_t> _flip_square;
+	std::vector<int16_t> _steps;
+	std::vector<int16_t> _remaining_steps;
+	int _max_steps;
+
+	std::size_t _n_threads;
+	mutable threading::ThreadPool _pool;
+};
+
+template<bool ds>
+BoardBatch<ds>::BoardBatch(std::size_t n, int max_steps, std::size_t n_threads) :
+	BoardBatch(std::vector<State>(n, State(max_steps)), n_threads)
+{ }
+
+template<bool ds>
+BoardBatch<ds>::BoardBatch(const std::vector<State>& boards, std::size_t n_threads) :
+	_squares(boards.size()),
+	_hidden(boards.size()),
+	_player(boards.size()),
+	_flip_square(boards.size()),
+	_steps(boards.size()),
+	_remaining_steps(boards.size()),
+	_max_steps(boards.empty() ? State::DEFAULT_MAX_STEPS : boards[0].maxSteps),
+	_n_threads(std::max<std::size_t>(1, n_threads))
+{
+	if(_n_threads > 1) {
+		_pool.initialize(_n_threads);
+	}
+	for(std::size_t i = 0; i < boards.size(); i++) {
+		set_board(i, boards[i]);
+	}
+}
+
+template<bool ds>
+typename BoardBatch<ds>::State BoardBatch<ds>::board(std::size_t i) const {
+	State ret(_max_steps);
+	ret.hiddenPieces.clear();
+	ret.hiddenPiecesCounts.clear();
+	ret.hiddenPiecesCount = 0;
+	for(Side side : { Sides::PLAYER_0, Sides::PLAYER_1 }) {
+		for(int value = 0; value < 4; value++) {
+			int count = _hidden_count(_hidden[i], side, value);
+			if(count > 0) {
+				ret.hiddenPieces.push_back(Piece(side, value));
+				ret.hiddenPiecesCounts.push_back(count);
+				ret.hiddenPiecesCount += count;
+			}
+			ret.onBoardPieces[side][value] = count;
+		}
+	}
+	for(int k = 0; k < 16; k++) {
+		uint8_t code = _square(_squares[i], k);
+		Piece& p = ret.board[k / 4][k % 4];
+		if(code == EMPTY) {
+			p = Piece::empty();
+		} else if(code == HIDDEN) {
+			p = Piece::hidden();
+		} else {
+			p = Piece((code - 2) / 4, (code - 2) % 4);
+			ret.onBoardPieces[p.getSide()][p.value]++;
+		}
+	}
+	ret.player_to_move = _player[i];
+	ret.about_to_flip = _player[i] < 0 ? Move(Move::Type::FLIP, _flip_square[i] / 4, _flip_square[i] % 4) : Move(Move::Type::NONE, 0, 0);
+	ret.steps = _steps[i];
+	ret.remaining_steps = _remaining_steps[i];
+	return ret;
+}
+
+template<bool ds>
+void BoardBatch<ds>::set_board(std::size_t i, const State& board) {
+	if(board.maxSteps != _max_steps) {
+		throw std::invalid_argument("every board of a batch must have the same max_steps");
+	}
+	uint64_t word = 0;
+	for(int k = 0; k < 16; k++) {
+		const Piece& p = board.board[k / 4][k % 4];
+		word = _set_square(word, k, p.isEmpty() ? EMPTY : (p.isHidden() ? HIDDEN : _code(p.getSide(), p.value)));
+	}
+	uint32_t hidden = 0;
+	for(std::size_t h = 0; h < board.hiddenPieces.size(); h++) {
+		const Piece& p = board.hiddenPieces[h];
+		hidden += (uint32_t)board.hiddenPiecesCounts[h] << (4 * (p.getSide() * 4 + p.value));
+	}
+	_squares[i] = word;
+	_hidden[i] = hidden;
+	_player[i] = board.player_to_move;
+	_flip_square[i] = board.player_to_move < 0 ? board.about_to_flip.x * 4 + board.about_to_flip.y : 0;
+	_steps[i] = board.steps;
+	_remaining_steps[i] = board.remaining_steps;
+}
+
+template<bool ds>
+std::vector<typename BoardBatch<ds>::State> BoardBatch<ds>::boards() const {
+	std::vector<State> ret(size());
+	_for_each_game([this, &ret](std::size_t i) {
+		ret[i] = board(i);
+	});
+	return ret;
+}
+
+template<bool ds>
+void BoardBatch<ds>::do_moves(const int* move_indices, uint8_t* applied) {
+	_for_each_game([this, move_indices, applied](std::size_t i) {
+		applied[i] = move_indices[i] >= 0 && _do_move(i, move_indices[i]);
+	});
+}
+
+template<bool ds>
+bool BoardBatch<ds>::_do_move(std::size_t i, int move_index) {
+	Side player = _player[i];
+	if(player < 0 || move_index >= NUM_MOVE_INDICES) {
+		return false;
+	}
+	int type = move_index / 16;
+	int k = move_index % 16;
+	Squares sq = _squares_of(_squares[i]);
+	if((int)Move::Type::FLIP == type) {
+		if(!(sq.hidden & (1 << k))) {
+			return false;
+		}
+		_flip_square[i] = k;
+		_player[i] = -player - 1;
+		if(ds) {
+			_remaining_steps[i] = _max_steps;
+		}
+		_steps[i]++;
+		return true;
+	}
+	uint16_t from[4];
+	_sources(sq, player, from);
+	if(!(from[type - 1] & (1 << k))) {
+		return false;
+	}
+	static const int STEP[4] = { -4, 4, -1, 1 };
+	int target = k + STEP[type - 1];
+	uint64_t word = _squares[i];
+	if(_square(word, target) != EMPTY && ds) {
+		_remaining_steps[i] = _max_steps;
+	}
+	word = _set_square(word, target, _square(word, k));
+	_squares[i] = _set_square(word, k, EMPTY);
+	_player[i] = 1 - player;
+	_steps[i]++;
+	_remaining_steps[i]--;
+	return true;
+}
+
+template<bool ds>
+void BoardBatch<ds>::env_step(uint64_t seed) {
+	_for_each_game([this, seed](std::size_t i) {
+		if(_player[i] >= 0) {
+			return;
+		}
+		// the game's own stream: independent of the thread the game lands on
+		uint64_t z = prng::derive(seed, {i});
+		uint32_t hidden = _hidden[i];
+		int total = 0;
+		for(int h = 0; h < 8; h++) {
+			total += (hidden >> (4 * h)) & 0xf;
+		}
+		int r = (int)(((z >> 32) * (uint64_t)total) >> 32);
+		int h = 0;
+		for(; h < 7; h++) {
+			int count = (hidden >> (4 * h)) & 0xf;
+			if(r < count) {
+				break;
+			}
+			r -= count;
+		}
+		_hidden[i] = hidden - (1u << (4 * h));
+		_squares[i] = _set_square(_squares[i], _flip_square[i], 2 + h);
+		_player[i] = 1 - (-_player[i] - 1);
+		if(ds) {
+			_remaining_steps[i] = _max_steps - 1;
+		}
+	});
+}
+
+template<bool ds>
+void BoardBatch<ds>::legal_masks(uint8_t* masks) const {
+	_for_each_game([this, masks](std::size_t i) {
+		uint8_t* mask = masks + i * NUM_MOVE_INDICES;
+		memset(mask, 0, NUM_MOVE_INDICES);
+		Side player = _player[i];
+		if(player < 0) {
+			return;
+		}
+		Squares sq = _squares_of(_squares[i]);
+		uint16_t from[4];
+		_sources(sq, player, from);
+		for(int k = 0; k < 16; k++) {
+			mask[(int)Move::Type::FLIP * 16 + k] = (sq.hidden >> k) & 1;
+			for(int d = 0; d < 4; d++) {
+				mask[(d + 1) * 16 + k] = (from[d] >> k) & 1;
+			}
+		}
+	});
+}
+
+template<bool ds>
+bool BoardBatch<ds>::_dominating(const Squares& sq, uint32_t hidden, Side side) const {
+	// Board::_piecesDominating over the pieces on the board, face down ones included
+	int own[4], other[4];
+	for(int value = 0; value < 4; value++) {
+		own[value] = _popcount(sq.pieces[side][value]) + _hidden_count(hidden, side, value);
+		other[value] = _popcount(sq.pieces[1 - side][value]) + _hidden_count(hidden, 1 - side, value);
+	}
+	return (own[0] > 0 && other[0] == 0 && other[1] == 0 && other[2] == 0)
+		|| (own[1] > 0 && other[1] == 0 && other[2] == 0 && other[3] == 0)
+		|| (own[2] > 0 && other[3] == 0 && other[2] == 0)
+		|| (own[3] > 0 && other[0] == 0 && other[3] == 0);
+}
+
+template<bool ds>
+int BoardBatch<ds>::_winner(std::size_t i) const {
+	Squares sq = _squares_of(_squares[i]);
+	int p0_moves = _num_moves(sq, Sides::PLAYER_0);
+	if(p0_moves == 0) {
+		return Sides::PLAYER_1;
+	}
+	int p1_moves = _num_moves(sq, Sides::PLAYER_1);
+	if(p1_moves == 0) {
+		return Sides::PLAYER_0;
+	}
+	if(_dominating(sq, _hidden[i], Sides::PLAYER_0)) {
+		return Sides::PLAYER_0;
+	}
+	if(_dominating(sq, _hidden[i], Sides::PLAYER_1)) {
+		return Sides::PLAYER_1;
+	}
+	if(_remaining(i) == 0) {
+		return p1_moves > p0_moves ? Sides::PLAYER_1 : (p1_moves < p0_moves ? Sides::PLAYER_0 : Sides::DRAW);
+	}
+	return Sides::NONE;
+}
+
+template<bool ds>
+void BoardBatch<ds>::winners(int* winners) const {
+	_for_each_game([this, winners](std::size_t i) {
+		winners[i] = _winner(i);
+	});
+}
+
+template<bool ds>
+void BoardBatch<ds>::current_players(int* players) const {
+	for(std::size_t i = 0; i < size(); i++) {
+		players[i] = _player[i];
+	}
+}
+
+template<bool ds>
+void BoardBatch<ds>::encode(float* board_states, float* hiddens, float* remaining_steps) const {
+	_for_each_game([this, board_states, hiddens, remaining_steps](std::size_t i) {
+		float* planes = board_states + i * COMPACT_BOARD_SIZE;
+		Side player = _player[i];
+		Squares sq = _squares_of(_squares[i]);
+		for(int k = 0; k < 16; k++) {
+			planes[8 * 16 + k] = (float)((sq.hidden >> k) & 1);
+		}
+		for(int value = 0; value < 4; value++) {
+			// as fill_compact_state, while a flip waits every piece is the opponent's
+			uint16_t own = player >= 0 ? sq.pieces[player][value] : 0;
+			uint16_t opponent = (sq.pieces[0][value] | sq.pieces[1][value]) & ~own;
+			for(int k = 0; k < 16; k++) {
+				planes[value * 16 + k] = (float)((own >> k) & 1);
+				planes[(4 + value) * 16 + k] = (float)((opponent >> k) & 1);
+			}
+		}
+		float* h = hiddens + i * COMPACT_HIDDENS_SIZE;
+		std::fill(h, h + COMPACT_HIDDENS_SIZE, 0.f);
+		for(int value = 0; value < 4; value++) {
+			h[(player == 0 ? 0 : 1) * 4 + value] = _hidden_count(_hidden[i], Sides::PLAYER_0, value);
+			h[(player == 1 ? 0 : 1) * 4 + value] = _hidden_count(_hidden[i], Sides::PLAYER_1, value);
+		}
+		remaining_steps[i] = _remaining(i);
+	});
+}
+
+template<bool ds>
+template<typename F>
+void BoardBatch<ds>::_for_each_game(F f) const {
+	// below this many games per thread the hand off costs more than it saves
+	static const std::size_t MIN_GAMES_PER_TASK = 256;
+	std::size_t n = size();
+	std::size_t n_tasks = std::min(_n_threads, (n + MIN_GAMES_PER_TASK - 1) / MIN_GAMES_PER_TASK);
+	if(n_tasks <= 1) {
+		for(std::size_t i = 0; i < n; i++) {
+			f(i);
+		}
+		return;
+	}
+	threading::ThreadGroup tg(_pool);
+	for(std::size_t t = 0; t < n_tasks; t++) {
+		tg.add_task([&f, t, n, n_tasks]() {
+			for(std::size_t i = n * t / n_tasks; i < n * (t + 1) / n_tasks; i++) {
+				f(i);
+			}
+		});
+	}
+	tg.wait_all();
+}
+
+}
+
+#endif
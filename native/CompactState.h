@@ -0,0 +1,111 @@
+#ifndef COMPACT_STATE_H
+#define COMPACT_STATE_H
+
+#include <cstdint>
+#include <cstring>
+
+#include "Board.h"
+#include "Symmetry.h"
+
+namespace elder_chess {
+
+/*
+	Network input layout: 9 planes of 4x4 (own pieces 1~4, opponent pieces 1~4,
+	hidden), 2x4 hidden piece counts (own, opponent) and the remaining steps.
+	Everything is relative to the player to move.
+*/
+static const int COMPACT_BOARD_SIZE = 9 * 4 * 4;
+static const int COMPACT_HIDDENS_SIZE = 2 * 4;
+static const int COMPACT_STATE_SIZE = COMPACT_BOARD_SIZE + COMPACT_HIDDENS_SIZE + 1;
+
+template<bool ds>
+inline void fill_compact_state(const Board<ds>& board, double (&board_state)[9][4][4], double (&hiddens_state)[2][4], double &remaining_steps_state) {
+	memset(&board_state, 0, sizeof(board_state));
+	for(int i = 0; i < 4; i++) {
+		for(int j = 0; j < 4; j++) {
+			Piece p = board.at(i, j);
+			if (p.isHidden()) {
+				board_state[8][i][j] = 1.;
+			} else if (!p.isEmpty()) {
+				int idx = p.getSide() == board.get_current_player() ? 0 : 1;
+				board_state[idx * 4 + p.value][i][j] = 1.;
+			}
+		}
+	}
+
+	auto&& counts = board.get_hidden_counts();
+	for(int i = 0; i < 4; i++) {
+		hiddens_state[board.get_current_player() == 0 ? 0 : 1][i] = counts.first[i];
+		hiddens_state[board.get_current_player() == 1 ? 0 : 1][i] = counts.second[i];
+	}
+
+	remaining_steps_state = board.get_remaining_steps();
+}
+
+/*
+	The same information as fill_compact_state in 25 bytes, for storing many
+	positions. Square codes: 0 empty, 1 hidden, 2~5 own piece, 6~9 opponent piece.
+*/
+struct PackedPosition final {
+
+	static const uint8_t EMPTY = 0;
+	static const uint8_t HIDDEN = 1;
+	static const uint8_t OWN = 2;
+	static const uint8_t OPPONENT = 6;
+
+	uint8_t squares[16];
+	uint8_t hiddens[2][4];
+	uint8_t remaining_steps;
+
+	template<bool ds>
+	static PackedPosition pack(const Board<ds>& board) {
+		PackedPosition ret;
+		for(int i = 0; i < 4; i++) {
+			for(int j = 0; j < 4; j++) {
+				Piece p = board.at(i, j);
+				if(p.isHidden()) {
+					ret.squares[i * 4 + j] = HIDDEN;
+				} else if(p.isEmpty()) {
+					ret.squares[i * 4 + j] = EMPTY;
+				} else {
+					ret.squares[i * 4 + j] = (p.getSide() == board.get_current_player() ? OWN : OPPONENT) + p.value;
+				}
+			}
+		}
+		auto&& counts = board.get_hidden_counts();
+		for(int i = 0; i < 4; i++) {
+			ret.hiddens[board.get_current_player() == 0 ? 0 : 1][i] = counts.first[i];
+			ret.hiddens[board.get_current_player() == 1 ? 0 : 1][i] = counts.second[i];
+		}
+		ret.remaining_steps = board.get_remaining_steps();
+		return ret;
+	}
+
+	/*
+		Writes the network input of this position seen through symmetry
+		`transform` into board_state[9 * 16], hiddens_state[8] and remaining_steps_state[1].
+	*/
+	template<typename T>
+	void unpack(T* board_state, T* hiddens_state, T* remaining_steps_state, int transform = 0) const {
+		const int (&square_map)[Symmetry::NUM_SQUARES] = Symmetry::tables().square_map[transform];
+		std::fill(board_state, board_state + COMPACT_BOARD_SIZE, T(0));
+		for(int s = 0; s < 16; s++) {
+			uint8_t code = squares[s];
+			if(code == HIDDEN) {
+				board_state[8 * 16 + square_map[s]] = T(1);
+			} else if(code != EMPTY) {
+				board_state[(code - OWN) * 16 + square_map[s]] = T(1);
+			}
+		}
+		for(int i = 0; i < 2; i++) {
+			for(int j = 0; j < 4; j++) {
+				hiddens_state[i * 4 + j] = T(hiddens[i][j]);
+			}
+		}
+		*remaining_steps_state = T(remaining_steps);
+	}
+};
+
+}
+
+#endif
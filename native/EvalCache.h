@@ -0,0 +1,172 @@
+#ifndef EVAL_CACHE_H
+#define EVAL_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mcts.h"
+#include "Symmetry.h"
+
+namespace elder_chess {
+
+/*
+	Leaf evaluations keyed by State::canonical_hash, so the 8 symmetric
+	versions of a position share one network call: the priors are stored as
+	seen on the canonical position and mapped back onto the moves of
+	whichever version is looked up. Direct mapped with 2^capacity_bits
+	entries of 336 bytes, a newer position replacing an older one; at most
+	2^MAX_CAPACITY_BITS, 1.4 GB. A position that is its own mirror image
+	keeps the priors of whichever orientation was stored. Thread safe; clear
+	it whenever the evaluator behind it changes.
+*/
+template<typename State>
+class EvalCache final {
+
+public:
+
+	typedef std::pair<std::vector<std::pair<typename State::Move, double>>, double> EvalResult;
+
+	static const int MAX_CAPACITY_BITS = 22;
+
+	explicit EvalCache(int capacity_bits = 16) {
+		if(capacity_bits < 1 || capacity_bits > MAX_CAPACITY_BITS) {
+			throw std::invalid_argument("capacity_bits must be in [1, " + std::to_string(MAX_CAPACITY_BITS) + "]");
+		}
+		_table.resize(std::size_t(1) << capacity_bits);
+		_mask = _table.size() - 1;
+	}
+
+	/* Fills result for state if it or a symmetric version of it is stored */
+	bool lookup(const State& state, EvalResult& result);
+
+	void store(const State& state, const EvalResult& result);
+
+	void clear();
+
+	inline std::size_t capacity() const { return _table.size(); }
+	inline uint64_t hits() const { return _hits; }
+	inline uint64_t misses() const { return _misses; }
+
+private:
+
+	static const int NUM_LOCKS = 64;
+
+	struct Entry {
+		uint64_t key = 0;
+		bool used = false;
+		float value = 0.f;
+		float priors[Symmetry::NUM_MOVE_INDICES];
+	};
+	static_assert(sizeof(Entry) == 336, "update the entry size in the class comment");
+
+	inline std::mutex& _lock(uint64_t key) {
+		return _locks[(key >> 32) % NUM_LOCKS];
+	}
+
+	std::vector<Entry> _table;
+	std::size_t _mask;
+	std::mutex _locks[NUM_LOCKS];
+	std::atomic<uint64_t> _hits { 0 };
+	std::atomic<uint64_t> _misses { 0 };
+};
+
+template<typename State>
+bool EvalCache<State>::lookup(const State& state, EvalResult& result) {
+	int transform = 0;
+	uint64_t key = state.canonical_hash(&transform);
+	const int (&to_canonical)[Symmetry::NUM_MOVE_INDICES] = Symmetry::tables().move_index_map[transform];
+	{
+		std::lock_guard<std::mutex> lock(_lock(key));
+		const Entry& e = _table[key & _mask];
+		if(e.used && e.key == key) {
+			auto&& moves = state.get_moves();
+			result.first.resize(moves.size());
+			for(std::size_t i = 0; i < moves.size(); i++) {
+				result.first[i] = std::make_pair(moves[i], (double)e.priors[to_canonical[Symmetry::move_index(moves[i])]]);
+			}
+			result.second = e.value;
+			_hits++;
+			return true;
+		}
+	}
+	_misses++;
+	return false;
+}
+
+template<typename State>
+void EvalCache<State>::store(const State& state, const EvalResult& result) {
+	int transform = 0;
+	uint64_t key = state.canonical_hash(&transform);
+	const int (&to_canonical)[Symmetry::NUM_MOVE_INDICES] = Symmetry::tables().move_index_map[transform];
+	std::lock_guard<std::mutex> lock(_lock(key));
+	Entry& e = _table[key & _mask];
+	e.key = key;
+	e.used = true;
+	e.value = result.second;
+	std::fill(e.priors, e.priors + Symmetry::NUM_MOVE_INDICES, 0.f);
+	for(auto& prior : result.first) {
+		e.priors[to_canonical[Symmetry::move_index(prior.first)]] = prior.second;
+	}
+}
+
+template<typename State>
+void EvalCache<State>::clear() {
+	for(std::mutex& m : _locks) {
+		m.lock();
+	}
+	for(Entry& e : _table) {
+		e.used = false;
+	}
+	for(std::mutex& m : _locks) {
+		m.unlock();
+	}
+	_hits = 0;
+	_misses = 0;
+}
+
+/* policy_fn answering from cache first and filling it with what it computes */
+template<typename State>
+typename mcts::MCTS<State>::PolicyFunction cached(const typename mcts::MCTS<State>::PolicyFunction& policy_fn, std::shared_ptr<EvalCache<State>> cache) {
+	return [policy_fn, cache](const State& state) {
+		typename EvalCache<State>::EvalResult result;
+		if(!cache->lookup(state, result)) {
+			result = policy_fn(state);
+			cache->store(state, result);
+		}
+		return result;
+	};
+}
+
+/* The same for BatchMCTS: only the positions missing from cache go to policy_fn, as one smaller batch */
+template<typename State>
+typename mcts::BatchMCTS<State>::PolicyFunction batch_cached(const typename mcts::BatchMCTS<State>::PolicyFunction& policy_fn, std::shared_ptr<EvalCache<State>> cache) {
+	typedef typename mcts::BatchMCTS<State>::EvalResult EvalResult;
+	return [policy_fn, cache](const std::vector<State>& states, std::vector<EvalResult>& results, int n, void* buffer) {
+		std::vector<State> missed;
+		std::vector<int> slots;
+		for(int i = 0; i < n; i++) {
+			if(!cache->lookup(states[i], results[i])) {
+				missed.push_back(states[i]);
+				slots.push_back(i);
+			}
+		}
+		if(missed.empty()) {
+			return;
+		}
+		std::vector<EvalResult> missed_results(missed.size());
+		policy_fn(missed, missed_results, (int)missed.size(), buffer);
+		for(std::size_t j = 0; j < missed.size(); j++) {
+			cache->store(missed[j], missed_results[j]);
+			results[slots[j]] = std::move(missed_results[j]);
+		}
+	};
+}
+
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef EVALUATORS_H
+#define EVALUATORS_H
+
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include "mcts.h"
+#include "Piece.h"
+#include "Move.h"
+
+namespace elder_chess {
+
+/*
+	Network free leaf evaluators for MCTS and BatchMCTS, for baselines,
+	bootstrapping training and running without an inference backend. They
+	give every legal move the same prior and differ in the value: the mean
+	outcome of random playouts or a material and mobility heuristic. Both
+	keep no shared state, so every search thread can call them at once.
+*/
+template<typename State>
+class UniformPriors {
+public:
+	typedef std::pair<std::vector<std::pair<typename State::Move, double>>, double> EvalResult;
+
+protected:
+	static std::vector<std::pair<typename State::Move, double>> _priors(const State& state) {
+		std::vector<typename State::Move> moves = state.get_moves();
+		std::vector<std::pair<typename State::Move, double>> priors(moves.size());
+		for(std::size_t i = 0; i < moves.size(); i++) {
+			priors[i] = std::make_pair(moves[i], 1. / moves.size());
+		}
+		return priors;
+	}
+};
+
+/*
+	Values a position by the mean result of n_rollouts games played on from
+	it with uniformly random moves and flips, for the player to move. The
+	rollouts of a position depend on it and seed alone.
+*/
+template<typename State>
+class RolloutEvaluator final : public UniformPriors<State> {
+public:
+	typedef typename UniformPriors<State>::EvalResult EvalResult;
+
+	explicit RolloutEvaluator(int n_rollouts, uint64_t seed = mcts::rng()) : _n_rollouts(n_rollouts), _seed(seed) {
+		if(n_rollouts < 1) {
+			throw std::invalid_argument("n_rollouts must be positive");
+		}
+	}
+
+	EvalResult operator()(const State& state) const {
+		return std::make_pair(this->_priors(state), value(state));
+	}
+
+	double value(const State& state) const {
+		// drawn from the position's own stream: threads never wait on each other and seeded searches repeat
+		prng::Xoshiro256 engine(prng::derive(_seed, {state.hash()}));
+		Side player = state.get_current_player();
+		double total = 0.;
+		for(int i = 0; i < _n_rollouts; i++) {
+			State rollout(state);
+			while(!rollout.game_ended()) {
+				rollout.do_random_move(&engine);
+			}
+			Side winner = rollout.get_winner();
+			if(winner == player) {
+				total += 1.;
+			} else if(winner == 1 - player) {
+				total -= 1.;
+			}
+		}
+		return total / _n_rollouts;
+	}
+
+private:
+	int _n_rollouts;
+	uint64_t _seed;
+};
+
+/*
+	Values a position by material, counting face down pieces since they are
+	still on the board, and by how freely the face up pieces can move. Kept
+	strictly inside (-1, 1) so finished games still score higher.
+*/
+template<typename State>
+class HeuristicEvaluator final : public UniformPriors<State> {
+public:
+	typedef typename UniformPriors<State>::EvalResult EvalResult;
+
+	EvalResult operator()(const State& state) const {
+		return std::make_pair(this->_priors(state), value(state));
+	}
+
+	static double value(const State& state) {
+		// piece 0 is weak but the only one that takes piece 3
+		static const double PIECE_WEIGHTS[4] = { 1.2, 1., 1.4, 1.8 };
+		static const double MATERIAL_WEIGHT = 0.5;
+		static const double MOBILITY_WEIGHT = 0.05;
+		Side player = state.get_current_player();
+		Side opponent = 1 - player;
+		double material = 0.;
+		for(int value = 0; value < 4; value++) {
+			material += PIECE_WEIGHTS[value] * (state.get_num_on_board(player, value) - state.get_num_on_board(opponent, value));
+		}
+		int mobility = state.get_num_piece_moves(player) - state.get_num_piece_moves(opponent);
+		return 0.9 * std::tanh(MATERIAL_WEIGHT * material + MOBILITY_WEIGHT * mobility);
+	}
+};
+
+/* Runs a single position evaluator over every slot of a BatchMCTS batch */
+template<typename State, typename Evaluator>
+typename mcts::BatchMCTS<State>::PolicyFunction batched(const Evaluator& evaluator) {
+	return [evaluator](const std::vector<State>& states, std::vector<typename mcts::BatchMCTS<State>::EvalResult>& results, int n, void*) {
+		for(int i = 0; i < n; i++) {
+			results[i] = evaluator(states[i]);
+		}
+	};
+}
+
+}
+
+#endif
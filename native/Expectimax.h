@@ -0,0 +1,436 @@
+#ifndef EXPECTIMAX_H
+#define EXPECTIMAX_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "Piece.h"
+#include "Move.h"
+#include "Symmetry.h"
+
+namespace elder_chess {
+
+/*
+	Depth limited expectimax with alpha-beta pruning over Board's do_move.
+
+	Decision nodes are searched negamax style for the player to move. Chance
+	nodes (a FLIP waiting for its outcome) are valued for the player who
+	flipped, as the get_env_move_weights weighted mean of the outcomes, and
+	pruned with Star2: every outcome is first probed with its best ordered
+	move, which bounds what the opponent can get there, and the outcomes are
+	then searched with Star1 windows narrowed by those bounds.
+
+	Depth counts player moves only. Values lie in [-1, 1]: finished games
+	score exactly -1, 0 or 1 and the horizon is scored by material strictly
+	inside that. A value is resolved when no line it depends on was cut by the
+	horizon, so a resolved root value is the game theoretic one and ends the
+	iterative deepening.
+*/
+template<typename State>
+class Expectimax final {
+public:
+
+	static const int MAX_DEPTH = 127;
+
+	struct Result {
+		Move move = Move(Move::Type::NONE, 0, 0);
+		double value = 0.;		// for the player to move
+		int depth = 0;			// deepest completed iteration
+		bool exact = false;		// value is the game theoretic one
+		uint64_t nodes = 0;
+		double seconds = 0.;
+	};
+
+	/* The transposition table has 2^tt_bits entries and is kept between searches */
+	explicit Expectimax(int tt_bits = 20) {
+		if(tt_bits < 1 || tt_bits > 30) {
+			throw std::invalid_argument("tt_bits must be in [1, 30]");
+		}
+		_table.resize(std::size_t(1) << tt_bits);
+		_mask = _table.size() - 1;
+	}
+
+	/*
+		Iterative deepening until the value is exact, max_depth is done or the
+		time (seconds > 0) or node (max_nodes > 0) budget runs out, in which
+		case the last completed iteration is returned.
+	*/
+	Result search(const State& state, double seconds, int max_depth = MAX_DEPTH, uint64_t max_nodes = 0);
+
+	/*
+		Game theoretic value of state from PLAYER_0's point of view, if it can
+		be proven within max_nodes; the leaf solver form used by the searches.
+	*/
+	bool solve(const State& state, uint64_t max_nodes, double& value_p0);
+
+	void clear() {
+		std::fill(_table.begin(), _table.end(), Entry());
+	}
+
+private:
+
+	typedef std::chrono::steady_clock clock;
+
+	enum : uint8_t { NO_MOVE = 0xff };
+
+	enum Bound : uint8_t { EXACT, LOWER, UPPER };
+
+	struct Entry {
+		uint64_t key = 0;
+		double value = 0.;
+		int8_t depth = -1;
+		uint8_t bound = EXACT;
+		uint8_t move = NO_MOVE;
+		bool resolved = false;
+	};
+
+	static inline int _side(const State& s) {
+		int p = s.get_current_player();
+		return p >= 0 ? p : -p - 1;
+	}
+
+	static inline double _score(Side winner, int side) {
+		return winner == Sides::DRAW ? 0. : (winner == side ? 1. : -1.);
+	}
+
+	static double _evaluate(const State& s, int side);
+
+	static void _order(const State& s, std::vector<Move>& moves, uint8_t first);
+
+	inline bool _out_of_budget() {
+		_nodes++;
+		if(_max_nodes > 0 && _nodes > _max_nodes) {
+			_aborted = true;
+		} else if(_timed && (_nodes & 1023) == 0 && clock::now() >= _deadline) {
+			_aborted = true;
+		}
+		return _aborted;
+	}
+
+	/* Value of s for side */
+	inline double _search(const State& s, int depth, int side, double alpha, double beta, bool& resolved) {
+		if(_side(s) == side) {
+			return _node(s, depth, alpha, beta, resolved);
+		}
+		return -_node(s, depth, -beta, -alpha, resolved);
+	}
+
+	/* Value of s for _side(s) */
+	double _node(const State& s, int depth, double alpha, double beta, bool& resolved);
+
+	double _decision(const State& s, int depth, double alpha, double beta, uint8_t tt_move, uint8_t& best_move, bool& resolved);
+
+	double _chance(const State& s, int depth, double alpha, double beta, bool& resolved);
+
+	void _store(uint64_t key, double value, int depth, double alpha, double beta, uint8_t move, bool resolved);
+
+	std::vector<Entry> _table;
+	std::size_t _mask;
+
+	uint64_t _nodes = 0;
+	uint64_t _max_nodes = 0;
+	bool _timed = false;
+	clock::time_point _deadline;
+	bool _aborted = false;
+};
+
+template<typename State>
+typename Expectimax<State>::Result Expectimax<State>::search(const State& state, double seconds, int max_depth, uint64_t max_nodes) {
+	if(state.is_env_move()) {
+		throw std::invalid_argument("expectimax search needs a player to move, not a pending flip");
+	}
+	auto start = clock::now();
+	_nodes = 0;
+	_max_nodes = max_nodes;
+	_timed = seconds > 0.;
+	_deadline = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(std::max(seconds, 0.)));
+	_aborted = false;
+
+	Result ret;
+	Side winner = state.get_winner();
+	if(winner != Sides::NONE) {
+		ret.value = _score(winner, _side(state));
+		ret.exact = true;
+	} else {
+		const double inf = std::numeric_limits<double>::infinity();
+		uint64_t key = state.hash();
+		for(int depth = 1; depth <= std::min(max_depth, (int)MAX_DEPTH); depth++) {
+			_nodes++;
+			const Entry& e = _table[key & _mask];
+			uint8_t best_move = NO_MOVE;
+			bool resolved = false;
+			double value = _decision(state, depth, -inf, inf, e.key == key ? e.move : NO_MOVE, best_move, resolved);
+			if(_aborted) {
+				break;
+			}
+			_store(key, value, depth, -inf, inf, best_move, resolved);
+			ret.depth = depth;
+			ret.value = value;
+			ret.exact = resolved;
+			auto&& moves = state.get_moves();
+			for(const Move& m : moves) {
+				if(Symmetry::move_index(m) == best_move) {
+					ret.move = m;
+				}
+			}
+			if(resolved) {
+				break;
+			}
+		}
+		if(ret.depth == 0) {
+			// not even one iteration finished: fall back to the best ordered move
+			auto&& moves = state.get_moves();
+			_order(state, moves, NO_MOVE);
+			ret.move = moves[0];
+			ret.value = _evaluate(state, _side(state));
+		}
+	}
+	ret.nodes = _nodes;
+	ret.seconds = std::chrono::duration<double>(clock::now() - start).count();
+	return ret;
+}
+
+template<typename State>
+bool Expectimax<State>::solve(const State& state, uint64_t max_nodes, double& value_p0) {
+	Result r = search(state, 0., MAX_DEPTH, max_nodes);
+	if(!r.exact) {
+		return false;
+	}
+	value_p0 = state.get_current_player() == Sides::PLAYER_0 ? r.value : -r.value;
+	return true;
+}
+
+template<typename State>
+double Expectimax<State>::_node(const State& s, int depth, double alpha, double beta, bool& resolved) {
+	if(_out_of_budget()) {
+		resolved = false;
+		return 0.;
+	}
+	int side = _side(s);
+	if(!s.is_env_move()) {
+		Side winner = s.get_winner();
+		if(winner != Sides::NONE) {
+			resolved = true;
+			return _score(winner, side);
+		}
+	}
+
+	uint64_t key = s.hash();
+	const Entry& e = _table[key & _mask];
+	uint8_t tt_move = NO_MOVE;
+	if(e.key == key) {
+		tt_move = e.move;
+		if((e.resolved || e.depth >= depth)
+			&& (e.bound == EXACT || (e.bound == LOWER && e.value >= beta) || (e.bound == UPPER && e.value <= alpha))) {
+			resolved = e.resolved;
+			return e.value;
+		}
+	}
+	if(depth == 0 && !s.is_env_move()) {
+		resolved = false;
+		return _evaluate(s, side);
+	}
+
+	uint8_t best_move = NO_MOVE;
+	double value = s.is_env_move()
+		? _chance(s, depth, alpha, beta, resolved)
+		: _decision(s, depth, alpha, beta, tt_move, best_move, resolved);
+	if(!_aborted) {
+		_store(key, value, depth, alpha, beta, best_move, resolved);
+	}
+	return value;
+}
+
+template<typename State>
+double Expectimax<State>::_decision(const State& s, int depth, double alpha, double beta, uint8_t tt_move, uint8_t& best_move, bool& resolved) {
+	int side = _side(s);
+	auto&& moves = s.get_moves();
+	_order(s, moves, tt_move);
+	double best = -std::numeric_limits<double>::infinity();
+	resolved = true;
+	for(const Move& m : moves) {
+		State child(s);
+		child.do_move(m);
+		bool r = false;
+		double v = _search(child, depth - 1, side, alpha, beta, r);
+		if(_aborted) {
+			return 0.;
+		}
+		if(v > best) {
+			best = v;
+			best_move = Symmetry::move_index(m);
+		}
+		alpha = std::max(alpha, best);
+		if(alpha >= beta) {
+			// the lower bound only rests on this move
+			resolved = r;
+			break;
+		}
+		resolved = resolved && r;
+	}
+	return best;
+}
+
+template<typename State>
+double Expectimax<State>::_chance(const State& s, int depth, double alpha, double beta, bool& resolved) {
+	int side = _side(s);
+	auto&& outcomes = s.get_env_move_weights();
+	std::size_t n = outcomes.size();
+	double total = 0.;
+	for(auto& o : outcomes) {
+		total += o.second;
+	}
+
+	std::vector<State> children(n, s);
+	std::vector<double> p(n), lb(n, -1.), ub(n, 1.);
+	std::vector<bool> bound_resolved(n, true);
+	double sum_lb = 0., sum_ub = 0.;
+	for(std::size_t i = 0; i < n; i++) {
+		children[i].do_move(outcomes[i].first);
+		p[i] = outcomes[i].second / total;
+	}
+
+	// Star2 probing: the opponent gets at least the value of any one of their moves
+	if(depth > 0) {
+		double probed_ub = 0., probed_p = 0.;
+		for(std::size_t i = 0; i < n; i++) {
+			const State& child = children[i];
+			int child_side = _side(child);
+			if(child_side != side && child.get_winner() == Sides::NONE) {
+				uint64_t key = child.hash();
+				const Entry& e = _table[key & _mask];
+				auto&& moves = child.get_moves();
+				_order(child, moves, e.key == key ? e.move : NO_MOVE);
+				State probe(child);
+				probe.do_move(moves[0]);
+				bool r = false;
+				double w = _search(probe, depth - 1, child_side, -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::infinity(), r);
+				if(_aborted) {
+					return 0.;
+				}
+				ub[i] = -w;
+				bound_resolved[i] = r;
+			}
+			probed_ub += p[i] * ub[i];
+			probed_p += p[i];
+			// the outcomes not probed yet can give at most 1
+			if(probed_ub + (1. - probed_p) <= alpha) {
+				resolved = std::all_of(bound_resolved.begin(), bound_resolved.begin() + i + 1, [](bool b) { return b; });
+				return probed_ub + (1. - probed_p);
+			}
+		}
+	}
+
+	// Star1: search each outcome with the window that can still move the mean across (alpha, beta)
+	for(std::size_t i = 0; i < n; i++) {
+		sum_lb += p[i] * lb[i];
+		sum_ub += p[i] * ub[i];
+	}
+	double sum = 0.;
+	resolved = true;
+	for(std::size_t i = 0; i < n; i++) {
+		sum_lb -= p[i] * lb[i];
+		sum_ub -= p[i] * ub[i];
+		if(sum + p[i] * ub[i] + sum_ub <= alpha) {
+			resolved = resolved && std::all_of(bound_resolved.begin() + i, bound_resolved.end(), [](bool b) { return b; });
+			return sum + p[i] * ub[i] + sum_ub;
+		}
+		if(sum + p[i] * lb[i] + sum_lb >= beta) {
+			return sum + p[i] * lb[i] + sum_lb;
+		}
+		double a = (alpha - sum - sum_ub) / p[i];
+		double b = (beta - sum - sum_lb) / p[i];
+		bool r = bound_resolved[i];
+		double v = ub[i];
+		if(lb[i] < ub[i]) {
+			v = _search(children[i], depth, side, std::max(a, lb[i]), std::min(b, ub[i]), r);
+			if(_aborted) {
+				return 0.;
+			}
+			v = std::min(std::max(v, lb[i]), ub[i]);
+		}
+		if(v <= a) {
+			resolved = resolved && r && std::all_of(bound_resolved.begin() + i + 1, bound_resolved.end(), [](bool b) { return b; });
+			return sum + p[i] * v + sum_ub;
+		}
+		if(v >= b) {
+			resolved = resolved && r;
+			return sum + p[i] * v + sum_lb;
+		}
+		sum += p[i] * v;
+		resolved = resolved && r;
+	}
+	return sum;
+}
+
+template<typename State>
+void Expectimax<State>::_store(uint64_t key, double value, int depth, double alpha, double beta, uint8_t move, bool resolved) {
+	Entry& e = _table[key & _mask];
+	e.key = key;
+	e.value = value;
+	e.depth = depth;
+	e.bound = value <= alpha ? UPPER : (value >= beta ? LOWER : EXACT);
+	e.move = move;
+	e.resolved = resolved;
+}
+
+/*
+	Material balance for side, squashed below the value of a finished game.
+	Stronger pieces count a little more; hidden pieces are split evenly in
+	expectation and left out.
+*/
+template<typename State>
+double Expectimax<State>::_evaluate(const State& s, int side) {
+	double material = 0.;
+	for(int i = 0; i < State::SIDE; i++) {
+		for(int j = 0; j < State::SIDE; j++) {
+			const Piece& p = s.at(i, j);
+			if(!p.isEmpty() && !p.isHidden()) {
+				double w = 1. + 0.1 * p.value;
+				material += p.getSide() == side ? w : -w;
+			}
+		}
+	}
+	return 0.9 * std::tanh(0.5 * material);
+}
+
+/*
+	first (a move index, usually from the transposition table), then captures
+	of the strongest piece by the weakest, then quiet moves, then flips.
+*/
+template<typename State>
+void Expectimax<State>::_order(const State& s, std::vector<Move>& moves, uint8_t first) {
+	static const int dx[] = { 0, -1, 1, 0, 0 };
+	static const int dy[] = { 0, 0, 0, -1, 1 };
+	std::vector<std::pair<int, Move>> scored(moves.size());
+	for(std::size_t i = 0; i < moves.size(); i++) {
+		const Move& m = moves[i];
+		int score = 0;
+		if(Symmetry::move_index(m) == first) {
+			score = 1000;
+		} else if(m.type == Move::Type::FLIP) {
+			score = -1;
+		} else {
+			const Piece& to = s.at(m.x + dx[(int)m.type], m.y + dy[(int)m.type]);
+			if(!to.isEmpty()) {
+				score = 100 + 10 * (to.value + 1) - s.at(m.x, m.y).value;
+			}
+		}
+		scored[i] = std::make_pair(score, m);
+	}
+	std::stable_sort(scored.begin(), scored.end(), [](const std::pair<int, Move>& a, const std::pair<int, Move>& b) {
+		return a.first > b.first;
+	});
+	for(std::size_t i = 0; i < moves.size(); i++) {
+		moves[i] = scored[i].second;
+	}
+}
+
+}
+
+#endif
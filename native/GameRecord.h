@@ -0,0 +1,572 @@
+#ifndef GAME_RECORD_H
+#define GAME_RECORD_H
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Move.h"
+#include "Symmetry.h"
+
+namespace elder_chess {
+
+/*
+	On-disk format for finished games. A file is a FileHeader followed by
+	records, each made of
+
+		RecordHeader
+		uint8_t  plies[n_plies]				every move including flip outcomes, padded to 8 bytes
+		uint16_t visits[n_decisions][80]	visit distribution of every player move, scaled to 65535
+
+	Records are only ever appended, positions are rebuilt by replaying plies
+	from a fresh board.
+
+	The writer keeps a sidecar index next to the file (index_path) of one
+	IndexEntry per record, so a reader opens any number of games by mapping
+	it instead of walking every record header. Records the index does not
+	cover yet, or all of them for a file without one, are still found by
+	that walk.
+*/
+namespace game_record {
+
+static const char FILE_MAGIC[8] = { 'A', 'E', 'C', 'G', 'R', 'E', 'C', '1' };
+static const char INDEX_MAGIC[8] = { 'A', 'E', 'C', 'G', 'I', 'D', 'X', '1' };
+static const uint32_t VERSION = 1;
+static const uint32_t RECORD_MAGIC = 0x454d4147; // "GAME"
+static const int POLICY_SIZE = Symmetry::NUM_MOVE_INDICES;
+
+struct FileHeader {
+	char magic[8];
+	uint32_t version;
+	int32_t max_steps;
+};
+
+struct IndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+};
+
+struct IndexEntry {
+	uint64_t offset;			// of the record in the file
+	uint64_t decisions_before;	// n_decisions of all earlier records
+};
+
+struct RecordHeader {
+	uint32_t magic;
+	uint32_t n_plies;
+	uint32_t n_decisions;
+	int32_t winner;
+	uint64_t seed;
+};
+
+/*
+	A ply in one byte: the low nibble is the square x * 4 + y (or, for a flip
+	outcome, side * 4 + value of the revealed piece), the high nibble the move type.
+*/
+inline uint8_t encode_move(const Move& m) {
+	if(m.type == Move::Type::ENV_RAND) {
+		Piece p = m.potential_piece;
+		return (((uint8_t)m.type) << 4) | (p.getSide() * 4 + p.value);
+	} else {
+		return (((uint8_t)m.type) << 4) | (m.x * 4 + m.y);
+	}
+}
+
+inline Move decode_move(uint8_t code) {
+	Move::Type type = (Move::Type)(code >> 4);
+	int low = code & 0xf;
+	if(type == Move::Type::ENV_RAND) {
+		return Move(Piece((Side)(low / 4), low % 4));
+	} else {
+		return Move(type, low / 4, low % 4);
+	}
+}
+
+inline std::size_t padded_plies_size(uint32_t n_plies) {
+	return (n_plies + 7) & ~(std::size_t)7;
+}
+
+inline std::size_t record_size(const RecordHeader& header) {
+	return sizeof(RecordHeader) + padded_plies_size(header.n_plies) + header.n_decisions * POLICY_SIZE * sizeof(uint16_t);
+}
+
+inline std::string index_path(const std::string& path) {
+	return path + ".idx";
+}
+
+/* A file mapped read only for as long as the object lives */
+class MappedFile final {
+
+public:
+
+	MappedFile() { }
+
+	~MappedFile() {
+		if(data != nullptr) {
+			munmap((void*)data, length);
+		}
+		if(_fd >= 0) {
+			::close(_fd);
+		}
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/* false if path cannot be opened or is empty */
+	bool open(const std::string& path) {
+		_fd = ::open(path.c_str(), O_RDONLY);
+		if(_fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if(fstat(_fd, &st) != 0 || st.st_size == 0) {
+			return false;
+		}
+		void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, _fd, 0);
+		if(mapped == MAP_FAILED) {
+			return false;
+		}
+		data = (const uint8_t*)mapped;
+		length = st.st_size;
+		return true;
+	}
+
+	const uint8_t* data = nullptr;
+	std::size_t length = 0;
+
+private:
+	int _fd = -1;
+};
+
+}
+
+class GameRecordWriter final {
+
+public:
+
+	GameRecordWriter(const std::string& path, int max_steps);
+
+	~GameRecordWriter() {
+		close();
+	}
+
+	/*
+		moves are all plies of the game in order (flip outcomes included),
+		policies holds POLICY_SIZE visit probabilities for each non-flip-outcome ply.
+	*/
+	template<typename T>
+	void append(uint64_t seed, const std::vector<Move>& moves, const T* policies, Side winner);
+
+	/* The records before the index entries, so a reader never finds an entry without its record */
+	void flush() {
+		if(_file != nullptr) {
+			fflush(_file);
+			fflush(_index);
+		}
+	}
+
+	void close() {
+		if(_file != nullptr) {
+			flush();
+			fclose(_file);
+			fclose(_index);
+			_file = nullptr;
+			_index = nullptr;
+		}
+	}
+
+private:
+
+	/*
+		Opens the index of path, rebuilding it if it is not one, and brings it
+		in line with the records: entries past the end of the file are dropped,
+		records it misses are added, and a torn last record is cut off.
+	*/
+	void _open_index(const std::string& path);
+
+	void _write_index_entry();
+
+	FILE* _file = nullptr;
+	FILE* _index = nullptr;
+	uint64_t _offset = 0;		// end of the last record
+	uint64_t _decisions = 0;	// in all records
+	std::vector<uint8_t> _buffer;
+};
+
+template<typename State>
+class GameRecordReader final {
+
+public:
+
+	GameRecordReader(const std::string& path);
+
+	GameRecordReader(const GameRecordReader&) = delete;
+	GameRecordReader& operator=(const GameRecordReader&) = delete;
+
+	inline std::size_t size() const {
+		return _indexed + _records.size();
+	}
+
+	inline std::size_t num_decisions() const {
+		return _num_decisions;
+	}
+
+	inline const game_record::RecordHeader& header(std::size_t game) const {
+		return *(const game_record::RecordHeader*)(_file.data + _offset(game));
+	}
+
+	inline Move ply(std::size_t game, std::size_t i) const {
+		return game_record::decode_move(_plies(game)[i]);
+	}
+
+	/*
+		The board after the first n_plies plies of game
+	*/
+	State position(std::size_t game, std::size_t n_plies) const;
+
+	/*
+		The board before the k-th player move of game and its visit distribution
+		(POLICY_SIZE entries, summing to 1). Returns the outcome for the player to move.
+	*/
+	template<typename T>
+	double decision(std::size_t game, std::size_t k, State& state, T* policy) const;
+
+	/*
+		Calls f(state, policy, outcome) for every decision of game, replaying it once.
+	*/
+	template<typename F>
+	void for_each_decision(std::size_t game, F&& f) const;
+
+private:
+
+	inline std::size_t _offset(std::size_t game) const {
+		return game < _indexed ? _index_entries[game].offset : _records.at(game - _indexed);
+	}
+
+	inline const uint8_t* _plies(std::size_t game) const {
+		return _file.data + _offset(game) + sizeof(game_record::RecordHeader);
+	}
+
+	inline const uint16_t* _visits(std::size_t game) const {
+		return (const uint16_t*)(_plies(game) + game_record::padded_plies_size(header(game).n_plies));
+	}
+
+	template<typename T>
+	static void _decode_policy(const uint16_t* visits, T* policy);
+
+	static double _outcome(Side winner, Side player);
+
+	/* Whether the record at offset lies whole within the file */
+	bool _valid_record(std::size_t offset) const;
+
+	/* Takes the entries of the index file that point at whole records; returns the end of the last */
+	std::size_t _load_index(const std::string& path);
+
+	game_record::MappedFile _file;
+	game_record::MappedFile _index_file;
+	const game_record::IndexEntry* _index_entries = nullptr;
+	std::size_t _indexed = 0;
+	int _max_steps;
+	std::vector<std::size_t> _records;	// offsets of the records after the indexed ones
+	std::size_t _num_decisions = 0;
+};
+
+inline GameRecordWriter::GameRecordWriter(const std::string& path, int max_steps) {
+	_file = fopen(path.c_str(), "ab+");
+	if(_file == nullptr) {
+		throw std::runtime_error("cannot open " + path);
+	}
+	fseek(_file, 0, SEEK_END);
+	if(ftell(_file) == 0) {
+		game_record::FileHeader header;
+		memcpy(header.magic, game_record::FILE_MAGIC, sizeof(header.magic));
+		header.version = game_record::VERSION;
+		header.max_steps = max_steps;
+		fwrite(&header, sizeof(header), 1, _file);
+		fflush(_file);
+	} else {
+		game_record::FileHeader header;
+		fseek(_file, 0, SEEK_SET);
+		if(fread(&header, sizeof(header), 1, _file) != 1
+			|| memcmp(header.magic, game_record::FILE_MAGIC, sizeof(header.magic)) != 0
+			|| header.version != game_record::VERSION
+			|| header.max_steps != max_steps) {
+			fclose(_file);
+			_file = nullptr;
+			throw std::runtime_error(path + " is not a compatible game record file");
+		}
+	}
+	_open_index(path);
+	fseek(_file, 0, SEEK_END);
+}
+
+inline void GameRecordWriter::_open_index(const std::string& path) {
+	std::string index_path = game_record::index_path(path);
+	_index = fopen(index_path.c_str(), "ab+");
+	game_record::IndexHeader index_header;
+	bool valid = _index != nullptr && fseek(_index, 0, SEEK_SET) == 0 && fread(&index_header, sizeof(index_header), 1, _index) == 1
+		&& memcmp(index_header.magic, game_record::INDEX_MAGIC, sizeof(index_header.magic)) == 0
+		&& index_header.version == game_record::VERSION;
+	if(!valid) {
+		if(_index != nullptr) {
+			fclose(_index);
+		}
+		_index = fopen(index_path.c_str(), "wb+");
+		if(_index == nullptr) {
+			fclose(_file);
+			_file = nullptr;
+			throw std::runtime_error("cannot open " + index_path);
+		}
+		memcpy(index_header.magic, game_record::INDEX_MAGIC, sizeof(index_header.magic));
+		index_header.version = game_record::VERSION;
+		index_header.reserved = 0;
+		fwrite(&index_header, sizeof(index_header), 1, _index);
+		fflush(_index);
+	}
+
+	fseek(_file, 0, SEEK_END);
+	uint64_t file_size = ftell(_file);
+	fseek(_index, 0, SEEK_END);
+	uint64_t n_entries = (ftell(_index) - sizeof(game_record::IndexHeader)) / sizeof(game_record::IndexEntry);
+	// a crash may have left entries whose records were never written
+	_offset = sizeof(game_record::FileHeader);
+	_decisions = 0;
+	while(n_entries > 0) {
+		game_record::IndexEntry entry;
+		game_record::RecordHeader header;
+		fseek(_index, sizeof(game_record::IndexHeader) + (n_entries - 1) * sizeof(entry), SEEK_SET);
+		if(fread(&entry, sizeof(entry), 1, _index) == 1 && fseek(_file, entry.offset, SEEK_SET) == 0
+			&& fread(&header, sizeof(header), 1, _file) == 1 && header.magic == game_record::RECORD_MAGIC
+			&& entry.offset + game_record::record_size(header) <= file_size) {
+			_offset = entry.offset + game_record::record_size(header);
+			_decisions = entry.decisions_before + header.n_decisions;
+			break;
+		}
+		n_entries--;
+	}
+	fflush(_index);
+	if(ftruncate(fileno(_index), sizeof(game_record::IndexHeader) + n_entries * sizeof(game_record::IndexEntry)) != 0) {
+		throw std::runtime_error("cannot truncate " + index_path);
+	}
+	fseek(_index, 0, SEEK_END);
+
+	// records appended without the index, by an old writer or before a crash
+	while(_offset < file_size) {
+		game_record::RecordHeader header;
+		fseek(_file, _offset, SEEK_SET);
+		if(fread(&header, sizeof(header), 1, _file) != 1 || header.magic != game_record::RECORD_MAGIC
+			|| _offset + game_record::record_size(header) > file_size) {
+			break;
+		}
+		_write_index_entry();
+		_offset += game_record::record_size(header);
+		_decisions += header.n_decisions;
+	}
+	if(_offset < file_size) {
+		fflush(_file);
+		if(ftruncate(fileno(_file), _offset) != 0) {
+			throw std::runtime_error("cannot truncate " + path);
+		}
+	}
+	fflush(_index);
+}
+
+inline void GameRecordWriter::_write_index_entry() {
+	game_record::IndexEntry entry;
+	entry.offset = _offset;
+	entry.decisions_before = _decisions;
+	if(fwrite(&entry, sizeof(entry), 1, _index) != 1) {
+		throw std::runtime_error("write failed");
+	}
+}
+
+template<typename T>
+void GameRecordWriter::append(uint64_t seed, const std::vector<Move>& moves, const T* policies, Side winner) {
+	if(_file == nullptr) {
+		throw std::runtime_error("writer is closed");
+	}
+	game_record::RecordHeader header;
+	header.magic = game_record::RECORD_MAGIC;
+	header.n_plies = moves.size();
+	header.n_decisions = 0;
+	for(const Move& m : moves) {
+		if(m.type != Move::Type::ENV_RAND) {
+			header.n_decisions++;
+		}
+	}
+	header.winner = winner;
+	header.seed = seed;
+
+	_buffer.assign(game_record::record_size(header), 0);
+	memcpy(_buffer.data(), &header, sizeof(header));
+	uint8_t* plies = _buffer.data() + sizeof(header);
+	for(std::size_t i = 0; i < moves.size(); i++) {
+		plies[i] = game_record::encode_move(moves[i]);
+	}
+	uint16_t* visits = (uint16_t*)(plies + game_record::padded_plies_size(header.n_plies));
+	for(std::size_t i = 0; i < header.n_decisions * game_record::POLICY_SIZE; i++) {
+		double p = std::min(std::max((double)policies[i], 0.), 1.);
+		visits[i] = (uint16_t)(p * 65535. + 0.5);
+	}
+	// a single write per record, so a crashed writer leaves at most one torn record at the end
+	if(fwrite(_buffer.data(), _buffer.size(), 1, _file) != 1) {
+		throw std::runtime_error("write failed");
+	}
+	_write_index_entry();
+	_offset += _buffer.size();
+	_decisions += header.n_decisions;
+}
+
+template<typename State>
+GameRecordReader<State>::GameRecordReader(const std::string& path) {
+	if(!_file.open(path)) {
+		throw std::runtime_error("cannot open " + path);
+	}
+	if(_file.length < sizeof(game_record::FileHeader)
+		|| memcmp(_file.data, game_record::FILE_MAGIC, sizeof(game_record::FILE_MAGIC)) != 0) {
+		throw std::runtime_error(path + " is not a game record file");
+	}
+	const game_record::FileHeader& file_header = *(const game_record::FileHeader*)_file.data;
+	if(file_header.version != game_record::VERSION) {
+		throw std::runtime_error(path + " is a game record file of unknown version " + std::to_string(file_header.version));
+	}
+	_max_steps = file_header.max_steps;
+
+	// only the record headers past the index are touched here, the payload is paged in on access
+	std::size_t offset = _load_index(path);
+	while(_valid_record(offset)) {
+		const game_record::RecordHeader& header = *(const game_record::RecordHeader*)(_file.data + offset);
+		_records.push_back(offset);
+		_num_decisions += header.n_decisions;
+		offset += game_record::record_size(header);
+	}
+}
+
+template<typename State>
+bool GameRecordReader<State>::_valid_record(std::size_t offset) const {
+	if(offset + sizeof(game_record::RecordHeader) > _file.length) {
+		return false;
+	}
+	const game_record::RecordHeader& header = *(const game_record::RecordHeader*)(_file.data + offset);
+	return header.magic == game_record::RECORD_MAGIC && offset + game_record::record_size(header) <= _file.length;
+}
+
+template<typename State>
+std::size_t GameRecordReader<State>::_load_index(const std::string& path) {
+	std::size_t first = sizeof(game_record::FileHeader);
+	if(!_index_file.open(game_record::index_path(path)) || _index_file.length < sizeof(game_record::IndexHeader)) {
+		return first;
+	}
+	const game_record::IndexHeader& index_header = *(const game_record::IndexHeader*)_index_file.data;
+	if(memcmp(index_header.magic, game_record::INDEX_MAGIC, sizeof(index_header.magic)) != 0
+		|| index_header.version != game_record::VERSION) {
+		return first;
+	}
+	_index_entries = (const game_record::IndexEntry*)(_index_file.data + sizeof(game_record::IndexHeader));
+	std::size_t n_entries = (_index_file.length - sizeof(game_record::IndexHeader)) / sizeof(game_record::IndexEntry);
+	if(n_entries == 0 || _index_entries[0].offset != first) {
+		return first;
+	}
+	// entries are written after their records, so only the last ones can be ahead of the file
+	while(n_entries > 0 && !_valid_record(_index_entries[n_entries - 1].offset)) {
+		n_entries--;
+	}
+	if(n_entries == 0) {
+		return first;
+	}
+	_indexed = n_entries;
+	const game_record::IndexEntry& last = _index_entries[n_entries - 1];
+	const game_record::RecordHeader& header = *(const game_record::RecordHeader*)(_file.data + last.offset);
+	_num_decisions = last.decisions_before + header.n_decisions;
+	return last.offset + game_record::record_size(header);
+}
+
+template<typename State>
+State GameRecordReader<State>::position(std::size_t game, std::size_t n_plies) const {
+	if(n_plies > header(game).n_plies) {
+		throw std::out_of_range("ply");
+	}
+	const uint8_t* plies = _plies(game);
+	State state(_max_steps);
+	for(std::size_t i = 0; i < n_plies; i++) {
+		state.do_move(game_record::decode_move(plies[i]));
+	}
+	return state;
+}
+
+template<typename State>
+template<typename T>
+double GameRecordReader<State>::decision(std::size_t game, std::size_t k, State& state, T* policy) const {
+	const game_record::RecordHeader& h = header(game);
+	if(k >= h.n_decisions) {
+		throw std::out_of_range("decision");
+	}
+	const uint8_t* plies = _plies(game);
+	state = State(_max_steps);
+	std::size_t seen = 0;
+	for(std::size_t i = 0; i < h.n_plies; i++) {
+		Move m = game_record::decode_move(plies[i]);
+		if(m.type != Move::Type::ENV_RAND) {
+			if(seen == k) {
+				break;
+			}
+			seen++;
+		}
+		state.do_move(m);
+	}
+	_decode_policy(_visits(game) + k * game_record::POLICY_SIZE, policy);
+	return _outcome(h.winner, state.get_current_player());
+}
+
+template<typename State>
+template<typename F>
+void GameRecordReader<State>::for_each_decision(std::size_t game, F&& f) const {
+	const game_record::RecordHeader& h = header(game);
+	const uint8_t* plies = _plies(game);
+	const uint16_t* visits = _visits(game);
+	float policy[game_record::POLICY_SIZE];
+	State state(_max_steps);
+	std::size_t k = 0;
+	for(std::size_t i = 0; i < h.n_plies; i++) {
+		Move m = game_record::decode_move(plies[i]);
+		if(m.type != Move::Type::ENV_RAND) {
+			_decode_policy(visits + (k++) * game_record::POLICY_SIZE, policy);
+			f((const State&)state, (const float*)policy, _outcome(h.winner, state.get_current_player()));
+		}
+		state.do_move(m);
+	}
+}
+
+template<typename State>
+template<typename T>
+void GameRecordReader<State>::_decode_policy(const uint16_t* visits, T* policy) {
+	double sum = 0.;
+	for(int i = 0; i < game_record::POLICY_SIZE; i++) {
+		sum += visits[i];
+	}
+	for(int i = 0; i < game_record::POLICY_SIZE; i++) {
+		policy[i] = sum > 0. ? T(visits[i] / sum) : T(0);
+	}
+}
+
+template<typename State>
+double GameRecordReader<State>::_outcome(Side winner, Side player) {
+	if(winner == Sides::DRAW || winner == Sides::NONE) {
+		return 0.;
+	}
+	return winner == player ? 1. : -1.;
+}
+
+}
+
+#endif
@@ -0,0 +1,727 @@
+#ifndef GAME_SERVER_H
+#define GAME_SERVER_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "mcts.h"
+#include "prng.hpp"
+
+namespace elder_chess {
+
+/*
+	Plays games against the search for many players at once over TCP: the
+	operations of chess_api.py, without XML-RPC or Python between a request
+	and its search. Every game keeps its board and search tree from move to
+	move, and the searches share a fixed set of threads fed by a bounded
+	queue, so a long search holds up nothing but its own game.
+
+	One request per line, "<tag> <operation> [arguments]", is answered by one
+	line, "<tag> OK [result]" or "<tag> ERR <reason>". The tag is any word of
+	the client's choosing: searches are answered when they finish, possibly
+	after later requests, so a connection can keep several games going.
+
+		start_game <id> [n_playout [move_time]]
+		check_game_started <id>            1 or 0
+		make_move <id> <move>              1 or 0, the move as "f x y" or "m x y up|down|left|right"
+		ai_make_move <id> [deadline]       the move played, searched within deadline seconds
+		display_board <id>                 the board, its line breaks sent as "\n"
+		get_winner <id>                    0, 1, 2 for a draw or -1
+		game_ended <id>                    1 or 0
+		end_game <id>
+		stats                              "key=value" counters
+
+	A flip is followed by its outcome at once, as in chess_api.py. move_time
+	is 0 for none or at least MIN_MOVE_TIME seconds. A search is refused
+	with "ERR busy" while max_queued others are waiting, and with
+	"ERR deadline" when its deadline passes before a thread is free or
+	leaves it no time to search; one that starts stops in time to be
+	answered within it. Until it is answered, make_move, start_game and
+	ai_make_move on its game are refused with "ERR searching" and the other
+	operations see the board before it.
+*/
+template<typename State>
+class GameServer final {
+
+public:
+
+	typedef typename State::Move Move;
+	typedef typename mcts::MCTS<State>::PolicyFunction PolicyFunction;
+	typedef typename mcts::MCTS<State>::LeafSolver LeafSolver;
+	typedef std::function<void(const std::string&)> Reply;
+
+	struct Options {
+		std::string host = "127.0.0.1";
+		int port = 1027;
+		std::size_t search_threads = 4;
+		std::size_t max_queued = 64;
+		std::size_t max_games = 10000;
+		double c_puct = 5.;
+		unsigned int n_playout = 10000;	// start_game defaults
+		double move_time = 5.;
+		bool early_stop = true;
+		double extension = 1.5;
+		double deadline = 0.;			// seconds, for ai_make_move without one; 0 for none
+		uint64_t seed = mcts::rng();	// of the flips, move sampling and searches of every game
+	};
+
+	/* Times in seconds, from a search's arrival to its start (wait) and from there to its answer */
+	struct Stats {
+		std::size_t games = 0;
+		std::size_t connections = 0;
+		std::size_t queued = 0;
+		std::size_t running = 0;
+		uint64_t completed = 0;
+		uint64_t rejected = 0;
+		uint64_t expired = 0;
+		uint64_t failed = 0;
+		double mean_wait = 0.;
+		double max_wait = 0.;
+		double mean_search = 0.;
+	};
+
+	/* policy_fn is called from every search thread at once */
+	GameServer(const PolicyFunction& policy_fn, const Options& options);
+
+	~GameServer();
+
+	/* Accepts and answers connections until stop(); throws std::system_error if it cannot listen */
+	void serve();
+
+	/*
+		Makes serve() return, or the next call if none is running, once its
+		connections are closed; searches already queued are still answered.
+	*/
+	void stop();
+
+	/* Answers line as if it came from a connection; searches are answered later, from a search thread */
+	void handle(const std::string& line, const Reply& reply);
+
+	/* For games started from now on */
+	inline void set_leaf_solver(const LeafSolver& solver) {
+		std::lock_guard<std::mutex> lock(_games_mutex);
+		_leaf_solver = solver;
+	}
+
+	Stats stats() const;
+
+private:
+
+	typedef std::chrono::steady_clock clock;
+
+	static const std::size_t MAX_LINE = 4096;
+
+	// shortest move_time besides 0 (none): below it a search is all overhead
+	static constexpr double MIN_MOVE_TIME = 1e-3;
+
+	/*
+		mutex guards board and searching, and is never held through a search:
+		while searching, the search thread alone uses search and rng, and
+		board is the last position played until it publishes the next one.
+	*/
+	struct Game {
+		std::mutex mutex;
+		State board;
+		std::unique_ptr<mcts::MCTS<State>> search;
+		prng::Xoshiro256 rng;
+		unsigned int n_playout;
+		double move_time;
+		bool searching = false; // an ai_make_move queued or running, until it is answered
+	};
+
+	struct Job {
+		std::shared_ptr<Game> game;
+		std::string tag;
+		Reply reply;
+		clock::time_point arrival;
+		clock::time_point deadline;
+	};
+
+	struct Connection {
+		int fd;
+		std::mutex write_mutex;
+
+		explicit Connection(int fd) : fd(fd) { }
+
+		// closed only once no search is left to answer on it
+		~Connection() { ::close(fd); }
+
+		void send_line(const std::string& line) {
+			std::string data = line + "\n";
+			std::lock_guard<std::mutex> lock(write_mutex);
+			std::size_t sent = 0;
+			while(sent < data.size()) {
+				ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+				if(n < 0 && errno == EINTR) {
+					continue;
+				}
+				if(n <= 0) {
+					return;
+				}
+				sent += n;
+			}
+		}
+	};
+
+	std::shared_ptr<Game> _find(const std::string& id);
+
+	/* Throws std::invalid_argument unless a search could run within n_playout and move_time */
+	static void _check_search_settings(unsigned int n_playout, double move_time);
+
+	void _start_game(const std::string& id, unsigned int n_playout, double move_time);
+
+	/* Plays the outcome of a pending flip on board, in game's tree as well */
+	void _env_move(Game& game, State& board);
+
+	void _queue_search(const std::string& tag, const std::shared_ptr<Game>& game, double deadline, const Reply& reply);
+
+	void _search_thread();
+
+	/*
+		Searches and plays the move of game, within deadline, into move as
+		text; returns false, playing nothing, if the deadline leaves no time
+		to come up with one.
+	*/
+	bool _play_search(Game& game, clock::time_point deadline, std::string& move_text);
+
+	void _serve_connection(std::shared_ptr<Connection> connection);
+
+	static std::string _escape(const std::string& text);
+
+	const PolicyFunction _policy_fn;
+	const Options _options;
+	LeafSolver _leaf_solver;
+
+	mutable std::mutex _games_mutex;
+	std::unordered_map<std::string, std::shared_ptr<Game>> _games;
+	uint64_t _games_started = 0;
+
+	mutable std::mutex _jobs_mutex;
+	std::condition_variable _jobs_ready;
+	std::deque<Job> _jobs;
+	std::vector<std::thread> _search_threads;
+	bool _closing = false;
+	std::size_t _running = 0;
+	uint64_t _completed = 0;
+	uint64_t _rejected = 0;
+	uint64_t _expired = 0;
+	uint64_t _failed = 0;
+	double _total_wait = 0.;
+	double _max_wait = 0.;
+	double _total_search = 0.;
+
+	mutable std::mutex _connections_mutex;
+	std::condition_variable _connections_closed;
+	std::vector<std::weak_ptr<Connection>> _connections;
+	std::size_t _open_connections = 0;
+	int _listener = -1;
+	bool _stopping = false;
+};
+
+template<typename State>
+GameServer<State>::GameServer(const PolicyFunction& policy_fn, const Options& options) :
+	_policy_fn(policy_fn),
+	_options(options)
+{
+	if(options.search_threads == 0) {
+		throw std::invalid_argument("search_threads must be positive");
+	}
+	_check_search_settings(options.n_playout, options.move_time);
+	for(std::size_t i = 0; i < options.search_threads; i++) {
+		_search_threads.emplace_back(&GameServer<State>::_search_thread, this);
+	}
+}
+
+template<typename State>
+GameServer<State>::~GameServer() {
+	stop();
+	{
+		std::lock_guard<std::mutex> lock(_jobs_mutex);
+		_closing = true;
+	}
+	_jobs_ready.notify_all();
+	for(std::thread& t : _search_threads) {
+		t.join();
+	}
+}
+
+template<typename State>
+void GameServer<State>::serve() {
+	int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+	if(listener < 0) {
+		throw std::system_error(errno, std::generic_category(), "socket");
+	}
+	int reuse = 1;
+	::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(_options.port);
+	if(::inet_pton(AF_INET, _options.host.c_str(), &address.sin_addr) != 1) {
+		::close(listener);
+		throw std::invalid_argument("host must be an IPv4 address: " + _options.host);
+	}
+	if(::bind(listener, (sockaddr*)&address, sizeof(address)) < 0 || ::listen(listener, 128) < 0) {
+		int error = errno;
+		::close(listener);
+		throw std::system_error(error, std::generic_category(), "listening on port " + std::to_string(_options.port));
+	}
+	{
+		std::lock_guard<std::mutex> lock(_connections_mutex);
+		_listener = listener;
+		if(_stopping) {
+			::shutdown(listener, SHUT_RDWR);
+		}
+	}
+
+	while(true) {
+		int fd = ::accept(listener, nullptr, nullptr);
+		int error = errno;
+		if(fd < 0 && (error == EMFILE || error == ENFILE)) {
+			// out of descriptors until some connection closes
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+		std::lock_guard<std::mutex> lock(_connections_mutex);
+		if(_stopping) {
+			if(fd >= 0) {
+				::close(fd);
+			}
+			break;
+		}
+		if(fd < 0) {
+			if(error == EINTR || error == ECONNABORTED || error == EMFILE || error == ENFILE) {
+				continue;
+			}
+			break;
+		}
+		auto connection = std::make_shared<Connection>(fd);
+		_connections.erase(std::remove_if(_connections.begin(), _connections.end(),
+			[](const std::weak_ptr<Connection>& c) { return c.expired(); }), _connections.end());
+		_connections.push_back(connection);
+		_open_connections++;
+		std::thread(&GameServer<State>::_serve_connection, this, connection).detach();
+	}
+
+	std::unique_lock<std::mutex> lock(_connections_mutex);
+	_connections_closed.wait(lock, [this]() { return _open_connections == 0; });
+	::close(listener);
+	_listener = -1;
+	_stopping = false;
+}
+
+template<typename State>
+void GameServer<State>::stop() {
+	std::lock_guard<std::mutex> lock(_connections_mutex);
+	_stopping = true;
+	if(_listener >= 0) {
+		::shutdown(_listener, SHUT_RDWR);
+	}
+	for(auto& c : _connections) {
+		if(auto connection = c.lock()) {
+			::shutdown(connection->fd, SHUT_RD);
+		}
+	}
+}
+
+template<typename State>
+void GameServer<State>::_serve_connection(std::shared_ptr<Connection> connection) {
+	Reply reply = [connection](const std::string& line) { connection->send_line(line); };
+	std::string pending;
+	char buffer[4096];
+	while(true) {
+		ssize_t n = ::recv(connection->fd, buffer, sizeof(buffer), 0);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n <= 0) {
+			break;
+		}
+		pending.append(buffer, n);
+		std::size_t start = 0, end;
+		while((end = pending.find('\n', start)) != std::string::npos) {
+			std::string line = pending.substr(start, end - start);
+			if(!line.empty() && line.back() == '\r') {
+				line.pop_back();
+			}
+			handle(line, reply);
+			start = end + 1;
+		}
+		pending.erase(0, start);
+		if(pending.size() > MAX_LINE) {
+			reply("- ERR line too long");
+			break;
+		}
+	}
+	::shutdown(connection->fd, SHUT_RDWR);
+	connection.reset();
+	reply = nullptr;
+	std::lock_guard<std::mutex> lock(_connections_mutex);
+	_open_connections--;
+	_connections_closed.notify_all();
+}
+
+template<typename State>
+void GameServer<State>::handle(const std::string& line, const Reply& reply) {
+	std::istringstream in(line);
+	std::string tag, op, id;
+	if(!(in >> tag)) {
+		return;
+	}
+	auto ok = [&](const std::string& result) {
+		reply(result.empty() ? tag + " OK" : tag + " OK " + result);
+	};
+	try {
+		in >> op;
+		if(op == "stats") {
+			Stats s = stats();
+			std::ostringstream out;
+			out << "games=" << s.games << " connections=" << s.connections << " queued=" << s.queued << " running=" << s.running
+				<< " completed=" << s.completed << " rejected=" << s.rejected << " expired=" << s.expired << " failed=" << s.failed
+				<< " mean_wait_ms=" << s.mean_wait * 1e3 << " max_wait_ms=" << s.max_wait * 1e3 << " mean_search_ms=" << s.mean_search * 1e3;
+			ok(out.str());
+			return;
+		}
+		if(!(in >> id)) {
+			throw std::invalid_argument(op.empty() ? "missing operation" : "missing game id");
+		}
+		std::string arg;
+		if(op == "start_game") {
+			unsigned int n_playout = _options.n_playout;
+			double move_time = _options.move_time;
+			if(in >> arg) {
+				n_playout = std::stoul(arg);
+			}
+			if(in >> arg) {
+				move_time = std::stod(arg);
+			}
+			_start_game(id, n_playout, move_time);
+			ok("");
+			return;
+		}
+		if(op == "check_game_started") {
+			std::lock_guard<std::mutex> lock(_games_mutex);
+			ok(_games.count(id) ? "1" : "0");
+			return;
+		}
+		if(op == "end_game") {
+			std::lock_guard<std::mutex> lock(_games_mutex);
+			_games.erase(id);
+			ok("");
+			return;
+		}
+
+		std::shared_ptr<Game> game = _find(id);
+		if(op == "ai_make_move") {
+			double deadline = _options.deadline;
+			if(in >> arg) {
+				deadline = std::stod(arg);
+			}
+			_queue_search(tag, game, deadline, reply);
+			return;
+		}
+		std::lock_guard<std::mutex> lock(game->mutex);
+		if(op == "make_move") {
+			std::string move_text;
+			std::getline(in, move_text);
+			if(game->searching) {
+				throw std::runtime_error("searching");
+			}
+			Move move;
+			try {
+				move = Move(move_text);
+			} catch(const std::exception&) {
+				ok("0");
+				return;
+			}
+			if(game->board.game_ended() || !game->board.do_move_safe(move, &game->rng)) {
+				ok("0");
+				return;
+			}
+			game->search->update_with_move(game->board, move);
+			_env_move(*game, game->board);
+			ok("1");
+		} else if(op == "display_board") {
+			std::ostringstream out;
+			out << game->board;
+			ok(_escape(out.str()));
+		} else if(op == "get_winner") {
+			ok(std::to_string((int)game->board.get_winner()));
+		} else if(op == "game_ended") {
+			ok(game->board.game_ended() ? "1" : "0");
+		} else {
+			throw std::invalid_argument("unknown operation " + op);
+		}
+	} catch(const std::exception& e) {
+		reply(tag + " ERR " + e.what());
+	}
+}
+
+template<typename State>
+std::shared_ptr<typename GameServer<State>::Game> GameServer<State>::_find(const std::string& id) {
+	std::lock_guard<std::mutex> lock(_games_mutex);
+	auto it = _games.find(id);
+	if(it == _games.end()) {
+		throw std::runtime_error("game not started");
+	}
+	return it->second;
+}
+
+template<typename State>
+void GameServer<State>::_check_search_settings(unsigned int n_playout, double move_time) {
+	if(n_playout == 0) {
+		throw std::invalid_argument("n_playout must be positive");
+	}
+	if(!(move_time == 0. || move_time >= MIN_MOVE_TIME)) {
+		std::ostringstream out;
+		out << "move_time must be 0 or at least " << MIN_MOVE_TIME;
+		throw std::invalid_argument(out.str());
+	}
+}
+
+template<typename State>
+void GameServer<State>::_start_game(const std::string& id, unsigned int n_playout, double move_time) {
+	_check_search_settings(n_playout, move_time);
+	std::shared_ptr<Game> game;
+	{
+		std::lock_guard<std::mutex> lock(_games_mutex);
+		auto it = _games.find(id);
+		if(it == _games.end()) {
+			if(_games.size() >= _options.max_games) {
+				throw std::runtime_error("too many games");
+			}
+			game = std::make_shared<Game>();
+			game->rng = prng::stream(_options.seed, {_games_started++});
+			game->search.reset(new mcts::MCTS<State>(_policy_fn, _options.c_puct, n_playout, game->rng()));
+			game->search->set_leaf_solver(_leaf_solver);
+			_games[id] = game;
+		} else {
+			game = it->second;
+		}
+	}
+	std::lock_guard<std::mutex> lock(game->mutex);
+	if(game->searching) {
+		throw std::runtime_error("searching");
+	}
+	game->board = State();
+	game->search->reset();
+	game->n_playout = n_playout;
+	game->move_time = move_time;
+	_env_move(*game, game->board);
+}
+
+template<typename State>
+void GameServer<State>::_env_move(Game& game, State& board) {
+	if(board.is_env_move() && !board.game_ended()) {
+		Move outcome = board.env_do_move(&game.rng);
+		game.search->update_with_move(board, outcome);
+	}
+}
+
+template<typename State>
+void GameServer<State>::_queue_search(const std::string& tag, const std::shared_ptr<Game>& game, double deadline, const Reply& reply) {
+	{
+		std::lock_guard<std::mutex> lock(game->mutex);
+		if(game->searching) {
+			throw std::runtime_error("searching");
+		}
+		if(game->board.game_ended()) {
+			throw std::runtime_error("game ended");
+		}
+		game->searching = true;
+	}
+	Job job{game, tag, reply, clock::now(), clock::time_point::max()};
+	if(deadline > 0.) {
+		job.deadline = job.arrival + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(deadline));
+	}
+	{
+		std::lock_guard<std::mutex> lock(_jobs_mutex);
+		if(_jobs.size() < _options.max_queued) {
+			_jobs.push_back(std::move(job));
+			_jobs_ready.notify_one();
+			return;
+		}
+		_rejected++;
+	}
+	std::lock_guard<std::mutex> lock(game->mutex);
+	game->searching = false;
+	throw std::runtime_error("busy");
+}
+
+template<typename State>
+void GameServer<State>::_search_thread() {
+	while(true) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(_jobs_mutex);
+			_jobs_ready.wait(lock, [this]() { return _closing || !_jobs.empty(); });
+			if(_jobs.empty()) {
+				return;
+			}
+			job = std::move(_jobs.front());
+			_jobs.pop_front();
+			_running++;
+		}
+		auto start = clock::now();
+		std::string answer;
+		bool expired = start >= job.deadline, failed = false;
+		if(expired) {
+			answer = job.tag + " ERR deadline";
+		} else {
+			try {
+				std::string move_text;
+				if(_play_search(*job.game, job.deadline, move_text)) {
+					answer = job.tag + " OK " + move_text;
+				} else {
+					answer = job.tag + " ERR deadline";
+					expired = true;
+				}
+			} catch(const std::exception& e) {
+				answer = job.tag + " ERR " + e.what();
+				failed = true;
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(job.game->mutex);
+			job.game->searching = false;
+		}
+		auto end = clock::now();
+		{
+			std::lock_guard<std::mutex> lock(_jobs_mutex);
+			_running--;
+			double wait = std::chrono::duration<double>(start - job.arrival).count();
+			_total_wait += wait;
+			_max_wait = std::max(_max_wait, wait);
+			if(expired) {
+				_expired++;
+			} else if(failed) {
+				_failed++;
+			} else {
+				_completed++;
+				_total_search += std::chrono::duration<double>(end - start).count();
+			}
+		}
+		job.reply(answer);
+	}
+}
+
+template<typename State>
+bool GameServer<State>::_play_search(Game& game, clock::time_point deadline, std::string& move_text) {
+	State board;
+	mcts::SearchLimits limits;
+	{
+		std::lock_guard<std::mutex> lock(game.mutex);
+		if(game.board.game_ended()) {
+			throw std::runtime_error("game ended");
+		}
+		board = game.board;
+		limits.playouts = game.n_playout;
+		limits.seconds = game.move_time;
+	}
+	limits.early_stop = _options.early_stop;
+	limits.extension = _options.extension;
+	if(deadline != clock::time_point::max()) {
+		// an extended search must still be done by the deadline
+		double left = std::chrono::duration<double>(deadline - clock::now()).count() / std::max(1., limits.extension);
+		if(left <= 0.) {
+			// SearchLimits would take it for no time limit at all
+			return false;
+		}
+		limits.seconds = limits.seconds > 0. ? std::min(limits.seconds, left) : left;
+	}
+	game.search->set_search_limits(limits);
+	// as MCTSPlayer: past the opening the most visited move, before it one sampled by visits
+	bool small_temp = board.get_total_steps() > 10;
+	auto move_probs = game.search->get_move_probs(board, small_temp);
+	const std::vector<double>& probs = move_probs.second;
+	double sum = 0.;
+	for(double p : probs) {
+		sum += p;
+	}
+	if(!(sum > 0.)) {
+		// no move has a visit to sample it by
+		return false;
+	}
+	std::size_t index = probs.size() - 1;
+	double u = prng::uniform(game.rng);
+	for(std::size_t i = 0; i < probs.size(); i++) {
+		u -= probs[i];
+		if(u < 0.) {
+			index = i;
+			break;
+		}
+	}
+	Move move = move_probs.first[index];
+	game.search->update_with_move_index(board, index);
+	board.do_move(move);
+	_env_move(game, board);
+	{
+		std::lock_guard<std::mutex> lock(game.mutex);
+		game.board = board;
+	}
+	std::ostringstream out;
+	out << move;
+	move_text = out.str();
+	return true;
+}
+
+template<typename State>
+typename GameServer<State>::Stats GameServer<State>::stats() const {
+	Stats s;
+	{
+		std::lock_guard<std::mutex> lock(_games_mutex);
+		s.games = _games.size();
+	}
+	{
+		std::lock_guard<std::mutex> lock(_connections_mutex);
+		s.connections = _open_connections;
+	}
+	std::lock_guard<std::mutex> lock(_jobs_mutex);
+	s.queued = _jobs.size();
+	s.running = _running;
+	s.completed = _completed;
+	s.rejected = _rejected;
+	s.expired = _expired;
+	s.failed = _failed;
+	uint64_t started = _completed + _expired + _failed;
+	s.mean_wait = started > 0 ? _total_wait / started : 0.;
+	s.max_wait = _max_wait;
+	s.mean_search = _completed > 0 ? _total_search / _completed : 0.;
+	return s;
+}
+
+template<typename State>
+std::string GameServer<State>::_escape(const std::string& text) {
+	std::string ret;
+	for(char c : text) {
+		if(c == '\\') {
+			ret += "\\\\";
+		} else if(c == '\n') {
+			ret += "\\n";
+		} else {
+			ret += c;
+		}
+	}
+	return ret;
+}
+
+}
+
+#endif
@@ -2,6 +2,8 @@
 #define PIECE_H
 
 #include <cassert>
+#include <cstddef>
+#include <ostream>
 
 namespace elder_chess {
 
@@ -0,0 +1,109 @@
+#ifndef REPLAY_BUFFER_H
+#define REPLAY_BUFFER_H
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+
+#include "CompactState.h"
+#include "Symmetry.h"
+
+namespace elder_chess {
+
+/*
+	Fixed capacity ring buffer of training samples. Positions are stored packed
+	and only once; the 8 board symmetries are applied while filling a batch.
+*/
+class ReplayBuffer final {
+
+public:
+
+	static const int POLICY_SIZE = Symmetry::NUM_MOVE_INDICES;
+
+	struct Sample {
+		PackedPosition position;
+		float outcome;
+		float policy[POLICY_SIZE];
+	};
+
+	ReplayBuffer(std::size_t capacity) :
+		_samples(capacity),
+		_capacity(capacity)
+	{
+		if(capacity == 0) {
+			throw std::invalid_argument("capacity");
+		}
+	}
+
+	/*
+		policy is indexed by type * 16 + x * 4 + y, outcome is from the point
+		of view of the player to move in position
+	*/
+	template<typename T>
+	void add(const PackedPosition& position, const T* policy, float outcome) {
+		Sample& sample = _samples[_head];
+		sample.position = position;
+		sample.outcome = outcome;
+		std::copy(policy, policy + POLICY_SIZE, sample.policy);
+		_head = (_head + 1) % _capacity;
+		_size = std::min(_size + 1, _capacity);
+	}
+
+	/*
+		Draws batch_size samples uniformly (with replacement) and writes them into
+		board_states[batch_size][9 * 16], hiddens[batch_size][8], remaining_steps[batch_size],
+		policies[batch_size][80] and outcomes[batch_size].
+	*/
+	template<typename T, typename RandomEngine>
+	void sample(std::size_t batch_size,
+		T* board_states, T* hiddens, T* remaining_steps, T* policies, T* outcomes,
+		bool augment, RandomEngine* engine) const
+	{
+		if(_size == 0) {
+			throw std::runtime_error("sample from empty buffer");
+		}
+		const Symmetry& symmetry = Symmetry::tables();
+		std::uniform_int_distribution<std::size_t> index_dist(0, _size - 1);
+		std::uniform_int_distribution<int> transform_dist(0, Symmetry::NUM_TRANSFORMS - 1);
+		for(std::size_t i = 0; i < batch_size; i++) {
+			const Sample& sample = _samples[index_dist(*engine)];
+			int t = augment ? transform_dist(*engine) : 0;
+			sample.position.unpack(
+				board_states + i * COMPACT_BOARD_SIZE,
+				hiddens + i * COMPACT_HIDDENS_SIZE,
+				remaining_steps + i,
+				t
+			);
+			T* policy = policies + i * POLICY_SIZE;
+			const int (&move_index_map)[POLICY_SIZE] = symmetry.move_index_map[t];
+			for(int k = 0; k < POLICY_SIZE; k++) {
+				policy[move_index_map[k]] = T(sample.policy[k]);
+			}
+			outcomes[i] = T(sample.outcome);
+		}
+	}
+
+	inline std::size_t size() const {
+		return _size;
+	}
+
+	inline std::size_t capacity() const {
+		return _capacity;
+	}
+
+	inline void clear() {
+		_head = 0;
+		_size = 0;
+	}
+
+private:
+	std::vector<Sample> _samples;
+	std::size_t _capacity;
+	std::size_t _head = 0;
+	std::size_t _size = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef SELF_PLAY_RUNNER_H
+#define SELF_PLAY_RUNNER_H
+
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#include "mcts.h"
+#include "CompactState.h"
+#include "Symmetry.h"
+#include "GameRecord.h"
+
+namespace elder_chess {
+
+/*
+	Plays n games concurrently against itself, one BatchMCTS search over all
+	unfinished games per move, and collects (position, visit distribution,
+	outcome) for every decision.
+*/
+template<typename State>
+class SelfPlayRunner final {
+
+public:
+
+	static const int POLICY_SIZE = Symmetry::NUM_MOVE_INDICES;
+
+	struct Options {
+		// moves are sampled proportionally to visits^(1 / temperature) until step small_temp_after
+		double temperature = 1.;
+		int small_temp_after = 10;
+		// after that the most visited move is mixed with Dirichlet noise, as MCTSPlayer.sample_move does
+		double dirichlet_alpha = 0.03;
+		double dirichlet_weight = 0.25;
+		// none of the above applies when the search uses a Gumbel root: its chosen move is played and its improved policy recorded
+	};
+
+	struct Trajectories {
+		std::vector<PackedPosition> positions;
+		std::vector<float> policies;	// POLICY_SIZE per position
+		std::vector<float> outcomes;	// from the point of view of the player to move
+		std::vector<int> game_indices;
+		std::vector<int> winners;		// per game, same encoding as Board::get_winner
+		std::vector<uint64_t> seeds;	// per game, seed of the flip outcomes
+		std::vector<std::vector<Move>> plies;	// per game, all moves including flip outcomes
+	};
+
+	SelfPlayRunner(mcts::BatchMCTS<State>& mcts, const Options& options) :
+		_mcts(mcts),
+		_options(options)
+	{ }
+
+	/*
+		Finished games are also appended to writer, if given, as soon as they end.
+	*/
+	template<typename RandomEngine>
+	Trajectories play(std::size_t n_games, const State& initial_state, RandomEngine* engine, GameRecordWriter* writer = nullptr);
+
+private:
+
+	template<typename RandomEngine>
+	std::size_t _select_move(const State& state, const std::vector<double>& probs, RandomEngine* engine) const;
+
+	mcts::BatchMCTS<State>& _mcts;
+	Options _options;
+};
+
+template<typename State>
+template<typename RandomEngine>
+typename SelfPlayRunner<State>::Trajectories SelfPlayRunner<State>::play(std::size_t n_games, const State& initial_state, RandomEngine* engine, GameRecordWriter* writer) {
+	Trajectories ret;
+	ret.winners.resize(n_games, Side(Sides::NONE));
+	ret.plies.resize(n_games);
+	std::vector<prng::Xoshiro256> env_engines;
+	for(std::size_t i = 0; i < n_games; i++) {
+		ret.seeds.push_back((*engine)());
+		env_engines.emplace_back(ret.seeds.back());
+	}
+
+	std::vector<State> states(n_games, initial_state);
+	std::vector<int> game_of(n_games);
+	for(std::size_t i = 0; i < n_games; i++) {
+		game_of[i] = i;
+	}
+	// per game list of (index into ret.positions, player to move)
+	std::vector<std::vector<std::pair<std::size_t, Side>>> decisions(n_games);
+
+	while(!states.empty()) {
+		_mcts.reset();
+		std::vector<bool> small_temp(states.size(), false);
+		auto&& move_probs = _mcts.get_move_probs(states, small_temp);
+
+		std::size_t n_active = 0;
+		for(std::size_t i = 0; i < states.size(); i++) {
+			State& state = states[i];
+			int game = game_of[i];
+			const std::vector<Move>& moves = move_probs[i].first;
+			const std::vector<double>& probs = move_probs[i].second;
+
+			decisions[game].push_back(std::make_pair(ret.positions.size(), state.get_current_player()));
+			ret.positions.push_back(PackedPosition::pack(state));
+			ret.game_indices.push_back(game);
+			ret.outcomes.push_back(0.f);
+			std::size_t offset = ret.policies.size();
+			ret.policies.resize(offset + POLICY_SIZE, 0.f);
+			for(std::size_t k = 0; k < moves.size(); k++) {
+				ret.policies[offset + Symmetry::move_index(moves[k])] = probs[k];
+			}
+
+			// sequential halving already sampled the move through its Gumbel noise
+			Move move = moves[_mcts.gumbel_root().max_considered > 0 ? _mcts.gumbel_choice(i) : _select_move(state, probs, engine)];
+			state.do_move(move);
+			ret.plies[game].push_back(move);
+			if(state.is_env_move()) {
+				ret.plies[game].push_back(state.env_do_move(&env_engines[game]));
+			}
+
+			if(state.game_ended()) {
+				Side winner = state.get_winner();
+				ret.winners[game] = winner;
+				for(auto& decision : decisions[game]) {
+					if(winner == Sides::DRAW) {
+						ret.outcomes[decision.first] = 0.f;
+					} else {
+						ret.outcomes[decision.first] = winner == decision.second ? 1.f : -1.f;
+					}
+				}
+				if(writer != nullptr) {
+					std::vector<float> policies;
+					for(auto& decision : decisions[game]) {
+						auto it = ret.policies.begin() + decision.first * POLICY_SIZE;
+						policies.insert(policies.end(), it, it + POLICY_SIZE);
+					}
+					writer->append(ret.seeds[game], ret.plies[game], policies.data(), winner);
+				}
+			} else {
+				states[n_active] = state;
+				game_of[n_active] = game;
+				n_active++;
+			}
+		}
+		states.resize(n_active);
+		game_of.resize(n_active);
+	}
+	_mcts.reset();
+	return ret;
+}
+
+template<typename State>
+template<typename RandomEngine>
+std::size_t SelfPlayRunner<State>::_select_move(const State& state, const std::vector<double>& probs, RandomEngine* engine) const {
+	std::vector<double> weights(probs.size());
+	if(state.get_total_steps() <= _options.small_temp_after) {
+		for(std::size_t k = 0; k < probs.size(); k++) {
+			weights[k] = std::pow(probs[k], 1. / _options.temperature);
+		}
+	} else {
+		std::size_t best = std::max_element(probs.begin(), probs.end()) - probs.begin();
+		if(_options.dirichlet_weight > 0.) {
+			std::gamma_distribution<double> gamma(_options.dirichlet_alpha, 1.);
+			double sum = 0.;
+			for(std::size_t k = 0; k < probs.size(); k++) {
+				weights[k] = gamma(*engine);
+				sum += weights[k];
+			}
+			for(std::size_t k = 0; k < probs.size(); k++) {
+				weights[k] = _options.dirichlet_weight * (sum > 0. ? weights[k] / sum : 1. / probs.size());
+			}
+		}
+		weights[best] += 1. - _options.dirichlet_weight;
+	}
+	std::discrete_distribution<std::size_t> dist(weights.begin(), weights.end());
+	return dist(*engine);
+}
+
+}
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef SYMMETRY_H
+#define SYMMETRY_H
+
+#include "Move.h"
+
+namespace elder_chess {
+
+/*
+	The 8 rotations/reflections of the 4x4 board. Transform t rotates the board
+	counterclockwise (t % 4) times (same as np.rot90) and then, if t >= 4,
+	mirrors it left-right (same as np.fliplr). Move directions are remapped so
+	that a transformed move is legal on the transformed board.
+*/
+struct Symmetry final {
+
+	static const int NUM_TRANSFORMS = 8;
+	static const int NUM_SQUARES = 16;
+	static const int NUM_MOVE_TYPES = 5;
+	static const int NUM_MOVE_INDICES = NUM_MOVE_TYPES * NUM_SQUARES;
+
+	// square_map[t][x * 4 + y] is where square (x, y) ends up under transform t
+	int square_map[NUM_TRANSFORMS][NUM_SQUARES];
+	// type_map[t][type] is the direction a FLIP/UP/DOWN/LEFT/RIGHT move becomes
+	int type_map[NUM_TRANSFORMS][NUM_MOVE_TYPES];
+	// move_index_map[t][i] is where policy entry i = type * 16 + x * 4 + y ends up
+	int move_index_map[NUM_TRANSFORMS][NUM_MOVE_INDICES];
+	// inverse[t] undoes transform t
+	int inverse[NUM_TRANSFORMS];
+
+	static inline const Symmetry& tables() {
+		static const Symmetry instance;
+		return instance;
+	}
+
+	static inline int move_index(const Move& m) {
+		return ((int)m.type) * NUM_SQUARES + m.x * 4 + m.y;
+	}
+
+	inline Move transform(const Move& m, int t) const {
+		if(m.type == Move::Type::ENV_RAND || m.type == Move::Type::NONE) {
+			return m;
+		}
+		int sq = square_map[t][m.x * 4 + m.y];
+		return Move((Move::Type)type_map[t][(int)m.type], sq / 4, sq % 4);
+	}
+
+private:
+
+	Symmetry() {
+		for(int t = 0; t < NUM_TRANSFORMS; t++) {
+			for(int s = 0; s < NUM_SQUARES; s++) {
+				int x = s / 4, y = s % 4;
+				for(int r = 0; r < t % 4; r++) {
+					// counterclockwise: (x, y) -> (3 - y, x)
+					int nx = 3 - y;
+					y = x;
+					x = nx;
+				}
+				if(t >= 4) {
+					y = 3 - y;
+				}
+				square_map[t][s] = x * 4 + y;
+			}
+			int types[NUM_MOVE_TYPES] = { 0, 1, 2, 3, 4 };
+			for(int r = 0; r < t % 4; r++) {
+				for(int k = 1; k < NUM_MOVE_TYPES; k++) {
+					types[k] = _rotate_type(types[k]);
+				}
+			}
+			if(t >= 4) {
+				for(int k = 1; k < NUM_MOVE_TYPES; k++) {
+					types[k] = _flip_type(types[k]);
+				}
+			}
+			for(int k = 0; k < NUM_MOVE_TYPES; k++) {
+				type_map[t][k] = types[k];
+				for(int s = 0; s < NUM_SQUARES; s++) {
+					move_index_map[t][k * NUM_SQUARES + s] = types[k] * NUM_SQUARES + square_map[t][s];
+				}
+			}
+		}
+		for(int t = 0; t < NUM_TRANSFORMS; t++) {
+			for(int u = 0; u < NUM_TRANSFORMS; u++) {
+				bool is_inverse = true;
+				for(int i = 0; i < NUM_MOVE_INDICES; i++) {
+					if(move_index_map[u][move_index_map[t][i]] != i) {
+						is_inverse = false;
+						break;
+					}
+				}
+				if(is_inverse) {
+					inverse[t] = u;
+					break;
+				}
+			}
+		}
+	}
+
+	static inline int _rotate_type(int type) {
+		switch((Move::Type)type) {
+			case Move::Type::UP: return (int)Move::Type::LEFT;
+			case Move::Type::LEFT: return (int)Move::Type::DOWN;
+			case Move::Type::DOWN: return (int)Move::Type::RIGHT;
+			case Move::Type::RIGHT: return (int)Move::Type::UP;
+			default: return type;
+		}
+	}
+
+	static inline int _flip_type(int type) {
+		switch((Move::Type)type) {
+			case Move::Type::LEFT: return (int)Move::Type::RIGHT;
+			case Move::Type::RIGHT: return (int)Move::Type::LEFT;
+			default: return type;
+		}
+	}
+};
+
+}
+
+#endif
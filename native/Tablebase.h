@@ -0,0 +1,441 @@
+#ifndef TABLEBASE_H
+#define TABLEBASE_H
+
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Piece.h"
+#include "threading.hpp"
+
+namespace elder_chess {
+
+/*
+	Endgame tablebase: the exact value of every position with no face down
+	pieces and at most max_pieces pieces on the board, for every number of
+	remaining steps. Without flips left the game is deterministic, so values
+	are win/draw/loss for the player to move.
+
+	A file is a FileHeader followed by the values packed 4 to a byte (entry i
+	in bits 2 * (i % 4) of byte i / 4), in the order of tablebase::Index.
+*/
+namespace tablebase {
+
+static const char FILE_MAGIC[8] = { 'A', 'E', 'C', 'T', 'B', 'A', 'S', '1' };
+
+struct FileHeader {
+	char magic[8];
+	uint32_t version;
+	int32_t max_pieces;
+	int32_t max_steps;
+	int32_t dynamic_steps;
+	uint64_t n_entries;
+};
+
+// for the player to move
+enum Value : uint8_t { LOSS = 0, DRAW = 1, WIN = 2, UNKNOWN = 3 };
+
+static const int NUM_SQUARES = 16;
+static const int NUM_KINDS = 8;			// side * 4 + value
+static const int MAX_PER_KIND = 2;
+static const int NUM_MATERIAL_CODES = 6561;	// 3 ^ NUM_KINDS
+
+/*
+	Perfect index of the positions in a table. Positions are grouped by
+	material (how many of each kind of piece are on the board, coded in base 3),
+	with fewer pieces first so a capture always leads to an earlier group.
+	Within a group the index is
+
+		((remaining_steps - 1) * placements + placement) * 2 + player
+
+	where placement ranks where each kind stands: kind by kind, its squares
+	as a combination of the squares the earlier kinds left free.
+*/
+class Index final {
+public:
+
+	struct Material {
+		int counts[NUM_KINDS];
+		int n_pieces;
+		uint64_t placements;
+		uint64_t offset;
+	};
+
+	Index() = default;
+
+	Index(int max_pieces, int max_steps) :
+		_max_steps(max_steps),
+		_material_of(NUM_MATERIAL_CODES, -1)
+	{
+		for(int n = 1; n <= max_pieces; n++) {
+			for(int code = 0; code < NUM_MATERIAL_CODES; code++) {
+				Material m;
+				m.n_pieces = 0;
+				m.placements = 1;
+				for(int k = 0, c = code, free = NUM_SQUARES; k < NUM_KINDS; k++, c /= 3) {
+					m.counts[k] = c % 3;
+					m.n_pieces += m.counts[k];
+					m.placements *= _choose(free, m.counts[k]);
+					free -= m.counts[k];
+				}
+				if(m.n_pieces != n) {
+					continue;
+				}
+				m.offset = _size;
+				_size += m.placements * max_steps * 2;
+				_material_of[code] = _materials.size();
+				_materials.push_back(m);
+			}
+		}
+	}
+
+	inline uint64_t size() const {
+		return _size;
+	}
+
+	inline const std::vector<Material>& materials() const {
+		return _materials;
+	}
+
+	/* False if state is not covered by the table */
+	template<typename State>
+	bool index(const State& state, uint64_t& i) const {
+		int r = state.get_remaining_steps();
+		if(state.get_num_hidden() > 0 || state.is_env_move() || r < 1 || r > _max_steps) {
+			return false;
+		}
+		int counts[NUM_KINDS] = { 0 };
+		int squares[NUM_KINDS][MAX_PER_KIND];
+		int code = 0;
+		for(int sq = 0; sq < NUM_SQUARES; sq++) {
+			const Piece& p = state.at(sq / 4, sq % 4);
+			if(p.isEmpty()) {
+				continue;
+			}
+			if(p.isHidden()) {
+				return false;
+			}
+			int k = p.getSide() * 4 + p.value;
+			if(counts[k] == MAX_PER_KIND) {
+				return false;
+			}
+			squares[k][counts[k]++] = sq;
+		}
+		for(int k = NUM_KINDS - 1; k >= 0; k--) {
+			code = code * 3 + counts[k];
+		}
+		if(_material_of[code] < 0) {
+			return false;
+		}
+		const Material& m = _materials[_material_of[code]];
+
+		uint64_t placement = 0;
+		uint32_t used = 0;
+		for(int k = 0, free = NUM_SQUARES; k < NUM_KINDS; k++) {
+			uint64_t rank = 0;
+			if(counts[k] == 1) {
+				rank = _compress(squares[k][0], used);
+			} else if(counts[k] == 2) {
+				// found in increasing square order, so a < b
+				uint64_t a = _compress(squares[k][0], used), b = _compress(squares[k][1], used);
+				rank = b * (b - 1) / 2 + a;
+			}
+			placement = placement * _choose(free, counts[k]) + rank;
+			for(int j = 0; j < counts[k]; j++) {
+				used |= 1u << squares[k][j];
+			}
+			free -= counts[k];
+		}
+		i = m.offset + (((uint64_t)(r - 1) * m.placements + placement) * 2 + state.get_current_player());
+		return true;
+	}
+
+	/* The board of placement in material m, the inverse of index() */
+	void squares(const Material& m, uint64_t placement, Piece (&board)[4][4]) const {
+		uint64_t ranks[NUM_KINDS];
+		int free[NUM_KINDS];
+		for(int k = 0, f = NUM_SQUARES; k < NUM_KINDS; k++) {
+			free[k] = f;
+			f -= m.counts[k];
+		}
+		for(int k = NUM_KINDS - 1; k >= 0; k--) {
+			uint64_t radix = _choose(free[k], m.counts[k]);
+			ranks[k] = placement % radix;
+			placement /= radix;
+		}
+		for(int sq = 0; sq < NUM_SQUARES; sq++) {
+			board[sq / 4][sq % 4] = Piece::empty();
+		}
+		uint32_t used = 0;
+		for(int k = 0; k < NUM_KINDS; k++) {
+			int compressed[MAX_PER_KIND];
+			if(m.counts[k] == 1) {
+				compressed[0] = ranks[k];
+			} else if(m.counts[k] == 2) {
+				int b = 1;
+				while((uint64_t)(b + 1) * b / 2 <= ranks[k]) {
+					b++;
+				}
+				compressed[0] = ranks[k] - (uint64_t)b * (b - 1) / 2;
+				compressed[1] = b;
+			}
+			uint32_t placed = 0;
+			for(int j = 0; j < m.counts[k]; j++) {
+				int sq = _expand(compressed[j], used);
+				board[sq / 4][sq % 4] = Piece((Side)(k / 4), k % 4);
+				placed |= 1u << sq;
+			}
+			used |= placed;
+		}
+	}
+
+private:
+
+	static inline uint64_t _choose(int n, int k) {
+		return k == 0 ? 1 : (k == 1 ? n : (uint64_t)n * (n - 1) / 2);
+	}
+
+	/* Rank of square sq among the squares not in used */
+	static inline int _compress(int sq, uint32_t used) {
+		return sq - __builtin_popcount(used & ((1u << sq) - 1));
+	}
+
+	/* The i-th square not in used */
+	static inline int _expand(int i, uint32_t used) {
+		for(int sq = 0; sq < NUM_SQUARES; sq++) {
+			if(!(used & (1u << sq)) && i-- == 0) {
+				return sq;
+			}
+		}
+		throw std::logic_error("tablebase placement out of range");
+	}
+
+	int _max_steps = 0;
+	uint64_t _size = 0;
+	std::vector<Material> _materials;
+	std::vector<int> _material_of;
+};
+
+}
+
+template<typename State>
+class Tablebase final {
+
+public:
+
+	explicit Tablebase(const std::string& path);
+
+	~Tablebase();
+
+	Tablebase(const Tablebase&) = delete;
+	Tablebase& operator=(const Tablebase&) = delete;
+
+	/*
+		Builds the table for positions of up to max_pieces pieces in games of
+		max_steps steps and writes it to path. Positions are solved material
+		by material in index order and by increasing remaining steps within
+		one, so all successors are known and every layer is one parallel sweep.
+	*/
+	static void generate(const std::string& path, int max_pieces, int max_steps, std::size_t n_threads);
+
+	/* Game value of state for the player to move: 1, 0 or -1 */
+	bool probe(const State& state, int& value) const;
+
+	/* The same from PLAYER_0's point of view, as a search leaf solver */
+	inline bool solve(const State& state, double& value_p0) const {
+		int value;
+		if(!probe(state, value)) {
+			return false;
+		}
+		value_p0 = state.get_current_player() == Sides::PLAYER_0 ? value : -value;
+		return true;
+	}
+
+	inline int max_pieces() const {
+		return _header.max_pieces;
+	}
+
+	inline int max_steps() const {
+		return _header.max_steps;
+	}
+
+	inline uint64_t size() const {
+		return _header.n_entries;
+	}
+
+private:
+
+	static tablebase::Value _solve(const State& state, const tablebase::Index& index, const std::vector<uint8_t>& values);
+
+	int _fd = -1;
+	const uint8_t* _data = nullptr;
+	std::size_t _length = 0;
+	tablebase::FileHeader _header;
+	tablebase::Index _index;
+};
+
+template<typename State>
+Tablebase<State>::Tablebase(const std::string& path) {
+	using namespace tablebase;
+	_fd = open(path.c_str(), O_RDONLY);
+	if(_fd < 0) {
+		throw std::runtime_error("cannot open " + path);
+	}
+	struct stat st;
+	fstat(_fd, &st);
+	_length = st.st_size;
+	if(_length < sizeof(FileHeader)) {
+		::close(_fd);
+		throw std::runtime_error(path + " is not a tablebase file");
+	}
+	void* data = mmap(nullptr, _length, PROT_READ, MAP_SHARED, _fd, 0);
+	if(data == MAP_FAILED) {
+		::close(_fd);
+		throw std::runtime_error("cannot mmap " + path);
+	}
+	_data = (const uint8_t*)data;
+	memcpy(&_header, _data, sizeof(_header));
+	if(memcmp(_header.magic, FILE_MAGIC, sizeof(_header.magic)) != 0
+		|| _header.dynamic_steps != State::DYNAMIC_STEPS
+		|| _length < sizeof(FileHeader) + (_header.n_entries + 3) / 4) {
+		munmap(data, _length);
+		::close(_fd);
+		throw std::runtime_error(path + " is not a compatible tablebase file");
+	}
+	_index = Index(_header.max_pieces, _header.max_steps);
+	if(_index.size() != _header.n_entries) {
+		munmap(data, _length);
+		::close(_fd);
+		throw std::runtime_error(path + " is not a compatible tablebase file");
+	}
+}
+
+template<typename State>
+Tablebase<State>::~Tablebase() {
+	if(_data != nullptr) {
+		munmap((void*)_data, _length);
+		_data = nullptr;
+	}
+	if(_fd >= 0) {
+		::close(_fd);
+		_fd = -1;
+	}
+}
+
+template<typename State>
+bool Tablebase<State>::probe(const State& state, int& value) const {
+	uint64_t i;
+	if(state.get_max_steps() != _header.max_steps || !_index.index(state, i)) {
+		return false;
+	}
+	// values are paged in from the file on first access
+	uint8_t v = (_data[sizeof(tablebase::FileHeader) + i / 4] >> (2 * (i % 4))) & 3;
+	if(v == tablebase::UNKNOWN) {
+		return false;
+	}
+	value = (int)v - 1;
+	return true;
+}
+
+template<typename State>
+tablebase::Value Tablebase<State>::_solve(const State& state, const tablebase::Index& index, const std::vector<uint8_t>& values) {
+	using namespace tablebase;
+	Side winner = state.get_winner();
+	if(winner != Sides::NONE) {
+		return winner == Sides::DRAW ? DRAW : (winner == state.get_current_player() ? WIN : LOSS);
+	}
+	Value best = LOSS;
+	for(const auto& m : state.get_moves()) {
+		State next(state);
+		next.do_move(m);
+		Value theirs;
+		Side next_winner = next.get_winner();
+		if(next_winner != Sides::NONE) {
+			theirs = next_winner == Sides::DRAW ? DRAW : (next_winner == next.get_current_player() ? WIN : LOSS);
+		} else {
+			uint64_t i;
+			if(!index.index(next, i) || values[i] == UNKNOWN) {
+				throw std::logic_error("tablebase successor not solved yet");
+			}
+			theirs = (Value)values[i];
+		}
+		best = std::max(best, (Value)(WIN - theirs));
+		if(best == WIN) {
+			break;
+		}
+	}
+	return best;
+}
+
+template<typename State>
+void Tablebase<State>::generate(const std::string& path, int max_pieces, int max_steps, std::size_t n_threads) {
+	using namespace tablebase;
+	if(max_pieces < 1 || max_pieces > NUM_KINDS * MAX_PER_KIND || max_steps < 1) {
+		throw std::invalid_argument("max_pieces must be in [1, 16] and max_steps positive");
+	}
+	Index index(max_pieces, max_steps);
+	std::vector<uint8_t> values(index.size(), UNKNOWN);
+
+	const uint64_t chunk = 1024;
+	threading::ThreadPool pool;
+	pool.initialize(std::max<std::size_t>(1, n_threads));
+	for(const Index::Material& m : index.materials()) {
+		for(int r = 1; r <= max_steps; r++) {
+			uint64_t base = m.offset + (uint64_t)(r - 1) * m.placements * 2;
+			std::atomic<uint64_t> next_chunk(0);
+			threading::ThreadGroup tg(pool);
+			for(std::size_t t = 0; t < std::max<std::size_t>(1, n_threads); t++) {
+				tg.add_task([&]() {
+					Piece squares[4][4];
+					uint64_t start;
+					while((start = (next_chunk++) * chunk) < m.placements) {
+						for(uint64_t p = start; p < std::min(start + chunk, m.placements); p++) {
+							index.squares(m, p, squares);
+							for(Side player : { Sides::PLAYER_0, Sides::PLAYER_1 }) {
+								values[base + p * 2 + player] = _solve(State::revealed(squares, player, r, max_steps), index, values);
+							}
+						}
+					}
+				});
+			}
+			tg.wait_all();
+		}
+	}
+
+	std::vector<uint8_t> packed((values.size() + 3) / 4, 0);
+	for(uint64_t i = 0; i < values.size(); i++) {
+		packed[i / 4] |= values[i] << (2 * (i % 4));
+	}
+	FileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+	header.version = 1;
+	header.max_pieces = max_pieces;
+	header.max_steps = max_steps;
+	header.dynamic_steps = State::DYNAMIC_STEPS;
+	header.n_entries = values.size();
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if(file == nullptr) {
+		throw std::runtime_error("cannot open " + path);
+	}
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(packed.data(), 1, packed.size(), file) == packed.size();
+	ok = fclose(file) == 0 && ok;
+	if(!ok) {
+		throw std::runtime_error("write failed");
+	}
+}
+
+}
+
+#endif
@@ -7,27 +7,75 @@ TreeNode<State>::~TreeNode() {
 
 template<typename State>
 void TreeNode<State>::expand(std::vector<std::pair<typename State::Move, double>> priors) {
+	double sum = 0.;
 	for(auto& it : priors) {
-		_children.push_back(std::make_pair(it.first, new TreeNode(this, it.second)));
+		sum += it.second;
+	}
+	// outcome weights come in as piece counts; keep them as probabilities so sampling needs no table
+	double scale = sum > 0. ? 1. / sum : 1.;
+	_children.reserve(priors.size());
+	for(auto& it : priors) {
+		_children.push_back(std::make_pair(it.first, new TreeNode(this, it.second * scale)));
 	}
 }
 
 template<typename State>
-std::pair<typename State::Move, TreeNode<State>*> TreeNode<State>::select(double c_puct) const {
-	return *std::max_element(_children.begin(), _children.end(),
-		[c_puct, this](auto a, auto b) { return a.second->get_U_value(c_puct) < b.second->get_U_value(c_puct); });
+std::pair<typename State::Move, TreeNode<State>*> TreeNode<State>::select(double c_puct, int player) const {
+	if(player < 0) {
+		return *std::max_element(_children.begin(), _children.end(),
+			[c_puct, this](auto a, auto b) { return a.second->get_U_value(c_puct) < b.second->get_U_value(c_puct); });
+	}
+	double sign = player == 0 ? 1. : -1.;
+	const std::pair<Move, TreeNode<State>*>* best = nullptr;
+	double best_u = -std::numeric_limits<double>::infinity();
+	for(auto& it : _children) {
+		const TreeNode<State>* child = it.second;
+		double u;
+		if(child->_proven) {
+			double v = sign * child->_proof;
+			if(v >= 1.) {
+				return it;
+			} else if(v <= -1.) {
+				continue;
+			}
+			// exact value in place of the running mean
+			u = v + c_puct * child->_prior * sqrt((double)_n_visit) / (1 + child->_n_visit);
+		} else {
+			u = child->get_U_value(c_puct);
+		}
+		if(best == nullptr || u > best_u) {
+			best = &it;
+			best_u = u;
+		}
+	}
+	return best != nullptr ? *best : select(c_puct);
 }
 
 template<typename State>
 template<typename RandomEngine>
 std::pair<typename State::Move, TreeNode<State>*> TreeNode<State>::env_select(RandomEngine* rng) const {
-	std::vector<double> weights;
-	std::transform(
-		_children.begin(), _children.end(), std::back_inserter(weights), 
-		[](auto it) { return it.second->_prior; }
-	);
-	std::discrete_distribution<int> dist(std::begin(weights), std::end(weights));
-	return _children[dist(*rng)];
+	double u = prng::uniform(*rng);
+	for(auto& it : _children) {
+		u -= it.second->_prior;
+		if(u < 0.) {
+			return it;
+		}
+	}
+	return _children.back();
+}
+
+template<typename State>
+std::pair<typename State::Move, TreeNode<State>*> TreeNode<State>::env_select_stratified() const {
+	const std::pair<Move, TreeNode<State>*>* best = &_children.front();
+	double best_deficit = -std::numeric_limits<double>::infinity();
+	for(auto& it : _children) {
+		double deficit = it.second->_prior * (_n_visit + 1) - it.second->_n_visit;
+		if(deficit > best_deficit) {
+			best = &it;
+			best_deficit = deficit;
+		}
+	}
+	return *best;
 }
 
 template<typename State>
@@ -46,7 +94,157 @@ void TreeNode<State>::update_recursive(double leaf_value) {
 
 template<typename State>
 double TreeNode<State>::get_U_value(double c_puct) const {
-	return _Q + (c_puct * _prior * sqrt((double)_parent->_n_visit) / (1 + _n_visit));
+	if(_virtual_loss == 0 && _parent->_virtual_loss == 0) {
+		return _Q + (c_puct * _prior * sqrt((double)_parent->_n_visit) / (1 + _n_visit));
+	}
+	// playouts still in flight through here count as losses until they are backed up
+	unsigned int n = _n_visit + _virtual_loss;
+	double q = _virtual_loss == 0 ? _Q : (_Q * _n_visit - _virtual_loss) / n;
+	return q + (c_puct * _prior * sqrt((double)(_parent->_n_visit + _parent->_virtual_loss)) / (1 + n));
+}
+
+template<typename State>
+void TreeNode<State>::_add_virtual_loss() {
+	for(TreeNode<State>* node = this; node != nullptr; node = node->_parent) {
+		node->_virtual_loss++;
+	}
+}
+
+template<typename State>
+void TreeNode<State>::_revert_virtual_loss() {
+	for(TreeNode<State>* node = this; node != nullptr; node = node->_parent) {
+		assert(node->_virtual_loss > 0);
+		node->_virtual_loss--;
+	}
+}
+
+template<typename State>
+bool TreeNode<State>::visit_leaders(unsigned int& first, unsigned int& second) const {
+	const TreeNode<State>* first_node = nullptr;
+	const TreeNode<State>* second_node = nullptr;
+	for(auto& it : _children) {
+		const TreeNode<State>* node = it.second;
+		if(first_node == nullptr || node->_n_visit > first_node->_n_visit) {
+			second_node = first_node;
+			first_node = node;
+		} else if(second_node == nullptr || node->_n_visit > second_node->_n_visit) {
+			second_node = node;
+		}
+	}
+	first = first_node == nullptr ? 0 : first_node->_n_visit;
+	second = second_node == nullptr ? 0 : second_node->_n_visit;
+	return second > 0 && second_node->_Q > first_node->_Q;
+}
+
+template<typename State>
+void TreeNode<State>::prove(double value, const std::vector<int>& players) {
+	_proven = true;
+	_proof = value;
+	int n_proven = 1;
+	TreeNode<State>* node = _parent;
+	for(int i = (int)players.size() - 2; i >= 0 && node != nullptr; i--, node = node->_parent) {
+		if(node->_proven || !node->_try_prove(players[i])) {
+			break;
+		}
+		n_proven++;
+	}
+	if(metrics::ThreadMetrics* m = metrics::current()) {
+		m->add(m->proven_nodes, n_proven);
+	}
+}
+
+template<typename State>
+bool TreeNode<State>::_try_prove(int player) {
+	if(_children.empty()) {
+		return false;
+	}
+	if(player < 0) {
+		// chance node: proven once every outcome is
+		double total = 0., weight = 0.;
+		for(auto& it : _children) {
+			if(!it.second->_proven) {
+				return false;
+			}
+			total += it.second->_prior * it.second->_proof;
+			weight += it.second->_prior;
+		}
+		_proof = total / weight;
+	} else {
+		// decision node: proven by a single winning move or once every move is
+		double sign = player == 0 ? 1. : -1.;
+		bool all_proven = true;
+		double best = -std::numeric_limits<double>::infinity();
+		for(auto& it : _children) {
+			if(!it.second->_proven) {
+				all_proven = false;
+				continue;
+			}
+			double v = sign * it.second->_proof;
+			if(v >= 1.) {
+				best = v;
+				all_proven = true;
+				break;
+			}
+			best = std::max(best, v);
+		}
+		if(!all_proven) {
+			return false;
+		}
+		_proof = sign * best;
+	}
+	_proven = true;
+	return true;
+}
+
+template<typename State>
+void TreeNode<State>::child_statistics(int player, std::vector<double>& priors, std::vector<double>& values, std::vector<double>& visits) const {
+	double sign = player == 0 ? 1. : -1.;
+	priors.resize(_children.size());
+	values.resize(_children.size());
+	visits.resize(_children.size());
+	for(std::size_t i = 0; i < _children.size(); i++) {
+		const TreeNode<State>* child = _children[i].second;
+		priors[i] = child->_prior;
+		values[i] = child->_proven ? sign * child->_proof : child->_Q;
+		visits[i] = (double)child->_n_visit;
+	}
+}
+
+template<typename State>
+std::vector<double> TreeNode<State>::child_weights(int player) const {
+	std::vector<double> weights(_children.size());
+	double sign = player == 0 ? 1. : -1.;
+	int n_wins = 0, n_losses = 0;
+	for(std::size_t i = 0; i < _children.size(); i++) {
+		const TreeNode<State>* child = _children[i].second;
+		weights[i] = (double)child->_n_visit;
+		if(child->_proven && sign * child->_proof >= 1.) {
+			n_wins++;
+		} else if(child->_proven && sign * child->_proof <= -1.) {
+			n_losses++;
+		}
+	}
+	if(n_wins == 0 && (n_losses == 0 || n_losses == (int)_children.size())) {
+		return weights;
+	}
+	double sum = 0.;
+	for(std::size_t i = 0; i < _children.size(); i++) {
+		const TreeNode<State>* child = _children[i].second;
+		double v = child->_proven ? sign * child->_proof : 0.;
+		if(n_wins > 0 ? v < 1. : v <= -1.) {
+			weights[i] = 0.;
+		}
+		sum += weights[i];
+	}
+	if(sum == 0.) {
+		// nothing visited among what is left: spread evenly over it
+		for(std::size_t i = 0; i < _children.size(); i++) {
+			const TreeNode<State>* child = _children[i].second;
+			double v = child->_proven ? sign * child->_proof : 0.;
+			weights[i] = (n_wins > 0 ? v >= 1. : v > -1.) ? 1. : 0.;
+		}
+	}
+	return weights;
 }
 
 template<typename State>
@@ -5,7 +5,9 @@ BatchMCTS<State>::BatchMCTS(const PolicyFunction& policy_fn, std::size_t compact
     _c_puct(c_puct),
     _n_playout(n_playout),
     _eval_batch_size(eval_batch_size),
-    _thread_pool_size(thread_pool_size)
+    _thread_pool_size(thread_pool_size),
+    _seed(rng()),
+    _metrics(thread_pool_size, eval_batch_size)
 {
     _pool.initialize(thread_pool_size);
 }
@@ -19,14 +21,27 @@ BatchMCTS<State>::~BatchMCTS() {
 
 template<typename State>
 template<typename RandomEngine>
-TreeNode<State>* BatchMCTS<State>::_playout_single_path(TreeNode<State>* root, State& state, std::vector<int>& players, double& leaf_value, bool& game_ended, RandomEngine* rng) {
+TreeNode<State>* BatchMCTS<State>::_playout_single_path(TreeNode<State>* root, State& state, std::vector<int>& players, double& leaf_value, bool& game_ended, bool& chance_leaf, RandomEngine* rng, int root_child) {
+    metrics::ThreadMetrics* m = metrics::current();
+    metrics::ScopedPhase phase(m, metrics::SELECTION);
     TreeNode<State>* node = root;
+    chance_leaf = false;
     while(true) {
         players.push_back(state.get_current_player());
+        if(node->_proven) {
+            break;
+        }
         bool is_env_move = state.is_env_move();
         if(node->is_leaf()) {
             if(is_env_move) {
+                phase.enter(metrics::EXPANSION);
                 node->expand(state.get_env_move_weights());
+                m->add(m->nodes, node->_children.size());
+                if(_exact_chance && node->_children.size() <= _eval_batch_size) {
+                    chance_leaf = true;
+                    break;
+                }
+                phase.enter(metrics::SELECTION);
                 auto action_node = node->env_select(rng);
                 node = action_node.second;
                 state.do_move(action_node.first);
@@ -35,18 +50,39 @@ TreeNode<State>* BatchMCTS<State>::_playout_single_path(TreeNode<State>* root, S
             }
         } else {
             if(is_env_move) {
-                auto action_node = node->env_select(rng);
+                auto action_node = _exact_chance ? node->env_select_stratified() : node->env_select(rng);
                 node = action_node.second;
                 state.do_move(action_node.first);
             } else {
-                auto action_node = node->select(_c_puct);
+                auto action_node = node == root && root_child >= 0 ? node->_children[root_child] : node->select(_c_puct, players.back());
                 node = action_node.second;
                 state.do_move(action_node.first);
             }
         }
     }
+    m->add(m->playouts);
+    m->observe_depth(players.size() - 1);
+    if(chance_leaf) {
+        game_ended = false;
+        return node;
+    }
 
-    if(state.game_ended()) {
+    // the root is left to the search, which has to come up with a move
+    if(_leaf_solver && node != root && !node->_proven && !state.game_ended()) {
+        phase.enter(metrics::LEAF_SOLVER);
+        double value;
+        if(_leaf_solver(state, value)) {
+            node->prove(value, players);
+        }
+    }
+    if(node->_proven) {
+        // solved subtree: its exact value is from PLAYER_0's point of view, so back it up as such
+        leaf_value = node->_proof;
+        players.back() = 0;
+        m->add(m->terminal_leaves);
+        game_ended = true;
+        return node;
+    } else if(state.game_ended()) {
         auto winner = state.get_winner();
         if(winner == 2) {
             leaf_value = 0;
@@ -56,6 +92,8 @@ TreeNode<State>* BatchMCTS<State>::_playout_single_path(TreeNode<State>* root, S
             assert(winner == 1 - state.get_current_player());
             leaf_value = -1.;
         }
+        node->prove(winner == 2 ? 0. : (winner == 0 ? 1. : -1.), players);
+        m->add(m->terminal_leaves);
         game_ended = true;
         return node;
     } else {
@@ -66,102 +104,315 @@ TreeNode<State>* BatchMCTS<State>::_playout_single_path(TreeNode<State>* root, S
 
 template<typename State>
 template<typename RandomEngine>
-void BatchMCTS<State>::_playout_batch(
+void BatchMCTS<State>::_add_playout(Batch& batch, TreeNode<State>* root, const State& state, int root_child, RandomEngine* rng) {
+    // chance expansions take several slots, so the games may not all fit in one batch
+    if(batch.eval_count + batch.ended_count >= (int)_eval_batch_size) {
+        _flush(batch);
+    }
+    int& eval_count = batch.eval_count;
+    batch.states[eval_count] = State(state);
+    std::vector<int> players;
+    double leaf_value = 0.;
+    bool game_ended = false;
+    bool chance_leaf = false;
+    TreeNode<State>* node = _playout_single_path(root, batch.states[eval_count], players, leaf_value, game_ended, chance_leaf, rng, root_child);
+    node->_add_virtual_loss();
+
+    if(chance_leaf) {
+        State leaf_state = batch.states[eval_count];
+        if(eval_count + batch.ended_count + node->_children.size() > _eval_batch_size) {
+            _flush(batch);
+        }
+        metrics::ThreadMetrics* m = metrics::current();
+        metrics::ScopedPhase phase(m, metrics::LEAF_SOLVER);
+        ChanceExpansion expansion{node, players, 0.};
+        for(auto& it : node->_children) {
+            TreeNode<State>* child = it.second;
+            batch.states[eval_count] = leaf_state;
+            batch.states[eval_count].do_move(it.first);
+            players.push_back(batch.states[eval_count].get_current_player());
+            double value;
+            if(prove_if_solved(child, batch.states[eval_count], _leaf_solver, players, value)) {
+                child->update(0.);
+                expansion.value += child->_prior * value;
+                m->add(m->terminal_leaves);
+            } else {
+                batch.nodes[eval_count] = child;
+                batch.players[eval_count] = players;
+                batch.chance[eval_count] = batch.chance_expansions.size();
+                eval_count++;
+            }
+            players.pop_back();
+        }
+        expansion.players.back() = 0;
+        batch.chance_expansions.push_back(std::move(expansion));
+        return;
+    }
+
+    int idx;
+    if(game_ended) {
+        idx = _eval_batch_size - batch.ended_count - 1;
+        batch.ended_results[idx] = leaf_value;
+        batch.ended_count++;
+    } else {
+        idx = eval_count;
+        batch.chance[idx] = -1;
+        eval_count++;
+    }
+
+    batch.nodes[idx] = node;
+    batch.players[idx] = std::move(players);
+}
+
+template<typename State>
+void BatchMCTS<State>::_flush(Batch& batch) {
+    _eval_and_backprop_batch(batch);
+    batch.eval_count = 0;
+    batch.ended_count = 0;
+    batch.chance_expansions.clear();
+}
+
+template<typename State>
+void BatchMCTS<State>::_make_room(Batch& batch, const State& state, std::size_t n) {
+    std::size_t used = batch.eval_count + batch.ended_count;
+    if(!_reproducible || used == 0) {
+        return;
+    }
+    // a playout ending on a new flip takes a slot per outcome
+    std::size_t slots = _exact_chance ? std::max<std::size_t>(1, std::min<std::size_t>(_eval_batch_size, state.max_env_moves())) : 1;
+    if(used + n * slots > _eval_batch_size) {
+        _flush(batch);
+    }
+}
+
+/*
+    Repeatedly takes a batch of games off the ready queue, runs playouts in
+    each, evaluates the leaves together and hands the games back, so a game
+    whose budget is spent stops taking up batch slots and threads. When there
+    are fewer games than batch slots every game gets several playouts per
+    batch, kept on different paths by virtual loss.
+*/
+template<typename State>
+void BatchMCTS<State>::_search_worker(
     const std::vector<State>& states, 
-    std::size_t start_i, std::size_t n_games, 
-    RandomEngine* rng) 
+    std::vector<SearchBudget>& budgets, 
+    uint64_t search) 
 {
-    std::vector<State> batch_states(_eval_batch_size);
-    std::vector<TreeNode<State>*> batch_nodes(_eval_batch_size);
-    std::vector<std::vector<int>> batch_players(_eval_batch_size);
-
-    std::vector<BatchMCTS<State>::EvalResult> batch_eval_results(_eval_batch_size);
-    std::vector<double> batch_ended_results(_eval_batch_size);
-
-    std::vector<double> compact_state_buffer(_compact_state_size * _eval_batch_size);
-
-    for(int j = 0; j < _n_playout; j++) {
-
-        int total_ended_count = 0;
-
-        int eval_count = 0;
-        int ended_count = 0; // Trick: ended games are stored reverse in the above buffers
-
-        int nn_eval_count = 0;
-        
-        for(int i = 0; i < n_games; i++) {
-            int which_game = start_i + i;
-            batch_states[eval_count] = State(states[which_game]);
-            std::vector<int> players;
-            double leaf_value = 0.;
-            bool game_ended = false;
-            TreeNode<State>* node = _playout_single_path(_roots[which_game], batch_states[eval_count], players, leaf_value, game_ended, rng);
-            
-            int idx;
-            if(game_ended) {
-                if(eval_count == 0) {
-                    // can treat this as single playout
-                    assert(ended_count == 0);
-                    _backprop_single_path(node, leaf_value, players);
-                    total_ended_count++;
-                    continue;
-                } else {
-                    idx = _eval_batch_size - ended_count - 1;
-                    batch_ended_results[idx] = leaf_value;
-                    ended_count++;
-                    total_ended_count++;
+    Batch batch(_eval_batch_size, _compact_state_size);
+    std::vector<std::size_t> games;
+    std::vector<bool> again;
+
+    while(_ready_games.pop(games, _eval_batch_size)) {
+        // which games come off the queue together is down to timing, so a seeded search shares out the batch by all of them
+        std::size_t sharing = _reproducible ? states.size() : games.size();
+        std::size_t playouts_per_game = std::max<std::size_t>(1, std::min(_max_playouts_per_game, _eval_batch_size / sharing));
+        for(std::size_t which_game : games) {
+            TreeNode<State>* root = _roots[which_game];
+            _make_room(batch, states[which_game], playouts_per_game);
+            for(std::size_t round = 0; round < playouts_per_game; round++) {
+                // the first playout was granted when the game was handed back
+                if(round > 0 && (root->_proven || !budgets[which_game].should_continue(*root))) {
+                    break;
                 }
-            } else {
-                idx = eval_count;
-                eval_count++;
+                prng::Xoshiro256 rng = prng::stream(_seed, {search, which_game, budgets[which_game].playouts()});
+                _add_playout(batch, root, states[which_game], -1, &rng);
+                budgets[which_game].add_playout();
             }
+        }
+        _flush(batch);
 
-            batch_nodes[idx] = node;
-            batch_players[idx] = std::move(players);
+        again.resize(games.size());
+        for(std::size_t i = 0; i < games.size(); i++) {
+            again[i] = !_roots[games[i]]->_proven && budgets[games[i]].should_continue(*_roots[games[i]]);
+        }
+        _ready_games.release(games, again);
+    }
+}
+
+/*
+    Expands the roots, samples the considered moves of each and then runs the
+    halving phases in lockstep over the games: every phase issues all its
+    forced playouts before evaluating, so the policy function sees the whole
+    phase in as few batches as the batch size allows. Virtual loss spreads
+    the playouts through one root move below it. Roots where the environment
+    moves have no moves to consider, so they get plain playouts as in
+    _search_worker, as MCTS does.
+*/
+template<typename State>
+void BatchMCTS<State>::_gumbel_worker(
+    const std::vector<State>& states,
+    const std::vector<std::size_t>& games,
+    std::vector<SearchBudget>& budgets,
+    uint64_t search)
+{
+    Batch batch(_eval_batch_size, _compact_state_size);
+    for(std::size_t g : games) {
+        if(_roots[g]->is_leaf() && !states[g].is_env_move()) {
+            _make_room(batch, states[g], 1);
+            prng::Xoshiro256 rng = prng::stream(_seed, {search, g, budgets[g].playouts()});
+            _add_playout(batch, _roots[g], states[g], -1, &rng);
+            budgets[g].add_playout();
+        }
+    }
+    _flush(batch);
 
-            if(eval_count + ended_count == _eval_batch_size) {
-                nn_eval_count += _eval_and_backprop_batch(batch_nodes, batch_states, batch_players, batch_ended_results, compact_state_buffer, batch_eval_results, eval_count);
-                eval_count = 0;
-                ended_count = 0;
+    std::size_t n_playout = _limits.playouts > 0 ? _limits.playouts : _n_playout;
+    std::vector<GumbelRoot> gumbels;
+    std::vector<std::size_t> of_game;
+    for(std::size_t g : games) {
+        if(!states[g].is_env_move() && !_roots[g]->_proven && !_roots[g]->is_leaf()) {
+            std::vector<double> priors, values, visits;
+            _roots[g]->child_statistics(states[g].get_current_player(), priors, values, visits);
+            prng::Xoshiro256 noise = prng::stream(_seed, {search, g});
+            gumbels.emplace_back(priors, _gumbel, n_playout, &noise);
+            of_game.push_back(g);
+        }
+    }
+
+    std::vector<std::size_t> active(gumbels.size());
+    for(std::size_t k = 0; k < active.size(); k++) {
+        active[k] = k;
+    }
+    std::vector<std::vector<std::size_t>> considered(gumbels.size());
+    std::vector<std::size_t> visits_each(gumbels.size());
+    std::vector<double> priors, values, visits;
+    while(!active.empty()) {
+        std::size_t n_active = 0;
+        for(std::size_t k : active) {
+            std::size_t g = of_game[k];
+            _roots[g]->child_statistics(states[g].get_current_player(), priors, values, visits);
+            if(!_roots[g]->_proven && budgets[g].should_continue(*_roots[g]) && gumbels[k].next_phase(values, visits, considered[k], visits_each[k])) {
+                active[n_active++] = k;
             }
         }
-        /* Backprop any residuals */
-        if(eval_count + ended_count > 0) {
-            nn_eval_count += _eval_and_backprop_batch(batch_nodes, batch_states, batch_players, batch_ended_results, compact_state_buffer, batch_eval_results, eval_count);
+        active.resize(n_active);
+        for(std::size_t k : active) {
+            std::size_t g = of_game[k];
+            _make_room(batch, states[g], visits_each[k] * considered[k].size());
+            // one playout through each move in turn, so a deadline cuts every move short alike
+            bool in_budget = true;
+            for(std::size_t v = 0; v < visits_each[k] && in_budget; v++) {
+                for(std::size_t child : considered[k]) {
+                    if(_roots[g]->_proven || !budgets[g].should_continue(*_roots[g])) {
+                        in_budget = false;
+                        break;
+                    }
+                    prng::Xoshiro256 rng = prng::stream(_seed, {search, g, budgets[g].playouts()});
+                    _add_playout(batch, _roots[g], states[g], child, &rng);
+                    budgets[g].add_playout();
+                }
+            }
+        }
+        _flush(batch);
+    }
+
+    for(std::size_t k = 0; k < gumbels.size(); k++) {
+        std::size_t g = of_game[k];
+        int player = states[g].get_current_player();
+        if(_roots[g]->_proven) {
+            // a proven win may not even be among the considered moves
+            continue;
+        }
+        _roots[g]->child_statistics(player, priors, values, visits);
+        _gumbel_choices[g] = gumbels[k].selected(values, visits);
+        _gumbel_policies[g] = gumbels[k].improved_policy(values, visits);
+    }
+
+    std::vector<std::size_t> chance;
+    for(std::size_t g : games) {
+        if(states[g].is_env_move()) {
+            chance.push_back(g);
+        }
+    }
+    while(!chance.empty()) {
+        // how the games are split among the threads depends on their number, so a seeded search shares out the batch by all of them
+        std::size_t sharing = _reproducible ? states.size() : chance.size();
+        std::size_t playouts_per_game = std::max<std::size_t>(1, std::min(_max_playouts_per_game, _eval_batch_size / sharing));
+        for(std::size_t g : chance) {
+            _make_room(batch, states[g], playouts_per_game);
+            for(std::size_t round = 0; round < playouts_per_game; round++) {
+                if(_roots[g]->_proven || !budgets[g].should_continue(*_roots[g])) {
+                    break;
+                }
+                prng::Xoshiro256 rng = prng::stream(_seed, {search, g, budgets[g].playouts()});
+                _add_playout(batch, _roots[g], states[g], -1, &rng);
+                budgets[g].add_playout();
+            }
         }
+        _flush(batch);
 
-        std::cout << "ok " << j << " " << _n_playout << " " << total_ended_count << " " << nn_eval_count << " " << total_ended_count + nn_eval_count << std::endl;
+        std::size_t n_left = 0;
+        for(std::size_t g : chance) {
+            if(!_roots[g]->_proven && budgets[g].should_continue(*_roots[g])) {
+                chance[n_left++] = g;
+            }
+        }
+        chance.resize(n_left);
     }
 }
 
 template<typename State>
-int BatchMCTS<State>::_eval_and_backprop_batch(
-    const std::vector<TreeNode<State>*>& nodes, 
-    const std::vector<State>& states, 
-    const std::vector<std::vector<int>>& players, 
-    const std::vector<double>& batch_ended_results,
-    const std::vector<double>& compact_state_buffer,
-    std::vector<BatchMCTS<State>::EvalResult>& eval_results,
-    int eval_count) 
-{
+int BatchMCTS<State>::_eval_and_backprop_batch(Batch& batch) {
+    const std::vector<TreeNode<State>*>& nodes = batch.nodes;
+    const std::vector<State>& states = batch.states;
+    const std::vector<std::vector<int>>& players = batch.players;
+    const std::vector<int>& batch_chance = batch.chance;
+    std::vector<EvalResult>& eval_results = batch.eval_results;
+    std::vector<ChanceExpansion>& chance_expansions = batch.chance_expansions;
+    int eval_count = batch.eval_count;
+    int ended_count = batch.ended_count;
+
+    metrics::ThreadMetrics* m = metrics::current();
+    metrics::ScopedPhase phase(m, metrics::POLICY_WAIT);
     int valid_cnt = 0;
-    this->_policy_fn(states, eval_results, eval_count, (void*)compact_state_buffer.data());
+    if(eval_count > 0) {
+        this->_policy_fn(states, eval_results, eval_count, (void*)batch.compact_state_buffer.data());
+        m->add(m->batches);
+        m->add(m->batch_slots, eval_count);
+        m->add(m->evaluated_leaves, eval_count);
+    }
     for(int i = 0; i < eval_count; i++) {
         TreeNode<State>* node = nodes[i];
         auto&& policy_value_pair = eval_results[i];
+        if(batch_chance[i] >= 0) {
+            // an outcome: only counts towards the mean of its chance node, backed up below
+            phase.enter(metrics::EXPANSION);
+            if(node->is_leaf()) {
+                // another playout of the batch may have sampled and expanded it already
+                node->expand(policy_value_pair.first);
+                m->add(m->nodes, node->_children.size());
+            }
+            node->update(0.);
+            double value = states[i].get_current_player() == 0 ? policy_value_pair.second : -policy_value_pair.second;
+            chance_expansions[batch_chance[i]].value += node->_prior * value;
+            valid_cnt ++;
+            continue;
+        }
+        node->_revert_virtual_loss();
         bool do_backprop = false;
         if(node->is_leaf()) {
+            phase.enter(metrics::EXPANSION);
             node->expand(policy_value_pair.first);
+            m->add(m->nodes, node->_children.size());
             do_backprop = true;
             valid_cnt ++;
+        } else {
+            m->add(m->collisions);
         }
         if(do_backprop) {
+            phase.enter(metrics::BACKUP);
             double leaf_value = policy_value_pair.second;
             _backprop_single_path(node, leaf_value, players[i]);
         }
     }
-    for(int i = eval_count; i < _eval_batch_size; i++) {
-        _backprop_single_path(nodes[i], batch_ended_results[i], players[i]);
+    phase.enter(metrics::BACKUP);
+    for(int i = _eval_batch_size - ended_count; i < _eval_batch_size; i++) {
+        nodes[i]->_revert_virtual_loss();
+        _backprop_single_path(nodes[i], batch.ended_results[i], players[i]);
+    }
+    for(auto& expansion : chance_expansions) {
+        expansion.node->_revert_virtual_loss();
+        _backprop_single_path(expansion.node, expansion.value, expansion.players);
     }
     return valid_cnt;
 }
@@ -194,28 +445,54 @@ BatchMCTS<State>::get_move_probs(std::vector<State>& states, const std::vector<b
         _roots[i] = new TreeNode<State>(nullptr, 1.0);
     }
 
+    auto search_start = std::chrono::steady_clock::now();
+    std::vector<SearchBudget> budgets(states.size(), SearchBudget(_limits, _n_playout, search_start));
+    _gumbel_choices.assign(states.size(), 0);
+    _gumbel_policies.assign(states.size(), std::vector<double>());
+    uint64_t search = _searches++;
     threading::ThreadGroup tg(_pool);
-    for(int i = 0; i < _thread_pool_size; i++) {
-        int residual = states.size() % _thread_pool_size;
-        std::size_t num_states_this_thread = states.size() / _thread_pool_size + (i < residual ? 1 : 0);
-        std::size_t start_i = i * (states.size() / _thread_pool_size) + std::min(i, residual);
-        tg.add_task([this, i, start_i, num_states_this_thread, &states]() {
-            std::mt19937 rng(time(0) + i); 
-            this->_playout_batch(states, start_i, num_states_this_thread, &rng); 
-        });
+    if(_gumbel.max_considered > 0) {
+        // the phases need every game's playouts together, so games stay with one thread throughout
+        for(int i = 0; i < _thread_pool_size; i++) {
+            tg.add_task([this, i, search, &states, &budgets]() {
+                metrics::ThreadBinding binding(_metrics.thread(i));
+                std::vector<std::size_t> games;
+                for(std::size_t g = i; g < states.size(); g += _thread_pool_size) {
+                    games.push_back(g);
+                }
+                this->_gumbel_worker(states, games, budgets, search);
+            });
+        }
+    } else {
+        _ready_games.reset(states.size(), _thread_pool_size);
+        for(int i = 0; i < _thread_pool_size; i++) {
+            tg.add_task([this, i, search, &states, &budgets]() {
+                metrics::ThreadBinding binding(_metrics.thread(i));
+                this->_search_worker(states, budgets, search);
+            });
+        }
     }
     tg.wait_all();
+    _metrics.add_search_time(std::chrono::steady_clock::now() - search_start);
 
     std::vector<std::pair<std::vector<typename State::Move>, std::vector<double>>> ret;
     for(int i = 0; i < states.size(); i++) {
         TreeNode<State> *root = _roots[i];
+        std::vector<double> weights = _gumbel_policies[i];
+        if(weights.empty()) {
+            weights = root->child_weights(states[i].get_current_player());
+            _gumbel_choices[i] = std::max_element(weights.begin(), weights.end()) - weights.begin();
+        } else if(small_temp[i]) {
+            std::fill(weights.begin(), weights.end(), 0.);
+            weights[_gumbel_choices[i]] = 1.;
+        }
         if(small_temp[i]) {
             std::vector<typename State::Move> moves(root->_children.size());
             std::vector<double> counts(root->_children.size());
-            int max_c = -1;
+            double max_c = -1;
             int max_idx = 0;
             for(int i = 0; i < root->_children.size(); i++) {
-                int c = root->_children[i].second->_n_visit;
+                double c = weights[i];
                 moves[i] = root->_children[i].first;
                 if(c > max_c) {
                     max_idx = i;
@@ -229,7 +506,7 @@ BatchMCTS<State>::get_move_probs(std::vector<State>& states, const std::vector<b
             std::vector<typename State::Move> moves(root->_children.size());
             std::vector<double> counts(root->_children.size());
             for(int i = 0; i < root->_children.size(); i++) {
-                double c = (double)root->_children[i].second->_n_visit;
+                double c = weights[i];
                 counts[i] = c;
                 moves[i] = root->_children[i].first;
                 sum += c;
@@ -0,0 +1,90 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <utility>
+
+/*
+	Minimal timing harness shared by the benchmark executables. Every result is
+	printed as one JSON object per line so runs can be diffed by scripts.
+*/
+namespace bench {
+
+typedef std::chrono::steady_clock clock;
+
+template<typename T>
+inline void do_not_optimize(const T& value) {
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+inline double seconds_since(clock::time_point start) {
+	return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+class Reporter {
+public:
+	Reporter(int argc, char const *argv[]) {
+		for(int i = 1; i + 1 < argc; i++) {
+			if(std::string(argv[i]) == "--json") {
+				_file.open(argv[i + 1]);
+			}
+			if(std::string(argv[i]) == "--min-time") {
+				_min_seconds = std::stod(argv[i + 1]);
+			}
+		}
+	}
+
+	inline double min_seconds() const {
+		return _min_seconds;
+	}
+
+	/*
+		params are extra (key, value) pairs; values are written verbatim, so
+		strings must already be quoted
+	*/
+	void report(const std::string& name, std::size_t ops, double seconds,
+		const std::vector<std::pair<std::string, std::string>>& params = {})
+	{
+		std::ostream& os = _file.is_open() ? _file : std::cout;
+		os << "{\"benchmark\": \"" << name << "\"";
+		for(auto& p : params) {
+			os << ", \"" << p.first << "\": " << p.second;
+		}
+		os << ", \"ops\": " << ops
+		   << ", \"seconds\": " << seconds
+		   << ", \"ns_per_op\": " << (ops > 0 ? seconds * 1e9 / ops : 0.)
+		   << ", \"ops_per_sec\": " << (seconds > 0 ? ops / seconds : 0.)
+		   << "}" << std::endl;
+	}
+
+	/*
+		Calls f() until at least min_seconds have passed; f returns the number of
+		operations it performed.
+	*/
+	template<typename F>
+	void run(const std::string& name, F&& f,
+		const std::vector<std::pair<std::string, std::string>>& params = {})
+	{
+		f(); // warm up
+		std::size_t ops = 0;
+		auto start = clock::now();
+		double elapsed = 0.;
+		do {
+			ops += f();
+			elapsed = seconds_since(start);
+		} while(elapsed < _min_seconds);
+		report(name, ops, elapsed, params);
+	}
+
+private:
+	std::ofstream _file;
+	double _min_seconds = 1.;
+};
+
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include "Board.h"
+#include "mcts.h"
+#include "CompactState.h"
+#include "bench.hpp"
+
+#include <vector>
+#include <random>
+#include <thread>
+#include <string>
+
+using namespace mcts;
+using namespace elder_chess;
+
+prng::Xoshiro256 mcts::rng(0);
+
+typedef Board<true> Board_;
+
+static std::vector<std::pair<Move, double>> uniform_priors(const Board_& board) {
+	auto&& moves = board.get_moves();
+	std::vector<std::pair<Move, double>> priors;
+	for(auto& m : moves) {
+		priors.push_back(std::make_pair(m, 1. / moves.size()));
+	}
+	return priors;
+}
+
+/*
+	Stands in for the network: encodes the batch like the python binding does,
+	then returns uniform priors and a zero value.
+*/
+static void uniform_batch_policy(const std::vector<Board_>& boards, std::vector<BatchMCTS<Board_>::EvalResult>& results, int batch_size, void* buffer) {
+	double* board_states = (double*)buffer;
+	for(int i = 0; i < batch_size; i++) {
+		double* compact_state = board_states + i * COMPACT_STATE_SIZE;
+		fill_compact_state(boards[i],
+			(double(&)[9][4][4])compact_state[0],
+			(double(&)[2][4])compact_state[COMPACT_BOARD_SIZE],
+			compact_state[COMPACT_BOARD_SIZE + COMPACT_HIDDENS_SIZE]);
+		results[i].first = uniform_priors(boards[i]);
+		results[i].second = 0.;
+	}
+}
+
+/*
+	Player-to-move positions from random games with a fixed seed
+*/
+static std::vector<Board_> start_positions(std::size_t n) {
+	prng::Xoshiro256 engine(42);
+	std::vector<Board_> positions;
+	while(positions.size() < n) {
+		Board_ board;
+		std::uniform_int_distribution<int> n_plies(0, 12);
+		int plies = n_plies(engine);
+		for(int i = 0; i < plies && !board.game_ended(); i++) {
+			board.do_random_move(&engine);
+		}
+		if(board.is_env_move()) {
+			board.env_do_move(&engine);
+		}
+		if(!board.game_ended()) {
+			positions.push_back(board);
+		}
+	}
+	return positions;
+}
+
+static std::string quote(const std::string& s) {
+	return "\"" + s + "\"";
+}
+
+int main(int argc, char const *argv[])
+{
+	bench::Reporter reporter(argc, argv);
+
+	const unsigned int n_playout = 800;
+	auto positions = start_positions(256);
+
+	{
+		MCTS<Board_> search([](const Board_& b) { return std::make_pair(uniform_priors(b), 0.); }, 5., n_playout);
+		std::size_t i = 0;
+		reporter.run("mcts.playouts", [&]() {
+			Board_ board(positions[i++ % positions.size()]);
+			search.reset();
+			auto&& move_probs = search.get_move_probs(board);
+			bench::do_not_optimize(move_probs.second.data());
+			return n_playout;
+		}, { { "threads", "1" }, { "policy", quote("uniform") } });
+	}
+
+	std::vector<std::size_t> thread_counts = { 1, 2, 4, 8 };
+	std::size_t hardware_threads = std::max(1u, std::thread::hardware_concurrency());
+	if(hardware_threads > 8) {
+		thread_counts.push_back(hardware_threads);
+	}
+	const std::size_t batch_n_playout = 50;
+	for(std::size_t threads : thread_counts) {
+		for(std::size_t batch_size : { 16, 64, 256 }) {
+			BatchMCTS<Board_> search(uniform_batch_policy, COMPACT_STATE_SIZE, 5., batch_n_playout, threads, batch_size);
+			std::vector<bool> small_temp(positions.size(), false);
+			reporter.run("batch_mcts.playouts", [&]() {
+				search.reset();
+				auto&& move_probs = search.get_move_probs(positions, small_temp);
+				bench::do_not_optimize(move_probs.data());
+				return positions.size() * batch_n_playout;
+			}, {
+				{ "threads", std::to_string(threads) },
+				{ "batch_size", std::to_string(batch_size) },
+				{ "games", std::to_string(positions.size()) },
+				{ "policy", quote("uniform") }
+			});
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,162 @@
+#include "Board.h"
+#include "mcts.h"
+#include "CompactState.h"
+#include "bench.hpp"
+
+#include <vector>
+#include <random>
+
+using namespace mcts;
+using namespace elder_chess;
+
+prng::Xoshiro256 mcts::rng(0);
+
+typedef Board<true> Board_;
+
+/*
+	Positions and the move played in them, taken from random games with a
+	fixed seed so every run measures the same work.
+*/
+struct Sample {
+	Board_ board;
+	Move move;
+};
+
+static std::vector<std::vector<Sample>> random_games(int n_games) {
+	prng::Xoshiro256 engine(42);
+	std::vector<std::vector<Sample>> games(n_games);
+	for(auto& game : games) {
+		Board_ board;
+		while(!board.game_ended()) {
+			Board_ before(board);
+			Move m = board.do_random_move(&engine);
+			game.push_back(Sample{ before, m });
+		}
+	}
+	return games;
+}
+
+int main(int argc, char const *argv[])
+{
+	bench::Reporter reporter(argc, argv);
+
+	auto games = random_games(1000);
+	std::vector<Board_> positions, player_positions, env_positions;
+	for(auto& game : games) {
+		for(auto& sample : game) {
+			positions.push_back(sample.board);
+			if(sample.board.is_env_move()) {
+				env_positions.push_back(sample.board);
+			} else {
+				player_positions.push_back(sample.board);
+			}
+		}
+	}
+
+	reporter.run("board.do_move", [&games]() {
+		std::size_t ops = 0;
+		for(auto& game : games) {
+			Board_ board(game[0].board);
+			for(auto& sample : game) {
+				board.do_move(sample.move);
+			}
+			bench::do_not_optimize(board);
+			ops += game.size();
+		}
+		return ops;
+	});
+
+	reporter.run("board.get_moves", [&positions]() {
+		for(auto& board : positions) {
+			auto&& moves = board.get_moves();
+			bench::do_not_optimize(moves.data());
+		}
+		return positions.size();
+	});
+
+	reporter.run("board.get_winner", [&positions]() {
+		for(auto& board : positions) {
+			Side winner = board.get_winner();
+			bench::do_not_optimize(winner);
+		}
+		return positions.size();
+	});
+
+	reporter.run("fill_compact_state", [&player_positions]() {
+		double board_state[9][4][4];
+		double hiddens_state[2][4];
+		double remaining_steps_state;
+		for(auto& board : player_positions) {
+			fill_compact_state(board, board_state, hiddens_state, remaining_steps_state);
+			bench::do_not_optimize(board_state);
+		}
+		return player_positions.size();
+	});
+
+	std::vector<std::vector<std::pair<Move, double>>> priors;
+	for(auto& board : player_positions) {
+		auto&& moves = board.get_moves();
+		std::vector<std::pair<Move, double>> p;
+		for(auto& m : moves) {
+			p.push_back(std::make_pair(m, 1. / moves.size()));
+		}
+		priors.push_back(p);
+	}
+
+	reporter.run("tree_node.expand", [&priors]() {
+		for(auto& p : priors) {
+			TreeNode<Board_> node(nullptr, 1.);
+			node.expand(p);
+			bench::do_not_optimize(node);
+		}
+		return priors.size();
+	});
+
+	{
+		std::vector<TreeNode<Board_>*> roots;
+		for(auto& p : priors) {
+			TreeNode<Board_>* root = new TreeNode<Board_>(nullptr, 1.);
+			root->expand(p);
+			roots.push_back(root);
+		}
+		reporter.run("tree_node.select", [&roots]() {
+			for(auto root : roots) {
+				auto&& action_node = root->select(5.);
+				bench::do_not_optimize(action_node.second);
+			}
+			return roots.size();
+		});
+		reporter.run("tree_node.update_recursive", [&roots]() {
+			for(auto root : roots) {
+				auto&& action_node = root->select(5.);
+				action_node.second->update_recursive(0.5);
+			}
+			return roots.size();
+		});
+		for(auto root : roots) {
+			delete root;
+		}
+	}
+
+	{
+		std::vector<TreeNode<Board_>*> roots;
+		for(auto& board : env_positions) {
+			TreeNode<Board_>* root = new TreeNode<Board_>(nullptr, 1.);
+			root->expand(board.get_env_move_weights());
+			roots.push_back(root);
+		}
+		prng::Xoshiro256 engine(7);
+		reporter.run("tree_node.env_select", [&roots, &engine]() {
+			for(auto root : roots) {
+				auto&& action_node = root->env_select(&engine);
+				bench::do_not_optimize(action_node.second);
+			}
+			return roots.size();
+		});
+		for(auto root : roots) {
+			delete root;
+		}
+	}
+
+	return 0;
+}
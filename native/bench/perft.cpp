@@ -0,0 +1,1019 @@
+#include "Board.h"
+#include "BoardBatch.h"
+#include "CompactState.h"
+#include "mcts.h"
+#include "Arena.h"
+#include "Evaluators.h"
+#include "Expectimax.h"
+#include "SelfPlayRunner.h"
+#include "Symmetry.h"
+#include "Tablebase.h"
+#include "bench.hpp"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace elder_chess;
+
+prng::Xoshiro256 mcts::rng(0);
+
+/*
+	Move generation validator. Walks the full game tree to a fixed depth, where
+	a FLIP is followed by one node per distinct piece it can reveal (the
+	ENV_RAND outcomes of get_env_move_weights), and tallies what it sees. Any
+	change to move generation, move application or game end detection that is
+	not behavior preserving shows up as a mismatch against the reference table.
+*/
+struct PerftCounts {
+	uint64_t nodes = 0;			// positions exactly `depth` plies deep
+	uint64_t terminals = 0;		// finished games at or above `depth`
+	uint64_t chance_nodes = 0;	// interior positions where a flip outcome is drawn
+	uint64_t wins[3] = { 0, 0, 0 };	// terminals by winner: player 0, player 1, draw
+	uint64_t move_checksum = 0;	// order independent digest of every generated move list
+
+	PerftCounts& operator+=(const PerftCounts& other) {
+		nodes += other.nodes;
+		terminals += other.terminals;
+		chance_nodes += other.chance_nodes;
+		for(int i = 0; i < 3; i++) {
+			wins[i] += other.wins[i];
+		}
+		move_checksum += other.move_checksum;
+		return *this;
+	}
+
+	bool operator==(const PerftCounts& other) const {
+		return nodes == other.nodes && terminals == other.terminals && chance_nodes == other.chance_nodes
+			&& wins[0] == other.wins[0] && wins[1] == other.wins[1] && wins[2] == other.wins[2]
+			&& move_checksum == other.move_checksum;
+	}
+};
+
+static inline uint64_t mix(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+template<bool ds>
+static void perft(const Board<ds>& board, int depth, uint64_t path, PerftCounts& counts) {
+	if(board.game_ended()) {
+		counts.terminals++;
+		Side winner = board.get_winner();
+		counts.wins[winner == Sides::DRAW ? 2 : winner]++;
+		return;
+	}
+	if(depth == 0) {
+		counts.nodes++;
+		return;
+	}
+	auto&& moves = board.get_moves();
+	if(board.is_env_move()) {
+		counts.chance_nodes++;
+	}
+	for(const Move& m : moves) {
+		uint64_t code = m.type == Move::Type::ENV_RAND
+			? 0x100 + m.potential_piece.getSide() * 4 + m.potential_piece.value
+			: Symmetry::move_index(m);
+		counts.move_checksum += mix(path ^ code);
+		Board<ds> next(board);
+		next.do_move(m);
+		perft(next, depth - 1, mix(path * 131 + code), counts);
+	}
+}
+
+/*
+	Expands the tree breadth first on the calling thread until there are enough
+	subtrees to keep n_threads busy, then searches them in parallel.
+*/
+template<bool ds>
+static PerftCounts parallel_perft(const Board<ds>& root, int depth, std::size_t n_threads) {
+	struct Task {
+		Board<ds> board;
+		int depth;
+		uint64_t path;
+	};
+	std::vector<Task> tasks = { Task{ root, depth, 0 } };
+	PerftCounts ret;
+	// split until there is enough work to balance threads
+	while(n_threads > 1 && tasks.size() < n_threads * 16) {
+		std::vector<Task> next_tasks;
+		bool expanded = false;
+		for(auto& task : tasks) {
+			if(task.depth == 0 || task.board.game_ended()) {
+				perft(task.board, task.depth, task.path, ret);
+				continue;
+			}
+			expanded = true;
+			auto&& moves = task.board.get_moves();
+			if(task.board.is_env_move()) {
+				ret.chance_nodes++;
+			}
+			for(const Move& m : moves) {
+				uint64_t code = m.type == Move::Type::ENV_RAND
+					? 0x100 + m.potential_piece.getSide() * 4 + m.potential_piece.value
+					: Symmetry::move_index(m);
+				ret.move_checksum += mix(task.path ^ code);
+				Board<ds> next(task.board);
+				next.do_move(m);
+				next_tasks.push_back(Task{ next, task.depth - 1, mix(task.path * 131 + code) });
+			}
+		}
+		tasks.swap(next_tasks);
+		if(!expanded) {
+			break;
+		}
+	}
+
+	std::vector<PerftCounts> partial(n_threads);
+	std::atomic<std::size_t> next_task(0);
+	threading::ThreadPool pool;
+	pool.initialize(n_threads);
+	threading::ThreadGroup tg(pool);
+	for(std::size_t t = 0; t < n_threads; t++) {
+		tg.add_task([&, t]() {
+			std::size_t i;
+			while((i = next_task++) < tasks.size()) {
+				perft(tasks[i].board, tasks[i].depth, tasks[i].path, partial[t]);
+			}
+		});
+	}
+	tg.wait_all();
+	for(auto& p : partial) {
+		ret += p;
+	}
+	return ret;
+}
+
+/*
+	Start positions: 0 is the initial board, n > 0 a position n * 7 + 8 plies
+	into a game scripted with mix() rather than <random>, whose distributions
+	differ between standard libraries.
+*/
+static const int NUM_POSITIONS = 6;
+
+template<bool ds>
+static Board<ds> start_position(int position) {
+	Board<ds> board;
+	int plies = position == 0 ? 0 : position * 7 + 8;
+	for(int i = 0; i < plies && !board.game_ended(); i++) {
+		uint64_t r = mix(position * 1000 + i);
+		if(board.is_env_move()) {
+			auto&& weights = board.get_env_move_weights();
+			double total = 0.;
+			for(auto& w : weights) {
+				total += w.second;
+			}
+			double x = (r % 1000000) / 1000000. * total;
+			std::size_t k = 0;
+			while(k + 1 < weights.size() && x >= weights[k].second) {
+				x -= weights[k].second;
+				k++;
+			}
+			board.do_move(weights[k].first);
+		} else {
+			auto&& moves = board.get_moves();
+			board.do_move(moves[r % moves.size()]);
+		}
+	}
+	return board;
+}
+
+struct Reference {
+	bool dynamic_steps;
+	int position;
+	int depth;
+	PerftCounts counts;
+};
+
+/*
+	Generated from the original _scanAvailableMoves/do_move/get_winner
+	(perft --generate); do not edit by hand.
+*/
+static const std::vector<Reference>& references() {
+	static const std::vector<Reference> refs = {
+		{ true, 0, 6, { 1706880ULL, 0ULL, 216976ULL, { 0ULL, 0ULL, 0ULL }, 9899240064793336543ULL } },
+		{ true, 1, 6, { 357102ULL, 0ULL, 29510ULL, { 0ULL, 0ULL, 0ULL }, 13785103689364818260ULL } },
+		{ true, 2, 6, { 106886ULL, 0ULL, 6866ULL, { 0ULL, 0ULL, 0ULL }, 14277148125491432823ULL } },
+		{ true, 3, 6, { 67639ULL, 2394ULL, 4429ULL, { 2394ULL, 0ULL, 0ULL }, 2895266846204090641ULL } },
+		{ true, 4, 6, { 239421ULL, 887ULL, 3764ULL, { 494ULL, 382ULL, 11ULL }, 8136297487838702914ULL } },
+		{ true, 5, 6, { 37558ULL, 653ULL, 888ULL, { 653ULL, 0ULL, 0ULL }, 784465353434423383ULL } },
+		{ false, 0, 6, { 1706880ULL, 0ULL, 216976ULL, { 0ULL, 0ULL, 0ULL }, 9899240064793336543ULL } },
+		{ false, 1, 6, { 357102ULL, 0ULL, 29510ULL, { 0ULL, 0ULL, 0ULL }, 13785103689364818260ULL } },
+		{ false, 2, 6, { 106886ULL, 0ULL, 6866ULL, { 0ULL, 0ULL, 0ULL }, 14277148125491432823ULL } },
+		{ false, 3, 6, { 67639ULL, 2394ULL, 4429ULL, { 2394ULL, 0ULL, 0ULL }, 2895266846204090641ULL } },
+		{ false, 4, 6, { 239939ULL, 369ULL, 3764ULL, { 0ULL, 369ULL, 0ULL }, 8136297487838702914ULL } },
+		{ false, 5, 6, { 37558ULL, 653ULL, 888ULL, { 653ULL, 0ULL, 0ULL }, 784465353434423383ULL } },
+	};
+	return refs;
+}
+
+static void print_counts(const char* board_type, int position, int depth, std::size_t n_threads, const PerftCounts& c, double seconds, std::ostream& os) {
+	uint64_t leaves = c.nodes + c.terminals;
+	os << "{\"benchmark\": \"perft\", \"board\": \"" << board_type << "\""
+	   << ", \"position\": " << position
+	   << ", \"depth\": " << depth
+	   << ", \"threads\": " << n_threads
+	   << ", \"nodes\": " << c.nodes
+	   << ", \"terminals\": " << c.terminals
+	   << ", \"chance_nodes\": " << c.chance_nodes
+	   << ", \"wins\": [" << c.wins[0] << ", " << c.wins[1] << ", " << c.wins[2] << "]"
+	   << ", \"move_checksum\": " << c.move_checksum
+	   << ", \"seconds\": " << seconds
+	   << ", \"leaves_per_sec\": " << (seconds > 0 ? leaves / seconds : 0.)
+	   << "}" << std::endl;
+}
+
+template<bool ds>
+static PerftCounts run(int position, int depth, std::size_t n_threads, std::ostream& os) {
+	Board<ds> board = start_position<ds>(position);
+	auto start = bench::clock::now();
+	PerftCounts counts = parallel_perft(board, depth, n_threads);
+	print_counts(ds ? "dynamic_steps" : "static_steps", position, depth, n_threads, counts, bench::seconds_since(start), os);
+	return counts;
+}
+
+static PerftCounts run(bool dynamic_steps, int position, int depth, std::size_t n_threads, std::ostream& os) {
+	return dynamic_steps ? run<true>(position, depth, n_threads, os) : run<false>(position, depth, n_threads, os);
+}
+
+template<bool ds>
+static std::string describe(const Board<ds>& board) {
+	std::ostringstream os;
+	os << board;
+	return os.str();
+}
+
+/*
+	BoardBatch validator. Plays n_games random games through a BoardBatch and
+	through one Board each in lockstep, the batch drawing the flip outcomes
+	and each game its moves from a stream of its own, and after every step
+	compares the legal moves, the boards (squares, hidden pieces, side to
+	move, step counters), the winners and the network encodings. Every
+	decision also tries one illegal move, which the batch must refuse.
+	Returns the number of games that went out of step.
+*/
+template<bool ds>
+static int verify_lockstep(std::size_t n_games, std::size_t n_threads) {
+	typedef Board<ds> Board_;
+	typedef BoardBatch<ds> BoardBatch_;
+	const int n_indices = BoardBatch_::NUM_MOVE_INDICES;
+	BoardBatch_ batch(n_games, Board_::DEFAULT_MAX_STEPS, n_threads);
+	std::vector<Board_> boards(n_games);
+	std::vector<prng::Xoshiro256> engines;
+	for(std::size_t i = 0; i < n_games; i++) {
+		engines.emplace_back(prng::derive(7, { i }));
+	}
+	std::vector<bool> failed(n_games, false);
+	std::vector<uint8_t> masks(n_games * n_indices), applied(n_games);
+	std::vector<int> move_indices(n_games), winners(n_games), players(n_games);
+	std::vector<float> board_states(n_games * COMPACT_BOARD_SIZE), hiddens(n_games * COMPACT_HIDDENS_SIZE), remaining_steps(n_games);
+	uint64_t plies = 0;
+
+	auto fail = [&](std::size_t i, const std::string& what) {
+		if(!failed[i]) {
+			std::cerr << "MISMATCH: game " << i << ", " << what << std::endl << boards[i] << batch.board(i);
+			failed[i] = true;
+		}
+	};
+
+	auto start = bench::clock::now();
+	for(uint64_t step = 0; ; step++) {
+		batch.legal_masks(masks.data());
+		batch.winners(winners.data());
+		batch.current_players(players.data());
+		batch.encode(board_states.data(), hiddens.data(), remaining_steps.data());
+		bool any_active = false;
+		bool any_flip = false;
+		for(std::size_t i = 0; i < n_games; i++) {
+			move_indices[i] = -1;
+			if(failed[i]) {
+				continue;
+			}
+			const Board_& board = boards[i];
+			if(describe(batch.board(i)) != describe(board) || batch.board(i).hash() != board.hash()
+				|| batch.board(i).get_remaining_steps() != board.get_remaining_steps()) {
+				fail(i, "board");
+				continue;
+			}
+			if(winners[i] != board.get_winner() || players[i] != board.get_current_player()) {
+				fail(i, "winner or player to move");
+				continue;
+			}
+			double compact_board[9][4][4], compact_hiddens[2][4], compact_steps;
+			fill_compact_state(board, compact_board, compact_hiddens, compact_steps);
+			bool same_encoding = remaining_steps[i] == (float)compact_steps;
+			for(int k = 0; k < COMPACT_BOARD_SIZE; k++) {
+				same_encoding &= board_states[i * COMPACT_BOARD_SIZE + k] == (float)(&compact_board[0][0][0])[k];
+			}
+			for(int k = 0; k < COMPACT_HIDDENS_SIZE; k++) {
+				same_encoding &= hiddens[i * COMPACT_HIDDENS_SIZE + k] == (float)(&compact_hiddens[0][0])[k];
+			}
+			if(!same_encoding) {
+				fail(i, "encoding");
+				continue;
+			}
+			if(board.game_ended()) {
+				continue;
+			}
+			any_active = true;
+			if(board.is_env_move()) {
+				any_flip = true;
+				continue;
+			}
+
+			std::vector<uint8_t> legal(n_indices, 0);
+			auto&& moves = board.get_moves();
+			for(const Move& m : moves) {
+				legal[Symmetry::move_index(m)] = 1;
+			}
+			if(!std::equal(legal.begin(), legal.end(), masks.begin() + i * n_indices)) {
+				fail(i, "legal moves");
+				continue;
+			}
+			std::vector<int> illegal;
+			for(int k = 0; k < n_indices; k++) {
+				if(!legal[k]) {
+					illegal.push_back(k);
+				}
+			}
+			move_indices[i] = illegal[engines[i].below(illegal.size())];
+		}
+		if(!any_active) {
+			break;
+		}
+
+		if(any_flip) {
+			// the batch draws the outcomes, the boards take the same ones
+			batch.env_step(prng::derive(7, { step }));
+			for(std::size_t i = 0; i < n_games; i++) {
+				if(failed[i] || boards[i].game_ended() || !boards[i].is_env_move()) {
+					continue;
+				}
+				// the flipped square is the one face down on the board and not in the batch
+				Board_ revealed = batch.board(i);
+				Piece outcome = Piece::hidden();
+				for(int k = 0; k < 16; k++) {
+					if(boards[i].at(k / 4, k % 4).isHidden() && !revealed.at(k / 4, k % 4).isHidden()) {
+						outcome = revealed.at(k / 4, k % 4);
+					}
+				}
+				bool possible = false;
+				for(auto& w : boards[i].get_env_move_weights()) {
+					possible |= w.first.potential_piece == outcome && w.second > 0;
+				}
+				if(!possible) {
+					fail(i, "flip outcome");
+					continue;
+				}
+				boards[i].do_move(Move(outcome));
+				plies++;
+			}
+			continue;
+		}
+
+		batch.do_moves(move_indices.data(), applied.data());
+		for(std::size_t i = 0; i < n_games; i++) {
+			if(move_indices[i] >= 0 && applied[i]) {
+				fail(i, "illegal move played");
+			}
+		}
+		for(std::size_t i = 0; i < n_games; i++) {
+			move_indices[i] = -1;
+			if(failed[i] || boards[i].game_ended()) {
+				continue;
+			}
+			auto&& moves = boards[i].get_moves();
+			Move m = moves[engines[i].below(moves.size())];
+			move_indices[i] = Symmetry::move_index(m);
+			boards[i].do_move(m);
+		}
+		batch.do_moves(move_indices.data(), applied.data());
+		for(std::size_t i = 0; i < n_games; i++) {
+			if(move_indices[i] >= 0) {
+				plies++;
+				if(!applied[i]) {
+					fail(i, "legal move refused");
+				}
+			}
+		}
+	}
+	int failures = std::count(failed.begin(), failed.end(), true);
+	std::cout << "{\"benchmark\": \"lockstep\", \"board\": \"" << (ds ? "dynamic_steps" : "static_steps") << "\""
+	   << ", \"games\": " << n_games
+	   << ", \"threads\": " << n_threads
+	   << ", \"plies\": " << plies
+	   << ", \"failures\": " << failures
+	   << ", \"seconds\": " << bench::seconds_since(start)
+	   << "}" << std::endl;
+	return failures;
+}
+
+/*
+	Tablebase validator. Generates a table of up to max_pieces pieces, then for
+	samples random positions of every material checks that the index maps the
+	position to its own entry and that probe agrees with an Expectimax search
+	run to the exact value. Fully revealed positions have no chance nodes, so
+	both sides must give exactly a win, a draw or a loss. Returns the number
+	of mismatches.
+*/
+template<bool ds>
+static int verify_tablebase(int max_pieces, int samples, std::size_t n_threads) {
+	typedef Board<ds> Board_;
+	const int max_steps = Board_::DEFAULT_MAX_STEPS;
+	const std::string path = "perft_tablebase_" + std::to_string(max_pieces) + ".bin";
+	auto start = bench::clock::now();
+	Tablebase<Board_>::generate(path, max_pieces, max_steps, n_threads);
+	Tablebase<Board_> table(path);
+	std::remove(path.c_str());
+	double generate_seconds = bench::seconds_since(start);
+
+	tablebase::Index index(max_pieces, max_steps);
+	Expectimax<Board_> expectimax(18);
+	prng::Xoshiro256 engine(prng::derive(0, { (uint64_t)max_pieces }));
+	int failures = 0;
+	uint64_t checked = 0, unresolved = 0, nodes = 0;
+	start = bench::clock::now();
+	for(const tablebase::Index::Material& m : index.materials()) {
+		for(int i = 0; i < samples; i++) {
+			uint64_t placement = engine.below(m.placements);
+			int remaining_steps = 1 + engine.below(max_steps);
+			Side player = (Side)engine.below(2);
+			Piece squares[4][4];
+			index.squares(m, placement, squares);
+			Board_ board = Board_::revealed(squares, player, remaining_steps, max_steps);
+
+			uint64_t i_board;
+			uint64_t expected = m.offset + ((uint64_t)(remaining_steps - 1) * m.placements + placement) * 2 + player;
+			int value;
+			if(!index.index(board, i_board) || i_board != expected || !table.probe(board, value)) {
+				std::cerr << "MISMATCH: index of material at " << m.offset << ", placement " << placement << std::endl << board;
+				failures++;
+				continue;
+			}
+
+			double exact;
+			if(board.game_ended()) {
+				Side winner = board.get_winner();
+				exact = winner == Sides::DRAW ? 0. : (winner == player ? 1. : -1.);
+			} else {
+				auto result = expectimax.search(board, 0., Expectimax<Board_>::MAX_DEPTH, 1000000);
+				nodes += result.nodes;
+				if(!result.exact) {
+					unresolved++;
+					continue;
+				}
+				exact = result.value;
+			}
+			checked++;
+			if(exact != value) {
+				std::cerr << "MISMATCH: tablebase " << value << ", expectimax " << exact << std::endl << board;
+				failures++;
+			}
+		}
+	}
+	std::cout << "{\"benchmark\": \"tablebase\", \"board\": \"" << (ds ? "dynamic_steps" : "static_steps") << "\""
+	   << ", \"max_pieces\": " << max_pieces
+	   << ", \"entries\": " << table.size()
+	   << ", \"generate_seconds\": " << generate_seconds
+	   << ", \"checked\": " << checked
+	   << ", \"unresolved\": " << unresolved
+	   << ", \"expectimax_nodes\": " << nodes
+	   << ", \"seconds\": " << bench::seconds_since(start)
+	   << "}" << std::endl;
+	return failures;
+}
+
+/*
+	Game value for PLAYER_0 by plain exhaustive expectimax, the reference of
+	the solver checks: every move of every decision node and every outcome of
+	every flip, weighted by get_env_move_weights. Decision nodes are memoized
+	by hash(). False once more than budget nodes were needed.
+*/
+template<bool ds>
+static bool exact_value(const Board<ds>& board, std::unordered_map<uint64_t, double>& memo, int64_t& budget, double& value) {
+	bool decision = !board.game_ended() && !board.is_env_move();
+	if(decision) {
+		auto it = memo.find(board.hash());
+		if(it != memo.end()) {
+			value = it->second;
+			return true;
+		}
+	}
+	if(--budget < 0) {
+		return false;
+	}
+	if(board.game_ended()) {
+		Side winner = board.get_winner();
+		value = winner == Sides::DRAW ? 0. : (winner == Sides::PLAYER_0 ? 1. : -1.);
+		return true;
+	}
+	if(board.is_env_move()) {
+		double total = 0., total_weight = 0.;
+		for(auto& outcome : board.get_env_move_weights()) {
+			Board<ds> next(board);
+			next.do_move(outcome.first);
+			double v;
+			if(!exact_value(next, memo, budget, v)) {
+				return false;
+			}
+			total += outcome.second * v;
+			total_weight += outcome.second;
+		}
+		value = total / total_weight;
+		return true;
+	}
+	bool maximize = board.get_current_player() == Sides::PLAYER_0;
+	double best = maximize ? -2. : 2.;
+	for(const Move& m : board.get_moves()) {
+		Board<ds> next(board);
+		next.do_move(m);
+		double v;
+		if(!exact_value(next, memo, budget, v)) {
+			return false;
+		}
+		best = maximize ? std::max(best, v) : std::min(best, v);
+	}
+	memo[board.hash()] = best;
+	value = best;
+	return true;
+}
+
+template<bool ds>
+struct Endgame {
+	Board<ds> board;
+	double value;	// for PLAYER_0
+};
+
+template<bool ds>
+static int num_pieces(const Board<ds>& board) {
+	int n = 0;
+	for(Side side : { Sides::PLAYER_0, Sides::PLAYER_1 }) {
+		for(int value = 0; value < 4; value++) {
+			n += board.get_num_on_board(side, value);
+		}
+	}
+	return n;
+}
+
+/*
+	The solver checks' position set, the same on every run: game i is a
+	random game seeded with i that takes a capture three times in four when
+	it has one, played to the first player's move with at most 3 or 4
+	pieces left, face down ones included. Positions are kept when
+	exact_value solves them within max_nodes.
+*/
+template<bool ds>
+static std::vector<Endgame<ds>> endgame_positions(std::size_t n, int64_t max_nodes, std::unordered_map<uint64_t, double>& memo) {
+	std::vector<Endgame<ds>> positions;
+	for(uint64_t game = 0; positions.size() < n; game++) {
+		prng::Xoshiro256 engine(prng::derive(5, { game }));
+		Board<ds> board;
+		int max_pieces = 3 + engine.below(2);
+		while(!board.game_ended() && (num_pieces(board) > max_pieces || board.is_env_move())) {
+			if(board.is_env_move()) {
+				board.env_do_move(&engine);
+				continue;
+			}
+			auto&& moves = board.get_moves();
+			std::vector<Move> captures;
+			for(const Move& m : moves) {
+				Board<ds> next(board);
+				next.do_move(m);
+				if(num_pieces(next) < num_pieces(board)) {
+					captures.push_back(m);
+				}
+			}
+			if(!captures.empty() && engine.below(4) != 0) {
+				board.do_move(captures[engine.below(captures.size())]);
+			} else {
+				board.do_move(moves[engine.below(moves.size())]);
+			}
+		}
+		int64_t budget = max_nodes;
+		double value;
+		if(!board.game_ended() && exact_value(board, memo, budget, value)) {
+			positions.push_back(Endgame<ds>{ board, value });
+		}
+	}
+	return positions;
+}
+
+/*
+	Expectimax validator. Searches every position and fails on any where the
+	engine claims an exact value other than exact_value's or picks a move
+	worth less. Returns the number of mismatches.
+*/
+template<bool ds>
+static int verify_expectimax(const std::vector<Endgame<ds>>& positions, std::unordered_map<uint64_t, double>& memo) {
+	typedef Board<ds> Board_;
+	int failures = 0;
+	uint64_t with_flips = 0, unresolved = 0, nodes = 0;
+	for(auto& position : positions) {
+		with_flips += position.board.get_num_hidden() > 0;
+	}
+	Expectimax<Board_> expectimax(18);
+	auto start = bench::clock::now();
+	for(std::size_t i = 0; i < positions.size(); i++) {
+		const Endgame<ds>& position = positions[i];
+		auto result = expectimax.search(position.board, 0., Expectimax<Board_>::MAX_DEPTH, 1000000);
+		nodes += result.nodes;
+		if(!result.exact) {
+			unresolved++;
+			continue;
+		}
+		double value = position.board.get_current_player() == Sides::PLAYER_0 ? result.value : -result.value;
+		Board_ next(position.board);
+		next.do_move(result.move);
+		int64_t budget = 100000000;
+		double move_value;
+		exact_value(next, memo, budget, move_value);
+		if(std::abs(value - position.value) > 1e-9 || std::abs(move_value - position.value) > 1e-9) {
+			std::cerr << "MISMATCH: position " << i << ", exact " << position.value << ", expectimax " << value
+				<< ", its move " << move_value << std::endl << position.board;
+			failures++;
+		}
+	}
+	std::cout << "{\"benchmark\": \"solver\", \"board\": \"" << (ds ? "dynamic_steps" : "static_steps") << "\""
+	   << ", \"engine\": \"expectimax\""
+	   << ", \"positions\": " << positions.size()
+	   << ", \"with_flips\": " << with_flips
+	   << ", \"unresolved\": " << unresolved
+	   << ", \"nodes\": " << nodes
+	   << ", \"seconds\": " << bench::seconds_since(start)
+	   << "}" << std::endl;
+	return failures;
+}
+
+template<bool ds>
+static std::vector<std::pair<Move, double>> uniform_priors(const Board<ds>& board) {
+	auto&& moves = board.get_moves();
+	std::vector<std::pair<Move, double>> priors;
+	for(auto& m : moves) {
+		priors.push_back(std::make_pair(m, 1. / moves.size()));
+	}
+	return priors;
+}
+
+/*
+	MCTS-Solver validator. Searches every position with MCTS and with BatchMCTS under uniform priors and a zero value, first with
+	proof propagation alone and then with Expectimax as leaf solver. Wherever
+	a search proves its root, the proven value must be exact_value's and the
+	most likely move must be worth as much; unproven roots carry no such
+	promise and are only counted. Returns the number of mismatches.
+*/
+template<bool ds>
+static int verify_search_solver(const std::vector<Endgame<ds>>& positions, std::unordered_map<uint64_t, double>& memo, std::size_t n_threads) {
+	typedef Board<ds> Board_;
+	const unsigned int n_playout = 20000;
+	std::vector<Board_> boards;
+	for(auto& position : positions) {
+		boards.push_back(position.board);
+	}
+
+	auto check = [&](std::size_t i, double proven_value, const std::vector<Move>& moves, const std::vector<double>& probs, const char* search) {
+		Board_ next(positions[i].board);
+		next.do_move(moves[std::max_element(probs.begin(), probs.end()) - probs.begin()]);
+		int64_t budget = 100000000;
+		double move_value;
+		exact_value(next, memo, budget, move_value);
+		if(std::abs(proven_value - positions[i].value) > 1e-9 || std::abs(move_value - positions[i].value) > 1e-9) {
+			std::cerr << "MISMATCH: " << search << ", position " << i << ", exact " << positions[i].value
+				<< ", proven " << proven_value << ", its move " << move_value << std::endl << positions[i].board;
+			return 1;
+		}
+		return 0;
+	};
+
+	int failures = 0;
+	for(bool leaf_solver : { false, true }) {
+		typename mcts::MCTS<Board_>::LeafSolver solver;
+		if(leaf_solver) {
+			solver = [](const Board_& board, double& value) {
+				static thread_local Expectimax<Board_> engine(16);
+				return engine.solve(board, 20000, value);
+			};
+		}
+
+		mcts::MCTS<Board_> search([](const Board_& board) { return std::make_pair(uniform_priors(board), 0.); }, 5., n_playout);
+		search.set_leaf_solver(solver);
+		uint64_t proven = 0;
+		auto start = bench::clock::now();
+		for(std::size_t i = 0; i < boards.size(); i++) {
+			Board_ board(boards[i]);
+			search.reset();
+			auto&& move_probs = search.get_move_probs(board);
+			double value;
+			if(search.root_proven(value)) {
+				proven++;
+				failures += check(i, value, move_probs.first, move_probs.second, "mcts");
+			}
+		}
+		double seconds = bench::seconds_since(start);
+
+		mcts::BatchMCTS<Board_> batch_search([](const std::vector<Board_>& boards, std::vector<typename mcts::BatchMCTS<Board_>::EvalResult>& results, int batch_size, void*) {
+			for(int i = 0; i < batch_size; i++) {
+				results[i] = std::make_pair(uniform_priors(boards[i]), 0.);
+			}
+		}, 1, 5., n_playout, n_threads, 16);
+		batch_search.set_leaf_solver(solver);
+		std::vector<Board_> batch_boards(boards);
+		std::vector<bool> small_temp(boards.size(), false);
+		uint64_t batch_proven = 0;
+		start = bench::clock::now();
+		auto&& batch_move_probs = batch_search.get_move_probs(batch_boards, small_temp);
+		double batch_seconds = bench::seconds_since(start);
+		for(std::size_t i = 0; i < boards.size(); i++) {
+			double value;
+			if(batch_search.root_proven(i, value)) {
+				batch_proven++;
+				failures += check(i, value, batch_move_probs[i].first, batch_move_probs[i].second, "batch_mcts");
+			}
+		}
+
+		std::cout << "{\"benchmark\": \"solver\", \"board\": \"" << (ds ? "dynamic_steps" : "static_steps") << "\""
+		   << ", \"engine\": \"mcts\""
+		   << ", \"leaf_solver\": " << (leaf_solver ? "true" : "false")
+		   << ", \"positions\": " << boards.size()
+		   << ", \"proven\": " << proven
+		   << ", \"playouts\": " << search.stats()["playouts"]
+		   << ", \"seconds\": " << seconds
+		   << ", \"batch_proven\": " << batch_proven
+		   << ", \"batch_playouts\": " << batch_search.stats()["playouts"]
+		   << ", \"batch_seconds\": " << batch_seconds
+		   << "}" << std::endl;
+	}
+	return failures;
+}
+
+/* Runs every solver check on the endgame_positions set; returns the number of mismatches */
+template<bool ds>
+static int verify_solvers(std::size_t n_positions, std::size_t n_threads) {
+	std::unordered_map<uint64_t, double> memo;
+	auto positions = endgame_positions<ds>(n_positions, 200000, memo);
+	return verify_expectimax(positions, memo) + verify_search_solver(positions, memo, n_threads);
+}
+
+/*
+	Reproducibility validator. Plays seeded self-play and arena games twice
+	from the same seed, as the bindings do when given one: once on n_threads
+	search threads and once on a single thread. Moves, flips, recorded
+	policies and winners must match, and another seed must change the moves.
+	Returns the number of mismatches.
+*/
+template<bool ds>
+static int verify_reproduce(std::size_t n_games, std::size_t n_threads) {
+	typedef Board<ds> Board_;
+	const unsigned int n_playout = 64;
+	auto policy = batched<Board_>(HeuristicEvaluator<Board_>());
+
+	auto self_play = [&](uint64_t seed, std::size_t threads) {
+		mcts::BatchMCTS<Board_> search(policy, 0, 5., n_playout, threads, 16);
+		search.set_seed(seed);
+		SelfPlayRunner<Board_> runner(search, typename SelfPlayRunner<Board_>::Options());
+		prng::Xoshiro256 engine(seed);
+		return runner.play(n_games, Board_(), &engine);
+	};
+	auto arena = [&](uint64_t seed, std::size_t threads) {
+		mcts::BatchMCTS<Board_> first(policy, 0, 5., n_playout, threads, 16), second(policy, 0, 5., n_playout / 2, threads, 16);
+		first.set_seed(prng::derive(seed, { 0 }));
+		second.set_seed(prng::derive(seed, { 1 }));
+		typename Arena<Board_>::Options options;
+		options.sampled_plies = 10;
+		Arena<Board_> arena(first, second, options);
+		prng::Xoshiro256 engine(seed);
+		return arena.play((n_games + 1) / 2, Board_(), &engine);
+	};
+
+	int failures = 0;
+	auto start = bench::clock::now();
+	auto&& trajectories = self_play(1, n_threads);
+	auto&& again = self_play(1, 1);
+	if(trajectories.plies != again.plies || trajectories.seeds != again.seeds || trajectories.winners != again.winners
+		|| trajectories.policies != again.policies || trajectories.outcomes != again.outcomes || trajectories.game_indices != again.game_indices) {
+		std::cerr << "MISMATCH: self-play games differ under the same seed" << std::endl;
+		failures++;
+	}
+	if(self_play(2, n_threads).plies == trajectories.plies) {
+		std::cerr << "MISMATCH: self-play games ignore their seed" << std::endl;
+		failures++;
+	}
+	auto&& result = arena(1, n_threads);
+	auto&& result_again = arena(1, 1);
+	if(result.winners != result_again.winners || result.seeds != result_again.seeds) {
+		std::cerr << "MISMATCH: arena games differ under the same seed" << std::endl;
+		failures++;
+	}
+	double seconds = bench::seconds_since(start);
+
+	std::cout << "{\"benchmark\": \"reproduce\", \"board\": \"" << (ds ? "dynamic_steps" : "static_steps") << "\""
+	   << ", \"games\": " << n_games
+	   << ", \"positions\": " << trajectories.positions.size()
+	   << ", \"threads\": " << n_threads
+	   << ", \"seconds\": " << seconds
+	   << "}" << std::endl;
+	return failures;
+}
+
+/*
+	Minimum budget validator. Searches random positions, flips included,
+	with MCTS and BatchMCTS, with and without a Gumbel root and early
+	stopping, under a deadline too short for a single playout. Every search
+	must still return moves with finite probabilities summing to one.
+	Returns the number of searches that did not.
+*/
+template<bool ds>
+static int verify_min_budget(std::size_t n_positions, std::size_t n_threads) {
+	typedef Board<ds> Board_;
+	std::vector<Board_> boards;
+	for(std::size_t i = 0; boards.size() < n_positions; i++) {
+		prng::Xoshiro256 engine = prng::stream(11, { i });
+		Board_ board;
+		for(std::size_t ply = engine.below(40); ply > 0 && !board.game_ended(); ply--) {
+			board.do_random_move(&engine);
+		}
+		if(!board.game_ended()) {
+			boards.push_back(board);
+		}
+	}
+
+	int failures = 0;
+	auto check = [&](std::size_t i, const std::vector<Move>& moves, const std::vector<double>& probs, const char* search) {
+		double sum = 0.;
+		bool finite = true;
+		for(double p : probs) {
+			finite = finite && std::isfinite(p);
+			sum += p;
+		}
+		if(moves.empty() || moves.size() != probs.size() || !finite || std::abs(sum - 1.) > 1e-9) {
+			std::cerr << "MISMATCH: " << search << ", position " << i << ", " << moves.size() << " moves, probabilities summing to " << sum << std::endl << boards[i];
+			failures++;
+		}
+	};
+
+	auto start = bench::clock::now();
+	for(bool gumbel : { false, true }) {
+		for(bool early_stop : { false, true }) {
+			mcts::SearchLimits limits;
+			limits.seconds = 1e-9;
+			limits.early_stop = early_stop;
+			limits.extension = early_stop ? 1.5 : 1.;
+			mcts::GumbelOptions options;
+			options.max_considered = gumbel ? 8 : 0;
+
+			mcts::MCTS<Board_> search([](const Board_& board) { return HeuristicEvaluator<Board_>()(board); }, 5., 10000);
+			search.set_search_limits(limits);
+			search.set_gumbel_root(options);
+			for(std::size_t i = 0; i < boards.size(); i++) {
+				Board_ board(boards[i]);
+				search.reset();
+				auto&& move_probs = search.get_move_probs(board);
+				check(i, move_probs.first, move_probs.second, "mcts");
+			}
+
+			mcts::BatchMCTS<Board_> batch_search(batched<Board_>(HeuristicEvaluator<Board_>()), 0, 5., 10000, n_threads, 16);
+			batch_search.set_search_limits(limits);
+			batch_search.set_gumbel_root(options);
+			std::vector<Board_> batch_boards(boards);
+			std::vector<bool> small_temp(boards.size(), false);
+			auto&& batch_move_probs = batch_search.get_move_probs(batch_boards, small_temp);
+			batch_search.reset();
+			for(std::size_t i = 0; i < boards.size(); i++) {
+				check(i, batch_move_probs[i].first, batch_move_probs[i].second, "batch_mcts");
+			}
+		}
+	}
+	double seconds = bench::seconds_since(start);
+
+	std::cout << "{\"benchmark\": \"min_budget\", \"board\": \"" << (ds ? "dynamic_steps" : "static_steps") << "\""
+	   << ", \"positions\": " << boards.size()
+	   << ", \"threads\": " << n_threads
+	   << ", \"seconds\": " << seconds
+	   << "}" << std::endl;
+	return failures;
+}
+
+int main(int argc, char const *argv[])
+{
+	int depth = 5;
+	int position = 0;
+	bool dynamic_steps = true;
+	bool verify = false;
+	bool generate = false;
+	int tablebase_pieces = 0;
+	int samples = 20;
+	bool solver = false;
+	int n_positions = 100;
+	int lockstep_games = 0;
+	int reproduce_games = 0;
+	bool min_budget = false;
+	std::size_t n_threads = std::max(1u, std::thread::hardware_concurrency());
+	for(int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if(arg == "--depth" && i + 1 < argc) {
+			depth = std::atoi(argv[++i]);
+		} else if(arg == "--threads" && i + 1 < argc) {
+			n_threads = std::max(1, std::atoi(argv[++i]));
+		} else if(arg == "--position" && i + 1 < argc) {
+			position = std::atoi(argv[++i]);
+		} else if(arg == "--static") {
+			dynamic_steps = false;
+		} else if(arg == "--verify") {
+			verify = true;
+		} else if(arg == "--generate") {
+			generate = true;
+		} else if(arg == "--tablebase" && i + 1 < argc) {
+			tablebase_pieces = std::atoi(argv[++i]);
+		} else if(arg == "--samples" && i + 1 < argc) {
+			samples = std::max(1, std::atoi(argv[++i]));
+		} else if(arg == "--lockstep" && i + 1 < argc) {
+			lockstep_games = std::max(1, std::atoi(argv[++i]));
+		} else if(arg == "--reproduce" && i + 1 < argc) {
+			reproduce_games = std::max(1, std::atoi(argv[++i]));
+		} else if(arg == "--min-budget") {
+			min_budget = true;
+		} else if(arg == "--solver") {
+			solver = true;
+		} else if(arg == "--positions" && i + 1 < argc) {
+			n_positions = std::max(1, std::atoi(argv[++i]));
+		} else {
+			std::cerr << "usage: perft [--depth d] [--position p] [--threads n] [--static] [--verify] [--generate] [--lockstep n_games] [--reproduce n_games] [--min-budget [--positions n]] [--tablebase max_pieces [--samples n]] [--solver [--positions n]]" << std::endl;
+			return 2;
+		}
+	}
+
+	if(position < 0 || position >= NUM_POSITIONS) {
+		std::cerr << "position must be in [0, " << NUM_POSITIONS << ")" << std::endl;
+		return 2;
+	}
+
+	if(lockstep_games > 0) {
+		int failures = dynamic_steps ? verify_lockstep<true>(lockstep_games, n_threads) : verify_lockstep<false>(lockstep_games, n_threads);
+		std::cout << (failures == 0 ? "perft: BoardBatch matches Board" : "perft: FAILED") << std::endl;
+		return failures == 0 ? 0 : 1;
+	}
+
+	if(min_budget) {
+		int failures = dynamic_steps ? verify_min_budget<true>(n_positions, n_threads) : verify_min_budget<false>(n_positions, n_threads);
+		std::cout << (failures == 0 ? "perft: every search returns a move distribution" : "perft: FAILED") << std::endl;
+		return failures == 0 ? 0 : 1;
+	}
+
+	if(reproduce_games > 0) {
+		int failures = dynamic_steps ? verify_reproduce<true>(reproduce_games, n_threads) : verify_reproduce<false>(reproduce_games, n_threads);
+		std::cout << (failures == 0 ? "perft: seeded games repeat exactly" : "perft: FAILED") << std::endl;
+		return failures == 0 ? 0 : 1;
+	}
+
+	if(tablebase_pieces > 0) {
+		int failures = dynamic_steps ? verify_tablebase<true>(tablebase_pieces, samples, n_threads) : verify_tablebase<false>(tablebase_pieces, samples, n_threads);
+		std::cout << (failures == 0 ? "perft: tablebase matches expectimax" : "perft: FAILED") << std::endl;
+		return failures == 0 ? 0 : 1;
+	}
+
+	if(solver) {
+		int failures = dynamic_steps ? verify_solvers<true>(n_positions, n_threads) : verify_solvers<false>(n_positions, n_threads);
+		std::cout << (failures == 0 ? "perft: solvers match exhaustive expectimax" : "perft: FAILED") << std::endl;
+		return failures == 0 ? 0 : 1;
+	}
+
+	if(generate) {
+		for(bool ds : { true, false }) {
+			for(int p = 0; p < NUM_POSITIONS; p++) {
+				PerftCounts c = run(ds, p, depth, n_threads, std::cerr);
+				std::cout << "\t\t{ " << (ds ? "true" : "false") << ", " << p << ", " << depth << ", { "
+					<< c.nodes << "ULL, " << c.terminals << "ULL, " << c.chance_nodes << "ULL, { "
+					<< c.wins[0] << "ULL, " << c.wins[1] << "ULL, " << c.wins[2] << "ULL }, "
+					<< c.move_checksum << "ULL } }," << std::endl;
+			}
+		}
+		return 0;
+	}
+
+	if(verify) {
+		int failures = 0;
+		for(auto& ref : references()) {
+			PerftCounts c = run(ref.dynamic_steps, ref.position, ref.depth, n_threads, std::cout);
+			if(!(c == ref.counts)) {
+				std::cerr << "MISMATCH: " << (ref.dynamic_steps ? "dynamic" : "static") << " steps, position " << ref.position << ", depth " << ref.depth << std::endl;
+				failures++;
+			}
+		}
+		std::cout << (failures == 0 ? "perft: all reference counts match" : "perft: FAILED") << std::endl;
+		return failures == 0 ? 0 : 1;
+	}
+
+	run(dynamic_steps, position, depth, n_threads, std::cout);
+	return 0;
+}
@@ -0,0 +1,79 @@
+#include "Board.h"
+#include "Evaluators.h"
+#include "GameServer.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace elder_chess;
+
+prng::Xoshiro256 mcts::rng(std::random_device{}());
+
+/*
+	Serves games searched with a built in evaluator, for running without an
+	inference backend; a network is served from Python through the module's
+	GameServer instead. See GameServer.h for the protocol.
+*/
+int main(int argc, char const *argv[])
+{
+	typedef Board<true> Board_;
+	GameServer<Board_>::Options options;
+	options.search_threads = std::max(1u, std::thread::hardware_concurrency());
+	std::string evaluator = "heuristic";
+	int n_rollouts = 8;
+	for(int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if(arg == "--host" && i + 1 < argc) {
+			options.host = argv[++i];
+		} else if(arg == "--port" && i + 1 < argc) {
+			options.port = std::atoi(argv[++i]);
+		} else if(arg == "--threads" && i + 1 < argc) {
+			options.search_threads = std::max(1, std::atoi(argv[++i]));
+		} else if(arg == "--max-queued" && i + 1 < argc) {
+			options.max_queued = std::atoi(argv[++i]);
+		} else if(arg == "--playouts" && i + 1 < argc) {
+			options.n_playout = std::atoi(argv[++i]);
+		} else if(arg == "--move-time" && i + 1 < argc) {
+			options.move_time = std::atof(argv[++i]);
+		} else if(arg == "--deadline" && i + 1 < argc) {
+			options.deadline = std::atof(argv[++i]);
+		} else if(arg == "--seed" && i + 1 < argc) {
+			options.seed = std::strtoull(argv[++i], nullptr, 10);
+		} else if(arg == "--evaluator" && i + 1 < argc) {
+			evaluator = argv[++i];
+		} else if(arg == "--rollouts" && i + 1 < argc) {
+			n_rollouts = std::max(1, std::atoi(argv[++i]));
+		} else {
+			std::cerr << "usage: elder_chess_server [--host ip] [--port p] [--threads n] [--max-queued n] [--playouts n] [--move-time s] "
+				"[--deadline s] [--seed s] [--evaluator heuristic|rollout] [--rollouts n]" << std::endl;
+			return 2;
+		}
+	}
+
+	mcts::MCTS<Board_>::PolicyFunction policy;
+	if(evaluator == "heuristic") {
+		policy = HeuristicEvaluator<Board_>();
+	} else if(evaluator == "rollout") {
+		policy = RolloutEvaluator<Board_>(n_rollouts, options.seed);
+	} else {
+		std::cerr << "unknown evaluator " << evaluator << ", expected rollout or heuristic" << std::endl;
+		return 2;
+	}
+
+	try {
+		GameServer<Board_> server(policy, options);
+		std::cout << "Listening on " << options.host << ":" << options.port << std::endl;
+		server.serve();
+	} catch(const std::invalid_argument& e) {
+		std::cerr << e.what() << std::endl;
+		return 2;
+	} catch(const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,139 @@
+#ifndef GUMBEL_ROOT_HPP
+#define GUMBEL_ROOT_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <random>
+#include <vector>
+
+namespace mcts {
+
+/*
+    Root move selection by Gumbel-top-k sampling and sequential halving
+    (Danihelka et al., "Policy improvement by planning with Gumbel"), for
+    searches with few playouts. Off while max_considered is 0.
+*/
+struct GumbelOptions {
+    // root moves sampled without replacement, then halved every phase down to one
+    std::size_t max_considered = 0;
+    // sigma(q) = (c_visit + most visits of a root move) * c_scale * q, q scaled to [0, 1]
+    double c_visit = 50.;
+    double c_scale = 1.;
+};
+
+/*
+    The schedule of one root. The search runs every phase as visits_each
+    playouts through each considered move, then asks for the next one; moves
+    are referred to by their index among the root's children. q and n are the
+    values (in [-1, 1], for the player to move at the root) and visit counts
+    of all children, as they stand when asked.
+*/
+class GumbelRoot {
+public:
+    template<typename RandomEngine>
+    GumbelRoot(const std::vector<double>& priors, const GumbelOptions& options, std::size_t n_playout, RandomEngine* rng) :
+        _options(options),
+        _n_playout(n_playout),
+        _logits(priors.size()),
+        _gumbels(priors.size())
+    {
+        std::extreme_value_distribution<double> gumbel(0., 1.);
+        for(std::size_t i = 0; i < priors.size(); i++) {
+            _logits[i] = std::log(std::max(priors[i], 1e-12));
+            _gumbels[i] = gumbel(*rng);
+            _considered.push_back(i);
+        }
+        std::size_t m = std::min(std::max<std::size_t>(1, options.max_considered), priors.size());
+        std::partial_sort(_considered.begin(), _considered.begin() + m, _considered.end(), [this](std::size_t a, std::size_t b) {
+            return _gumbels[a] + _logits[a] > _gumbels[b] + _logits[b];
+        });
+        _considered.resize(m);
+        _n_phases = std::max(1, (int)std::ceil(std::log2((double)m)));
+    }
+
+    /* false once the budget is spent or a single move is left after the first phase */
+    bool next_phase(const std::vector<double>& q, const std::vector<double>& n, std::vector<std::size_t>& considered, std::size_t& visits_each) {
+        if(_phase > 0) {
+            if(_considered.size() == 1) {
+                return false;
+            }
+            double max_n = *std::max_element(n.begin(), n.end());
+            std::sort(_considered.begin(), _considered.end(), [&](std::size_t a, std::size_t b) {
+                return _score(a, q, n, max_n) > _score(b, q, n, max_n);
+            });
+            _considered.resize((_considered.size() + 1) / 2);
+        }
+        if(_used >= _n_playout) {
+            return false;
+        }
+        std::size_t k = _considered.size();
+        visits_each = _phase + 1 >= _n_phases || k == 1
+            ? (_n_playout - _used) / k
+            : _n_playout / (_n_phases * k);
+        visits_each = std::max<std::size_t>(1, visits_each);
+        _used += visits_each * k;
+        _phase++;
+        considered = _considered;
+        return true;
+    }
+
+    /* The move to play: the best of those still considered */
+    std::size_t selected(const std::vector<double>& q, const std::vector<double>& n) const {
+        double max_n = *std::max_element(n.begin(), n.end());
+        return *std::max_element(_considered.begin(), _considered.end(), [&](std::size_t a, std::size_t b) {
+            return _score(a, q, n, max_n) < _score(b, q, n, max_n);
+        });
+    }
+
+    /* softmax(logits + sigma(completed q)), the policy target; unvisited moves get the prior weighted mean of the visited */
+    std::vector<double> improved_policy(const std::vector<double>& q, const std::vector<double>& n) const {
+        double max_n = *std::max_element(n.begin(), n.end());
+        double visited_prior = 0., visited_q = 0.;
+        for(std::size_t i = 0; i < q.size(); i++) {
+            if(n[i] > 0) {
+                visited_prior += std::exp(_logits[i]);
+                visited_q += std::exp(_logits[i]) * q[i];
+            }
+        }
+        double v_mix = visited_prior > 0. ? visited_q / visited_prior : 0.;
+        std::vector<double> ret(q.size());
+        double max_logit = -std::numeric_limits<double>::infinity();
+        for(std::size_t i = 0; i < q.size(); i++) {
+            ret[i] = _logits[i] + _sigma(n[i] > 0 ? q[i] : v_mix, max_n);
+            max_logit = std::max(max_logit, ret[i]);
+        }
+        double sum = 0.;
+        for(double& p : ret) {
+            p = std::exp(p - max_logit);
+            sum += p;
+        }
+        for(double& p : ret) {
+            p /= sum;
+        }
+        return ret;
+    }
+
+private:
+    inline double _sigma(double q, double max_n) const {
+        return (_options.c_visit + max_n) * _options.c_scale * (q + 1.) / 2.;
+    }
+
+    inline double _score(std::size_t i, const std::vector<double>& q, const std::vector<double>& n, double max_n) const {
+        return _gumbels[i] + _logits[i] + (n[i] > 0 ? _sigma(q[i], max_n) : 0.);
+    }
+
+    GumbelOptions _options;
+    std::size_t _n_playout;
+    std::vector<double> _logits;
+    std::vector<double> _gumbels;
+    std::vector<std::size_t> _considered;
+    int _n_phases = 1;
+    int _phase = 0;
+    std::size_t _used = 0;
+};
+
+}
+
+#endif
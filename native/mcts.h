@@ -1,16 +1,31 @@
 #ifndef MCTS_H
 #define MCTS_H
 
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <functional>
 #include <stdexcept>
 #include <sstream>
 #include <random>
 #include <iostream>
+#include <limits>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #include "threading.hpp"
+#include "metrics.hpp"
+#include "search_budget.hpp"
+#include "gumbel_root.hpp"
+#include "prng.hpp"
 
 namespace mcts {
 
-extern std::mt19937 rng;
+/* Draws that belong to no search: flips of games played out, seeds of searches built without one */
+extern prng::Xoshiro256 rng;
 
 template<typename> class MCTS;
 template<typename> class BatchMCTS;
@@ -30,31 +45,101 @@ public:
 
 	~TreeNode();
 
+	/* Priors are normalized, so a chance node's children hold the outcome probabilities */
 	void expand(std::vector<std::pair<Move, double>> priors);
 
-	std::pair<Move, TreeNode<State>*> select(double c_puct) const;
+	/*
+		When player (the one to move here) is given, children proven to lose
+		for them are skipped and a proven win is picked right away.
+	*/
+	std::pair<Move, TreeNode<State>*> select(double c_puct, int player = -1) const;
 
 	template<typename RandomEngine>
 	std::pair<Move, TreeNode<State>*> env_select(RandomEngine*) const;
 
+	/* The outcome whose visits lag furthest behind its probability */
+	std::pair<Move, TreeNode<State>*> env_select_stratified() const;
+
 	void update_recursive(double leaf_value);
 	double get_U_value(double c_puct) const;
+
+	/* Visit counts of the two most visited children; true if the runner-up has the better value */
+	bool visit_leaders(unsigned int& first, unsigned int& second) const;
+
+	/*
+		Solver: marks this node as having the exact value `value`, from
+		PLAYER_0's point of view, and proves as many ancestors as that allows.
+		players[i] is the player to move at depth i of the path to this node,
+		negative for chance nodes, whose value is the expectation over outcomes.
+	*/
+	void prove(double value, const std::vector<int>& players);
+	inline bool is_proven() const { return _proven; }
+	inline double proven_value() const { return _proof; }
+
+	/*
+		Visit counts of the children, except that proven wins for player take
+		all the weight and proven losses none while there is anything else.
+	*/
+	std::vector<double> child_weights(int player) const;
+
+	/* Prior, value for player (exact when proven) and visit count of every child */
+	void child_statistics(int player, std::vector<double>& priors, std::vector<double>& values, std::vector<double>& visits) const;
+
 	bool is_leaf() const;
 	bool is_root() const;
 
 private:
 	void update(double leaf_value);
+	bool _try_prove(int player);
+
+	/* Marks a playout in flight on the path from the root down to here, until reverted */
+	void _add_virtual_loss();
+	void _revert_virtual_loss();
 
 protected:
 	TreeNode<State>* const _parent;
 	std::vector<std::pair<Move, TreeNode<State>*>> _children;
 	unsigned int _n_visit = 0;
+	unsigned int _virtual_loss = 0;
 	double _Q = 0;
 	double _prior;
+	bool _proven = false;
+	double _proof = 0;
 };
 
 #include "TreeNode.ipp"
 
+/*
+	Proves node when state is over or solver can solve it, with value set to
+	the exact value from PLAYER_0's point of view; players is the path to node.
+*/
+template<typename State, typename Solver>
+inline bool prove_if_solved(TreeNode<State>* node, const State& state, const Solver& solver, const std::vector<int>& players, double& value) {
+	if(state.game_ended()) {
+		auto winner = state.get_winner();
+		value = winner == 2 ? 0. : (winner == 0 ? 1. : -1.);
+	} else if(!solver || !solver(state, value)) {
+		return false;
+	}
+	node->prove(value, players);
+	return true;
+}
+
+/*
+	Cores all pondering searches of the process share between them; each one
+	gets at most ponder_cores() / pondering_searches() of them on top of its
+	own cpu_share.
+*/
+inline std::atomic<double>& ponder_cores() {
+	static std::atomic<double> cores(std::max(1., std::thread::hardware_concurrency() / 2.));
+	return cores;
+}
+
+inline std::atomic<int>& pondering_searches() {
+	static std::atomic<int> n(0);
+	return n;
+}
+
 template<typename State>
 class MCTS
 {
@@ -63,15 +148,27 @@ public:
 
 	typedef std::function<std::pair<std::vector<std::pair<typename State::Move, double>>, double>(const State&)> PolicyFunction;
 
-	MCTS(const PolicyFunction& _policy_fn, double _c_puct, unsigned int _n_playout) :
+	/*
+		Returns true with the exact value of a leaf, from PLAYER_0's point of
+		view, when it can solve it; the leaf is then proven instead of evaluated.
+	*/
+	typedef std::function<bool(const State&, double&)> LeafSolver;
+
+	/* seed as for set_seed */
+	MCTS(const PolicyFunction& _policy_fn, double _c_puct, unsigned int _n_playout, uint64_t seed = rng()) :
 		_root(new TreeNode<State>(nullptr, 1.0)),
 		_current_root(_root),
 		_policy_fn(_policy_fn),
 		_c_puct(_c_puct),
-		_n_playout(_n_playout)
+		_n_playout(_n_playout),
+		_seed(seed),
+		_metrics(1, 1)
 	{ }
 
-	~MCTS() { delete _root; }
+	~MCTS() {
+		stop_ponder();
+		delete _root;
+	}
 
 	std::pair<std::vector<typename State::Move>, std::vector<double>> get_move_probs(State& state, bool small_temp=false);
 
@@ -79,16 +176,104 @@ public:
     void update_with_move(const State& nextState, Move move);
 
     void reset();
+
+	/*
+		Keeps searching from the current root, whose position is state, on a
+		background thread for at most max_playouts, using up to cpu_share of a
+		core. Every other call that touches the tree stops pondering first, so
+		the work done is kept in whichever subtree the game continues in.
+	*/
+	void start_ponder(const State& state, double cpu_share = 1., std::size_t max_playouts = 100000);
+	void stop_ponder();
+	inline bool is_pondering() const { return _ponder_thread.joinable() && !_ponder_done; }
+
+	inline metrics::SearchMetrics::Snapshot stats() const { return _metrics.snapshot(); }
+	inline void reset_stats() { _metrics.clear(); }
+
+	inline const SearchLimits& search_limits() const { return _limits; }
+	inline void set_search_limits(const SearchLimits& limits) { _limits = limits; }
+
+	inline void set_leaf_solver(const LeafSolver& solver) {
+		stop_ponder();
+		_leaf_solver = solver;
+	}
+
+	/* Whether the last search proved its root, and then its exact value from PLAYER_0's point of view */
+	inline bool root_proven(double& value_p0) const {
+		value_p0 = _current_root->proven_value();
+		return _current_root->is_proven();
+	}
+
+	/*
+		When set, a flip reached for the first time has all its outcomes
+		expanded and evaluated, and their probability weighted mean is backed
+		up in place of a single sampled one; later visits go to the outcome
+		furthest behind its share of them instead of a random one.
+	*/
+	inline void set_exact_chance(bool exact) {
+		stop_ponder();
+		_exact_chance = exact;
+	}
+	inline bool exact_chance() const { return _exact_chance; }
+
+	/*
+		With options.max_considered > 0 the root moves are chosen by Gumbel
+		sequential halving and searched below by PUCT. get_move_probs then
+		returns the improved policy, or with small_temp the chosen move alone,
+		which gumbel_choice() also gives as an index into the returned moves.
+	*/
+	inline void set_gumbel_root(const GumbelOptions& options) {
+		stop_ponder();
+		_gumbel = options;
+	}
+	inline const GumbelOptions& gumbel_root() const { return _gumbel; }
+	inline std::size_t gumbel_choice() const { return _gumbel_choice; }
+
+	/*
+		Search number k after set_seed(seed) draws from the stream (seed, k)
+		alone, so the same seed and calls give the same results. Pondering
+		takes a number too, but how far it gets depends on timing.
+	*/
+	inline void set_seed(uint64_t seed) {
+		stop_ponder();
+		_seed = seed;
+		_searches = 0;
+	}
 private:
 
+	void _ponder(State state, double cpu_share, std::size_t max_playouts, prng::Xoshiro256 rng);
+
+	/* root_child >= 0 forces the move taken at the root */
+	template<typename RandomEngine>
+	void _playout(State state, RandomEngine* rng, int root_child = -1);
+
+	/* Spends the budget on the root by sequential halving; returns the policy get_move_probs reports */
 	template<typename RandomEngine>
-	void _playout(State state, RandomEngine* rng);
+	std::vector<double> _gumbel_search(const State& state, SearchBudget& budget, bool small_temp, RandomEngine* rng);
+
+	/* Expands and scores every outcome of the chance node at state; returns their mean from PLAYER_0's point of view */
+	double _evaluate_outcomes(TreeNode<State>* node, const State& state, std::vector<int>& players);
 
 	TreeNode<State>* _root;
 	TreeNode<State>* _current_root;
 	const PolicyFunction _policy_fn;
+	LeafSolver _leaf_solver;
+	bool _exact_chance = false;
+	GumbelOptions _gumbel;
+	std::size_t _gumbel_choice = 0;
 	double _c_puct;
 	unsigned int _n_playout;
+	SearchLimits _limits;
+	uint64_t _seed;
+	uint64_t _searches = 0;
+
+	std::thread _ponder_thread;
+	std::atomic<bool> _ponder_stop{false};
+	std::atomic<bool> _ponder_done{false};
+	std::mutex _ponder_mutex;
+	std::condition_variable _ponder_wakeup;
+
+	metrics::SearchMetrics _metrics;
 };
 
 #include "mcts.ipp"
@@ -102,6 +287,9 @@ public:
 
 	typedef std::function<void(const std::vector<State>& boards, std::vector<EvalResult>&, int, void*)> PolicyFunction;
 
+	/* As MCTS::LeafSolver, but called from every search thread at once */
+	typedef typename MCTS<State>::LeafSolver LeafSolver;
+
 	BatchMCTS(const PolicyFunction& policy_fn, std::size_t compact_state_size, double c_puct, std::size_t n_playout, std::size_t thread_pool_size, std::size_t eval_batch_size);
 
 	~BatchMCTS();
@@ -109,37 +297,137 @@ public:
 	std::vector<std::pair<std::vector<typename State::Move>, std::vector<double>>> get_move_probs(std::vector<State>& state, const std::vector<bool>& small_temp);
 
 	void reset();
+
+	inline metrics::SearchMetrics::Snapshot stats() const { return _metrics.snapshot(); }
+	inline void reset_stats() { _metrics.clear(); }
+
+	/* Applied to every game separately */
+	inline const SearchLimits& search_limits() const { return _limits; }
+	inline void set_search_limits(const SearchLimits& limits) { _limits = limits; }
+
+	inline void set_leaf_solver(const LeafSolver& solver) { _leaf_solver = solver; }
+
+	/* As MCTS::root_proven, for game i of the last search */
+	inline bool root_proven(std::size_t i, double& value_p0) const {
+		value_p0 = _roots.at(i)->proven_value();
+		return _roots.at(i)->is_proven();
+	}
+
+	/*
+		As MCTS::set_exact_chance; the outcomes of a flip go to the policy
+		function together, in the batch of the playout that reached it.
+		Flips with more outcomes than eval_batch_size are still sampled.
+	*/
+	inline void set_exact_chance(bool exact) { _exact_chance = exact; }
+	inline bool exact_chance() const { return _exact_chance; }
+
+	/*
+		Cap on the playouts one game gets per batch when there are fewer games
+		than eval_batch_size slots; 1 keeps to one leaf per game and batch.
+	*/
+	inline void set_max_playouts_per_game(std::size_t n) { _max_playouts_per_game = std::max<std::size_t>(1, n); }
+	inline std::size_t max_playouts_per_game() const { return _max_playouts_per_game; }
+
+	/*
+		As MCTS::set_gumbel_root. Every halving phase of all the games a
+		search thread holds is batched together, so a phase costs one policy
+		call when the batch is wide enough. gumbel_choice(i) is the move chosen
+		in game i of the last search.
+	*/
+	inline void set_gumbel_root(const GumbelOptions& options) { _gumbel = options; }
+	inline const GumbelOptions& gumbel_root() const { return _gumbel; }
+	inline std::size_t gumbel_choice(std::size_t i) const { return _gumbel_choices.at(i); }
+
+	/*
+		Every playout draws from a stream of its own, (seed, search, game,
+		playout). Once a seed is set, the playouts of a game also go out
+		together, into a batch with room for all of their leaves, so a game's
+		tree no longer depends on which games share its batches: results then
+		follow from the seed, whatever the thread count and scheduling. That
+		takes a policy function that answers a position the same in any batch,
+		playout limits rather than a deadline and no EvalCache shared between
+		games; batches may be flushed less full.
+	*/
+	inline void set_seed(uint64_t seed) {
+		_seed = seed;
+		_searches = 0;
+		_reproducible = true;
+	}
 	
 private:
 
+	/* A chance node whose outcomes are evaluated in the current batch */
+	struct ChanceExpansion {
+		TreeNode<State>* node;
+		std::vector<int> players;
+		double value; // running mean over the outcomes, from PLAYER_0's point of view
+	};
+
+	/* The leaves gathered for one call of the policy function */
+	struct Batch {
+		std::vector<State> states;
+		std::vector<TreeNode<State>*> nodes;
+		std::vector<std::vector<int>> players;
+		std::vector<int> chance; // chance expansion an eval slot is an outcome of, -1 for none
+		std::vector<ChanceExpansion> chance_expansions;
+		std::vector<EvalResult> eval_results;
+		std::vector<double> ended_results;
+		std::vector<double> compact_state_buffer;
+		int eval_count = 0;
+		int ended_count = 0; // Trick: ended games are stored reverse in the above buffers
+
+		Batch(std::size_t size, std::size_t compact_state_size) :
+			states(size), nodes(size), players(size), chance(size, -1), eval_results(size), ended_results(size),
+			compact_state_buffer(compact_state_size * size)
+		{ }
+	};
+
+	/* chance_leaf is set when the path ends on a newly expanded chance node with all outcomes left to evaluate */
 	template<typename RandomEngine>
-	TreeNode<State>* _playout_single_path(TreeNode<State>* root, State& state, std::vector<int>& players, double& leaf_value, bool& game_ended, RandomEngine* rng);
+	TreeNode<State>* _playout_single_path(TreeNode<State>* root, State& state, std::vector<int>& players, double& leaf_value, bool& game_ended, bool& chance_leaf, RandomEngine* rng, int root_child = -1);
 
+	/* Runs a playout from root, whose position is state, and queues its leaf in batch; root_child >= 0 forces the root move */
 	template<typename RandomEngine>
-	void _playout_batch(const std::vector<State>& state, std::size_t start_i, std::size_t n_games, RandomEngine* rng);
+	void _add_playout(Batch& batch, TreeNode<State>* root, const State& state, int root_child, RandomEngine* rng);
+
+	void _flush(Batch& batch);
+
+	/* With a seed set, flushes batch unless it has room for every leaf of n more playouts from state */
+	void _make_room(Batch& batch, const State& state, std::size_t n);
+
+	void _search_worker(const std::vector<State>& state, std::vector<SearchBudget>& budgets, uint64_t search);
+
+	/* Sequential halving at the roots of games, all held by this thread */
+	void _gumbel_worker(const std::vector<State>& states, const std::vector<std::size_t>& games, std::vector<SearchBudget>& budgets, uint64_t search);
 
 	void _backprop_single_path(TreeNode<State>* node, double leaf_value, const std::vector<int>& players);
 
-	int _eval_and_backprop_batch(const std::vector<TreeNode<State>*>& nodes, 
-		const std::vector<State>& states, 
-		const std::vector<std::vector<int>>& players, 
-		const std::vector<double>& batch_ended_results,
-    	const std::vector<double>& compact_state_buffer,
-		std::vector<BatchMCTS<State>::EvalResult>& eval_results, 
-		int batch_size
-	);
+	int _eval_and_backprop_batch(Batch& batch);
 
 	std::vector<TreeNode<State>*> _roots;
 	const PolicyFunction _policy_fn;
+	LeafSolver _leaf_solver;
+	bool _exact_chance = false;
 	std::size_t _compact_state_size;
 
 	double _c_puct;
 	std::size_t _n_playout;
+	SearchLimits _limits;
 
 	std::size_t _eval_batch_size; 
 	std::size_t _thread_pool_size;
+	std::size_t _max_playouts_per_game = 16;
+	GumbelOptions _gumbel;
+	std::vector<std::size_t> _gumbel_choices;
+	std::vector<std::vector<double>> _gumbel_policies; // per game, the policy get_move_probs reports; empty when the search fell back to visits
+	uint64_t _seed;
+	uint64_t _searches = 0;
+	bool _reproducible = false;
 
 	threading::ThreadPool _pool;
+	threading::ReadyQueue _ready_games;
+
+	metrics::SearchMetrics _metrics;
 
 	int _depth = 0;
 };
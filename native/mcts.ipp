@@ -1,13 +1,26 @@
 template<typename State>
 template<typename RandomEngine>
-void MCTS<State>::_playout(State state, RandomEngine* rng) {
+void MCTS<State>::_playout(State state, RandomEngine* rng, int root_child) {
+	metrics::ThreadMetrics* m = metrics::current();
+	metrics::ScopedPhase phase(m, metrics::SELECTION);
 	TreeNode<State>* node = _current_root;
 	std::vector<int> players;
+	bool chance_leaf = false;
 	while(true) {
 		players.push_back(state.get_current_player());
+		if(node->_proven) {
+			break;
+		}
 		if(node->is_leaf()) {
 			if(state.is_env_move()) {
+				phase.enter(metrics::EXPANSION);
 				node->expand(state.get_env_move_weights());
+				m->add(m->nodes, node->_children.size());
+				if(_exact_chance) {
+					chance_leaf = true;
+					break;
+				}
+				phase.enter(metrics::SELECTION);
 				auto action_node = node->env_select(rng);
 				node = action_node.second;
 				state.do_move(action_node.first);
@@ -16,18 +29,35 @@ void MCTS<State>::_playout(State state, RandomEngine* rng) {
 			}
 		} else {
 			if(state.is_env_move()) {
-				auto action_node = node->env_select(rng);
+				auto action_node = _exact_chance ? node->env_select_stratified() : node->env_select(rng);
 				node = action_node.second;
 				state.do_move(action_node.first);
 			} else {
-				auto action_node = node->select(_c_puct);
+				auto action_node = node == _current_root && root_child >= 0 ? node->_children[root_child] : node->select(_c_puct, players.back());
 				node = action_node.second;
 				state.do_move(action_node.first);
 			}
 		}
 	}
+	// the root is left to the search, which has to come up with a move
+	if(_leaf_solver && !chance_leaf && node != _current_root && !node->_proven && !state.game_ended()) {
+		phase.enter(metrics::LEAF_SOLVER);
+		double value;
+		if(_leaf_solver(state, value)) {
+			node->prove(value, players);
+		}
+	}
 	double leaf_value;
-	if(state.game_ended()) {
+	int last_player = state.get_current_player();
+	if(chance_leaf) {
+		leaf_value = _evaluate_outcomes(node, state, players);
+		last_player = 0;
+	} else if(node->_proven) {
+		// solved subtree, whose exact value is from PLAYER_0's point of view
+		leaf_value = node->_proof;
+		last_player = 0;
+		m->add(m->terminal_leaves);
+	} else if(state.game_ended()) {
 		auto winner = state.get_winner();
 		if(winner == 2) {
 			leaf_value = 0;
@@ -37,13 +67,23 @@ void MCTS<State>::_playout(State state, RandomEngine* rng) {
 			assert(winner == 1 - state.get_current_player());
 			leaf_value = -1.;
 		}
+		node->prove(winner == 2 ? 0. : (winner == 0 ? 1. : -1.), players);
+		m->add(m->terminal_leaves);
 	} else {
+		phase.enter(metrics::POLICY_WAIT);
 		auto policy_value_pair = this->_policy_fn(state);
+		phase.enter(metrics::EXPANSION);
 		node->expand(policy_value_pair.first);
 		leaf_value = policy_value_pair.second;
+		m->add(m->evaluated_leaves);
+		m->add(m->batches);
+		m->add(m->batch_slots);
+		m->add(m->nodes, node->_children.size());
 	}
+	m->add(m->playouts);
+	m->observe_depth(players.size() - 1);
 
-	int last_player = state.get_current_player();
+	phase.enter(metrics::BACKUP);
 	TreeNode<State> *it = node;
 	for(int i = players.size() - 2; i >= 0; i--) {
 		int player = players[i];
@@ -58,20 +98,72 @@ void MCTS<State>::_playout(State state, RandomEngine* rng) {
 		}
 		it = it->_parent;
 	}
+	// the search root is not on the update path but its visit count drives exploration below it
+	it->_n_visit++;
+}
+
+template<typename State>
+double MCTS<State>::_evaluate_outcomes(TreeNode<State>* node, const State& state, std::vector<int>& players) {
+	metrics::ThreadMetrics* m = metrics::current();
+	metrics::ScopedPhase phase(m, metrics::EXPANSION);
+	double expectation = 0.;
+	for(auto& it : node->_children) {
+		TreeNode<State>* child = it.second;
+		State next(state);
+		next.do_move(it.first);
+		players.push_back(next.get_current_player());
+		double value;
+		phase.enter(metrics::LEAF_SOLVER);
+		if(prove_if_solved(child, next, _leaf_solver, players, value)) {
+			m->add(m->terminal_leaves);
+		} else {
+			phase.enter(metrics::POLICY_WAIT);
+			auto policy_value_pair = this->_policy_fn(next);
+			phase.enter(metrics::EXPANSION);
+			child->expand(policy_value_pair.first);
+			value = next.get_current_player() == 0 ? policy_value_pair.second : -policy_value_pair.second;
+			m->add(m->evaluated_leaves);
+			m->add(m->batches);
+			m->add(m->batch_slots);
+			m->add(m->nodes, child->_children.size());
+		}
+		players.pop_back();
+		// outcomes are not chosen by anyone, so like any child of a chance node they only count visits
+		child->update(0.);
+		expectation += child->_prior * value;
+	}
+	return expectation;
 }
 
 template<typename State>
 std::pair<std::vector<typename State::Move>, std::vector<double>> MCTS<State>::get_move_probs(State& state, bool small_temp) {
-	for(int i = 0; i < _n_playout; i++) {
-		_playout(state, &rng);
+	stop_ponder();
+	std::vector<double> weights;
+	{
+		metrics::ThreadBinding binding(_metrics.thread(0));
+		SearchBudget budget(_limits, _n_playout);
+		prng::Xoshiro256 search_rng = prng::stream(_seed, {_searches++});
+		auto start = std::chrono::steady_clock::now();
+		if(_gumbel.max_considered > 0 && !state.is_env_move()) {
+			weights = _gumbel_search(state, budget, small_temp, &search_rng);
+		}
+		while(weights.empty() && !_current_root->_proven && budget.should_continue(*_current_root)) {
+			_playout(state, &search_rng);
+			budget.add_playout();
+		}
+		_metrics.add_search_time(std::chrono::steady_clock::now() - start);
+	}
+	if(weights.empty()) {
+		weights = _current_root->child_weights(state.get_current_player());
+		_gumbel_choice = std::max_element(weights.begin(), weights.end()) - weights.begin();
 	}
 	if(small_temp) {
 		std::vector<typename State::Move> moves(_current_root->_children.size());
 		std::vector<double> counts(_current_root->_children.size());
-		int max_c = -1;
+		double max_c = -1;
 		int max_idx = 0;
 		for(int i = 0; i < _current_root->_children.size(); i++) {
-			int c = _current_root->_children[i].second->_n_visit;
+			double c = weights[i];
 			moves[i] = _current_root->_children[i].first;
 			if(c > max_c) {
 				max_idx = i;
@@ -85,7 +177,7 @@ std::pair<std::vector<typename State::Move>, std::vector<double>> MCTS<State>::g
 		std::vector<typename State::Move> moves(_current_root->_children.size());
 		std::vector<double> counts(_current_root->_children.size());
 		for(int i = 0; i < _current_root->_children.size(); i++) {
-			double c = (double)_current_root->_children[i].second->_n_visit;
+			double c = weights[i];
 			counts[i] = c;
 			moves[i] = _current_root->_children[i].first;
 			sum += c;
@@ -97,8 +189,55 @@ std::pair<std::vector<typename State::Move>, std::vector<double>> MCTS<State>::g
 	}
 }
 
+template<typename State>
+template<typename RandomEngine>
+std::vector<double> MCTS<State>::_gumbel_search(const State& state, SearchBudget& budget, bool small_temp, RandomEngine* rng) {
+	if(_current_root->is_leaf() && !_current_root->_proven) {
+		_playout(state, rng);
+		budget.add_playout();
+	}
+	if(_current_root->_proven || _current_root->is_leaf()) {
+		return std::vector<double>();
+	}
+	int player = state.get_current_player();
+	std::vector<double> priors, values, visits;
+	_current_root->child_statistics(player, priors, values, visits);
+	GumbelRoot gumbel(priors, _gumbel, _limits.playouts > 0 ? _limits.playouts : _n_playout, rng);
+	std::vector<std::size_t> considered;
+	std::size_t visits_each;
+	bool in_budget = true;
+	while(in_budget && gumbel.next_phase(values, visits, considered, visits_each)) {
+		// one playout through each move in turn, so a deadline cuts every move short alike
+		for(std::size_t v = 0; v < visits_each && in_budget; v++) {
+			for(std::size_t child : considered) {
+				if(!budget.should_continue(*_current_root)) {
+					in_budget = false;
+					break;
+				}
+				_playout(state, rng, child);
+				budget.add_playout();
+			}
+		}
+		_current_root->child_statistics(player, priors, values, visits);
+		if(_current_root->_proven) {
+			// a proven win may not even be among the considered moves
+			std::vector<double> weights = _current_root->child_weights(player);
+			_gumbel_choice = std::max_element(weights.begin(), weights.end()) - weights.begin();
+			return weights;
+		}
+	}
+	_gumbel_choice = gumbel.selected(values, visits);
+	if(!small_temp) {
+		return gumbel.improved_policy(values, visits);
+	}
+	std::vector<double> ret(priors.size(), 0.);
+	ret[_gumbel_choice] = 1.;
+	return ret;
+}
+
 template<typename State>
 void MCTS<State>::update_with_move_index(State curState, unsigned int move_index) {
+	stop_ponder();
 	curState.do_move(_current_root->_children[move_index].first);
 	State& nextState = curState;
 	TreeNode<State>* new_root = _current_root->_children[move_index].second;
@@ -112,6 +251,7 @@ void MCTS<State>::update_with_move_index(State curState, unsigned int move_index
 
 template<typename State>
 void MCTS<State>::update_with_move(const State& nextState, typename State::Move move) {
+	stop_ponder();
 	if(_current_root->is_leaf()) {
 		// This can happen if we encountered a totally new state
 		// we should be able to drop anything we've calculated before and move on
@@ -128,7 +268,58 @@ void MCTS<State>::update_with_move(const State& nextState, typename State::Move
 
 template<typename State>
 void MCTS<State>::reset() {
+	stop_ponder();
 	delete _root;
 	_root = new TreeNode<State>(nullptr, 1.0);
 	_current_root = _root;
 }
+
+template<typename State>
+void MCTS<State>::start_ponder(const State& state, double cpu_share, std::size_t max_playouts) {
+	stop_ponder();
+	if(state.game_ended() || cpu_share <= 0. || max_playouts == 0) {
+		return;
+	}
+	_ponder_stop = false;
+	_ponder_done = false;
+	_ponder_thread = std::thread(&MCTS<State>::_ponder, this, state, std::min(cpu_share, 1.), max_playouts, prng::stream(_seed, {_searches++}));
+}
+
+template<typename State>
+void MCTS<State>::stop_ponder() {
+	if(!_ponder_thread.joinable()) {
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(_ponder_mutex);
+		_ponder_stop = true;
+	}
+	_ponder_wakeup.notify_all();
+	_ponder_thread.join();
+}
+
+template<typename State>
+void MCTS<State>::_ponder(State state, double cpu_share, std::size_t max_playouts, prng::Xoshiro256 ponder_rng) {
+	// searches in slices and sleeps in between so that busy / (busy + idle) stays at the allowed share
+	const auto slice = std::chrono::milliseconds(10);
+	metrics::ThreadBinding binding(_metrics.thread(0));
+	pondering_searches()++;
+	std::size_t done = 0;
+	while(!_ponder_stop && done < max_playouts) {
+		auto slice_start = std::chrono::steady_clock::now();
+		do {
+			_playout(state, &ponder_rng);
+			done++;
+		} while(!_ponder_stop && done < max_playouts && std::chrono::steady_clock::now() - slice_start < slice);
+
+		double share = std::min(cpu_share, ponder_cores().load() / std::max(1, pondering_searches().load()));
+		if(share < 1.) {
+			auto busy = std::chrono::steady_clock::now() - slice_start;
+			std::unique_lock<std::mutex> lock(_ponder_mutex);
+			_ponder_wakeup.wait_for(lock, std::chrono::duration<double>(std::chrono::duration<double>(busy).count() * (1. - share) / share),
+				[this]() { return _ponder_stop.load(); });
+		}
+	}
+	pondering_searches()--;
+	_ponder_done = true;
+}
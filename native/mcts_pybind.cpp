@@ -1,8 +1,20 @@
 #include "Board.h"
 #include "mcts.h"
+#include "CompactState.h"
+#include "ReplayBuffer.h"
+#include "SelfPlayRunner.h"
+#include "GameRecord.h"
+#include "Expectimax.h"
+#include "Tablebase.h"
+#include "Evaluators.h"
+#include "Arena.h"
+#include "BoardBatch.h"
+#include "EvalCache.h"
+#include "GameServer.h"
 
 #include <string>
 #include <sstream>
+#include <limits>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/operators.h>
@@ -14,32 +26,11 @@ using namespace elder_chess;
 
 namespace py = pybind11;
 
-std::mt19937 mcts::rng(time(0));
+prng::Xoshiro256 mcts::rng(std::random_device{}());
 
 typedef Board<true> Board_;
-
-static void fill_compact_state(const Board_& board, double (&board_state)[9][4][4], double (&hiddens_state)[2][4], double &remaining_steps_state) {
-    memset(&board_state, 0, sizeof(board_state));
-    for(int i = 0; i < 4; i++) {
-        for(int j = 0; j < 4; j++) {
-            Piece p = board.at(i, j);
-            if (p.isHidden()) {
-                board_state[8][i][j] = 1.;
-            } else if (!p.isEmpty()) {
-                int idx = p.getSide() == board.get_current_player() ? 0 : 1;
-                board_state[idx * 4 + p.value][i][j] = 1.;
-            }
-        }
-    }
-
-    auto&& counts = board.get_hidden_counts();
-    for(int i = 0; i < 4; i++) {
-        hiddens_state[board.get_current_player() == 0 ? 0 : 1][i] = counts.first[i];
-        hiddens_state[board.get_current_player() == 1 ? 0 : 1][i] = counts.second[i];
-    }
-    
-    remaining_steps_state = board.get_remaining_steps();
-}
+typedef Tablebase<Board_> Tablebase_;
+typedef EvalCache<Board_> EvalCache_;
 
 typedef std::tuple<py::array_t<double>, py::array_t<double>, double> CompactState;
 
@@ -56,6 +47,152 @@ static CompactState get_compact_state(const Board_& board) {
     return std::make_tuple(ret, hiddens, remaining_steps);
 }
 
+/*
+    Returns the data pointer of a caller owned array that we are going to fill
+    in place; refuses anything that would need a conversion (and thus a copy).
+*/
+template<typename T>
+static T* writable_buffer(py::array& a, std::size_t expected_size, const char* name) {
+    if(!a.dtype().is(py::dtype::of<T>()) || !(a.flags() & py::array::c_style) || !a.writeable()) {
+        throw std::invalid_argument(std::string(name) + ": expected a writeable C-contiguous array of " + std::string(py::str(py::dtype::of<T>())));
+    }
+    if((std::size_t)a.size() != expected_size) {
+        throw std::invalid_argument(std::string(name) + ": wrong size");
+    }
+    return static_cast<T*>(a.mutable_data());
+}
+
+static SearchLimits make_search_limits(std::size_t playouts, double seconds, bool early_stop, double extension) {
+    SearchLimits limits;
+    limits.playouts = playouts;
+    limits.seconds = seconds;
+    limits.early_stop = early_stop;
+    limits.extension = extension;
+    return limits;
+}
+
+static GumbelOptions make_gumbel_options(std::size_t max_considered, double c_visit, double c_scale) {
+    GumbelOptions options;
+    options.max_considered = max_considered;
+    options.c_visit = c_visit;
+    options.c_scale = c_scale;
+    return options;
+}
+
+/*
+    Proves leaves found in tablebase (if any), then those with at most
+    max_hidden pieces still face down using a per thread Expectimax engine,
+    which gives up after max_nodes; max_hidden < 0 turns the engine off.
+*/
+static MCTS<Board_>::LeafSolver make_endgame_solver(int max_hidden, uint64_t max_nodes, std::shared_ptr<const Tablebase_> tablebase) {
+    if(max_hidden < 0 && !tablebase) {
+        return nullptr;
+    }
+    if(max_hidden >= 0 && max_nodes == 0) {
+        throw std::invalid_argument("max_nodes must be positive");
+    }
+    return [max_hidden, max_nodes, tablebase](const Board_& board, double& value) {
+        if(tablebase && tablebase->solve(board, value)) {
+            return true;
+        }
+        if(board.get_num_hidden() > max_hidden) {
+            return false;
+        }
+        static thread_local Expectimax<Board_> engine(16);
+        return engine.solve(board, max_nodes, value);
+    };
+}
+
+/*
+    The built in evaluator called name ("rollout" or "heuristic"), which runs
+    without the GIL; n_rollouts is the number of playouts per leaf of "rollout".
+*/
+static MCTS<Board_>::PolicyFunction make_native_evaluator(const std::string& name, int n_rollouts) {
+    if(name == "rollout") {
+        return RolloutEvaluator<Board_>(n_rollouts);
+    } else if(name == "heuristic") {
+        return HeuristicEvaluator<Board_>();
+    }
+    throw std::invalid_argument("unknown evaluator " + name + ", expected rollout or heuristic");
+}
+
+typedef std::function<std::pair<py::array_t<double>, double>(const CompactState&)> PolicyNetworkF;
+
+/* policy_f, a python network from compact states to (80 move probabilities, value), as a PolicyFunction */
+static MCTS<Board_>::PolicyFunction make_network_policy(const PolicyNetworkF& policy_f) {
+    return [policy_f](const Board_& b) {
+        // searches run with the GIL released, and may be on a ponder or GameServer thread
+        metrics::ScopedPhase gil_wait(metrics::GIL_ACQUIRE);
+        py::gil_scoped_acquire acquire;
+        gil_wait.exit();
+        auto compact_state = [&b]() {
+            metrics::ScopedPhase encoding(metrics::ENCODING);
+            return get_compact_state(b);
+        }();
+        auto&& move_probs_and_value = policy_f(compact_state);
+        py::array_t<double> move_probs = move_probs_and_value.first;
+        double value = move_probs_and_value.second;
+        auto move_probs_buf = move_probs.unchecked<1>();
+        std::vector<Move> available_moves = b.get_moves();
+        std::vector<std::pair<Move, double>> available_moves_probs(available_moves.size());
+        double normalizer = 0.;
+        for(int i = 0; i < available_moves.size(); i++) {
+            Move m = available_moves[i];
+            normalizer += move_probs_buf(m.y + m.x * 4 + ((int)m.type) * 4 * 4);
+        }
+        for(int i = 0; i < available_moves.size(); i++) {
+            Move m = available_moves[i];
+            available_moves_probs[i] = std::make_pair(
+                m, 
+                move_probs_buf(m.y + m.x * 4 + ((int)m.type) * 4 * 4) / normalizer
+            );
+        }
+        return std::make_pair(available_moves_probs, value);
+    };
+}
+
+/*
+    A pondering thread may be waiting for the GIL inside the policy, so it has
+    to be stopped with the GIL released before the search is destroyed.
+*/
+struct PonderingSearchDeleter {
+    void operator()(MCTS<Board_>* mcts) const {
+        {
+            py::gil_scoped_release release;
+            mcts->stop_ponder();
+        }
+        delete mcts;
+    }
+};
+
+/* Search threads may be waiting for the GIL inside the policy while the server shuts down */
+struct GameServerDeleter {
+    void operator()(GameServer<Board_>* server) const {
+        py::gil_scoped_release release;
+        delete server;
+    }
+};
+
+static GameServer<Board_>::Options make_server_options(const std::string& host, int port, std::size_t search_threads, std::size_t max_queued,
+    unsigned int n_playout, double move_time, bool early_stop, double extension, double deadline, double c_puct, py::object seed)
+{
+    GameServer<Board_>::Options options;
+    options.host = host;
+    options.port = port;
+    options.search_threads = search_threads;
+    options.max_queued = max_queued;
+    options.n_playout = n_playout;
+    options.move_time = move_time;
+    options.early_stop = early_stop;
+    options.extension = extension;
+    options.deadline = deadline;
+    options.c_puct = c_puct;
+    if(!seed.is_none()) {
+        options.seed = seed.cast<uint64_t>();
+    }
+    return options;
+}
+
 PYBIND11_MODULE(elder_chess_native, m) {
 	py::class_<Board_>(m, "Board")
 		.def(py::init<>())
@@ -81,6 +218,7 @@ PYBIND11_MODULE(elder_chess_native, m) {
 		})
 		.def("get_remaining_steps", &Board_::get_remaining_steps)
 		.def("get_total_steps", &Board_::get_total_steps)
+		.def("get_num_hidden", &Board_::get_num_hidden)
 		.def("get_moves_one_hot", [](const Board_& board) {
 			std::vector<Move> moves = board.get_moves();
 			py::array_t<unsigned int> ret({5, 4, 4});
@@ -91,6 +229,12 @@ PYBIND11_MODULE(elder_chess_native, m) {
 			}
 			return ret;
 		})
+		.def("hash", [](const Board_& board) { return board.hash(); })
+		.def("canonical_key", [](const Board_& board) {
+			int transform = 0;
+			uint64_t key = board.canonical_hash(&transform);
+			return py::make_tuple(key, transform);
+		})
 	;
 
 	py::class_<Move>(m, "Move")
@@ -107,41 +251,41 @@ PYBIND11_MODULE(elder_chess_native, m) {
 		})
 	;
 
-	typedef std::function<std::pair<py::array_t<double>, double>(const CompactState&)> PolicyNetworkF;
-
-    py::class_<MCTS<Board_>>(m, "MCTS")
+    py::class_<MCTS<Board_>, std::unique_ptr<MCTS<Board_>, PonderingSearchDeleter>>(m, "MCTS")
         // .def(py::init<const MCTS<Board_>::PolicyFunction&, double, unsigned int>())
-        .def(py::init([](const PolicyNetworkF& policy_f, double c_puct, unsigned int n_playout) {
-        	return new MCTS<Board_>(
-        		[policy_f](const Board_& b) {
-        			auto&& move_probs_and_value = policy_f(get_compact_state(b));
-        			py::array_t<double> move_probs = move_probs_and_value.first;
-        			double value = move_probs_and_value.second;
-        			auto move_probs_buf = move_probs.unchecked<1>();
-        			std::vector<Move> available_moves = b.get_moves();
-					std::vector<std::pair<Move, double>> available_moves_probs(available_moves.size());
-					double normalizer = 0.;
-                    for(int i = 0; i < available_moves.size(); i++) {
-						Move m = available_moves[i];
-                    	normalizer += move_probs_buf(m.y + m.x * 4 + ((int)m.type) * 4 * 4);
-                    }
-					for(int i = 0; i < available_moves.size(); i++) {
-						Move m = available_moves[i];
-						available_moves_probs[i] = std::make_pair(
-							m, 
-							move_probs_buf(m.y + m.x * 4 + ((int)m.type) * 4 * 4) / normalizer
-						);
-					}
-					return std::make_pair(available_moves_probs, value);
-        		},
-        		c_puct,
-        		n_playout
-        	);
-        }))
-        .def("get_move_probs", &MCTS<Board_>::get_move_probs)
-        .def("update_with_move", &MCTS<Board_>::update_with_move)
-        .def("update_with_move_index", &MCTS<Board_>::update_with_move_index)
-        .def("reset", &MCTS<Board_>::reset)
+        .def(py::init([](const PolicyNetworkF& policy_f, double c_puct, unsigned int n_playout, std::shared_ptr<EvalCache_> eval_cache) {
+        	MCTS<Board_>::PolicyFunction policy = make_network_policy(policy_f);
+        	return new MCTS<Board_>(eval_cache ? cached<Board_>(policy, eval_cache) : policy, c_puct, n_playout);
+        }), py::arg("policy_value_function"), py::arg("c_puct"), py::arg("n_playout"), py::arg("eval_cache") = nullptr)
+        .def(py::init([](const std::string& evaluator, double c_puct, unsigned int n_playout, int n_rollouts) {
+            return new MCTS<Board_>(make_native_evaluator(evaluator, n_rollouts), c_puct, n_playout);
+        }), py::arg("evaluator"), py::arg("c_puct"), py::arg("n_playout"), py::arg("n_rollouts") = 8)
+        .def("get_move_probs", &MCTS<Board_>::get_move_probs, py::call_guard<py::gil_scoped_release>())
+        .def("update_with_move", &MCTS<Board_>::update_with_move, py::call_guard<py::gil_scoped_release>())
+        .def("update_with_move_index", &MCTS<Board_>::update_with_move_index, py::call_guard<py::gil_scoped_release>())
+        .def("reset", &MCTS<Board_>::reset, py::call_guard<py::gil_scoped_release>())
+        .def("start_ponder", &MCTS<Board_>::start_ponder, py::call_guard<py::gil_scoped_release>(),
+            py::arg("board"), py::arg("cpu_share") = 1., py::arg("max_playouts") = 100000)
+        .def("stop_ponder", &MCTS<Board_>::stop_ponder, py::call_guard<py::gil_scoped_release>())
+        .def("is_pondering", &MCTS<Board_>::is_pondering)
+        .def("set_search_limits", [](MCTS<Board_>& mcts, std::size_t playouts, double seconds, bool early_stop, double extension) {
+            mcts.set_search_limits(make_search_limits(playouts, seconds, early_stop, extension));
+        }, py::arg("playouts") = 0, py::arg("seconds") = 0., py::arg("early_stop") = false, py::arg("extension") = 1.)
+        .def("set_endgame_solver", [](MCTS<Board_>& mcts, int max_hidden, uint64_t max_nodes, std::shared_ptr<Tablebase_> tablebase) {
+            auto solver = make_endgame_solver(max_hidden, max_nodes, tablebase);
+            py::gil_scoped_release release;
+            mcts.set_leaf_solver(solver);
+        }, py::arg("max_hidden") = 0, py::arg("max_nodes") = 20000, py::arg("tablebase") = nullptr)
+        .def("set_exact_chance", &MCTS<Board_>::set_exact_chance, py::call_guard<py::gil_scoped_release>(), py::arg("exact") = true)
+        .def("exact_chance", &MCTS<Board_>::exact_chance)
+        .def("set_gumbel_root", [](MCTS<Board_>& mcts, std::size_t max_considered, double c_visit, double c_scale) {
+            py::gil_scoped_release release;
+            mcts.set_gumbel_root(make_gumbel_options(max_considered, c_visit, c_scale));
+        }, py::arg("max_considered") = 16, py::arg("c_visit") = 50., py::arg("c_scale") = 1.)
+        .def("gumbel_choice", &MCTS<Board_>::gumbel_choice)
+        .def("set_seed", &MCTS<Board_>::set_seed, py::call_guard<py::gil_scoped_release>(), py::arg("seed"))
+        .def("stats", &MCTS<Board_>::stats)
+        .def("reset_stats", &MCTS<Board_>::reset_stats)
     ;
 
 
@@ -149,19 +293,24 @@ PYBIND11_MODULE(elder_chess_native, m) {
 
     py::class_<BatchMCTS<Board_>>(m, "BatchMCTS")
         // .def(py::init<const MCTS<Board_>::PolicyFunction&, double, unsigned int>())
-        .def(py::init([](const BatchedPolicyNetworkF& policy_f, double c_puct, int n_playout, int thread_pool_size, int eval_batch_size) {
-            return new BatchMCTS<Board_>(
+        .def(py::init([](const BatchedPolicyNetworkF& policy_f, double c_puct, int n_playout, int thread_pool_size, int eval_batch_size, std::shared_ptr<EvalCache_> eval_cache) {
+            BatchMCTS<Board_>::PolicyFunction policy =
                 [policy_f, eval_batch_size]
                 (const std::vector<Board_>& boards, std::vector<BatchMCTS<Board_>::EvalResult>& results, int batch_size, void* buffer) {
                     double* _board_states = (double*)buffer;
                     double* _hiddens_states = _board_states + eval_batch_size * 9 * 4 * 4;
                     double* _remaining_steps_states = _hiddens_states + eval_batch_size * 2 * 4;
-                    for(int i = 0; i < batch_size; i++) {
-                        fill_compact_state(boards[i], (double(&)[9][4][4])_board_states[i * 9 * 4 * 4], (double(&)[2][4])_hiddens_states[i * 2 * 4], _remaining_steps_states[i]);
+                    {
+                        metrics::ScopedPhase encoding(metrics::ENCODING);
+                        for(int i = 0; i < batch_size; i++) {
+                            fill_compact_state(boards[i], (double(&)[9][4][4])_board_states[i * 9 * 4 * 4], (double(&)[2][4])_hiddens_states[i * 2 * 4], _remaining_steps_states[i]);
+                        }
                     }
 
                     {
+                        metrics::ScopedPhase gil_wait(metrics::GIL_ACQUIRE);
                         py::gil_scoped_acquire acquire;
+                        gil_wait.exit();
 
                         py::object board_states = py::array_t<double, py::array::c_style>(
                             {batch_size, 9, 4, 4}, 
@@ -199,18 +348,435 @@ PYBIND11_MODULE(elder_chess_native, m) {
                             }
                         }
                     }
-                },
+                };
+            return new BatchMCTS<Board_>(
+                eval_cache ? batch_cached<Board_>(policy, eval_cache) : policy,
                 (9 * 4 * 4) + (2 * 4) + (1),
                 c_puct,
                 n_playout,
                 thread_pool_size,
                 eval_batch_size
             );
-        }))
+        }), py::arg("policy_value_function"), py::arg("c_puct"), py::arg("n_playout"), py::arg("thread_pool_size"), py::arg("eval_batch_size"), py::arg("eval_cache") = nullptr)
+        .def(py::init([](const std::string& evaluator, double c_puct, int n_playout, int thread_pool_size, int eval_batch_size, int n_rollouts) {
+            // nothing to encode, so no compact state buffer
+            return new BatchMCTS<Board_>(
+                batched<Board_>(make_native_evaluator(evaluator, n_rollouts)),
+                0,
+                c_puct,
+                n_playout,
+                thread_pool_size,
+                eval_batch_size
+            );
+        }), py::arg("evaluator"), py::arg("c_puct"), py::arg("n_playout"), py::arg("thread_pool_size"), py::arg("eval_batch_size"), py::arg("n_rollouts") = 8)
         .def("get_move_probs", &BatchMCTS<Board_>::get_move_probs, py::call_guard<py::gil_scoped_release>())
+        .def("get_move_probs", [](BatchMCTS<Board_>& mcts, const BoardBatch<true>& batch, const std::vector<bool>& small_temp) {
+            // one search over the games that are waiting on a player, as an n x 80 policy array;
+            // the tree search itself runs on Board, so the batch is unpacked once per call
+            std::size_t n = batch.size();
+            if(small_temp.size() != n) {
+                throw std::invalid_argument("small_temp: expected one flag per game");
+            }
+            py::array_t<double> ret({ n, (std::size_t)Symmetry::NUM_MOVE_INDICES });
+            double* probs = ret.mutable_data();
+            {
+                py::gil_scoped_release release;
+                std::fill(probs, probs + n * Symmetry::NUM_MOVE_INDICES, 0.);
+                std::vector<Board_> boards = batch.boards();
+                std::vector<std::size_t> games;
+                std::vector<Board_> states;
+                std::vector<bool> temps;
+                for(std::size_t i = 0; i < n; i++) {
+                    if(!boards[i].is_env_move() && !boards[i].game_ended()) {
+                        games.push_back(i);
+                        states.push_back(boards[i]);
+                        temps.push_back(small_temp[i]);
+                    }
+                }
+                if(!states.empty()) {
+                    auto move_probs = mcts.get_move_probs(states, temps);
+                    for(std::size_t j = 0; j < games.size(); j++) {
+                        for(std::size_t k = 0; k < move_probs[j].first.size(); k++) {
+                            probs[games[j] * Symmetry::NUM_MOVE_INDICES + Symmetry::move_index(move_probs[j].first[k])] = move_probs[j].second[k];
+                        }
+                    }
+                }
+            }
+            return ret;
+        }, py::arg("batch"), py::arg("small_temp"))
         .def("reset", &BatchMCTS<Board_>::reset)
+        .def("set_search_limits", [](BatchMCTS<Board_>& mcts, std::size_t playouts, double seconds, bool early_stop, double extension) {
+            mcts.set_search_limits(make_search_limits(playouts, seconds, early_stop, extension));
+        }, py::arg("playouts") = 0, py::arg("seconds") = 0., py::arg("early_stop") = false, py::arg("extension") = 1.)
+        .def("set_endgame_solver", [](BatchMCTS<Board_>& mcts, int max_hidden, uint64_t max_nodes, std::shared_ptr<Tablebase_> tablebase) {
+            mcts.set_leaf_solver(make_endgame_solver(max_hidden, max_nodes, tablebase));
+        }, py::arg("max_hidden") = 0, py::arg("max_nodes") = 20000, py::arg("tablebase") = nullptr)
+        .def("set_exact_chance", &BatchMCTS<Board_>::set_exact_chance, py::arg("exact") = true)
+        .def("exact_chance", &BatchMCTS<Board_>::exact_chance)
+        .def("set_gumbel_root", [](BatchMCTS<Board_>& mcts, std::size_t max_considered, double c_visit, double c_scale) {
+            mcts.set_gumbel_root(make_gumbel_options(max_considered, c_visit, c_scale));
+        }, py::arg("max_considered") = 16, py::arg("c_visit") = 50., py::arg("c_scale") = 1.)
+        .def("gumbel_choice", &BatchMCTS<Board_>::gumbel_choice, py::arg("game"))
+        .def("set_seed", &BatchMCTS<Board_>::set_seed, py::arg("seed"))
+        .def("set_max_playouts_per_game", &BatchMCTS<Board_>::set_max_playouts_per_game, py::arg("n"))
+        .def("max_playouts_per_game", &BatchMCTS<Board_>::max_playouts_per_game)
+        .def("stats", &BatchMCTS<Board_>::stats)
+        .def("reset_stats", &BatchMCTS<Board_>::reset_stats)
+    ;
+
+    py::class_<EvalCache_, std::shared_ptr<EvalCache_>>(m, "EvalCache")
+        .def(py::init<int>(), py::arg("capacity_bits") = 16)
+        .def("clear", &EvalCache_::clear)
+        .def_property_readonly("capacity", &EvalCache_::capacity)
+        .def_property_readonly("hits", &EvalCache_::hits)
+        .def_property_readonly("misses", &EvalCache_::misses)
+    ;
+
+    typedef Expectimax<Board_> Expectimax_;
+
+    py::class_<Expectimax_>(m, "Expectimax")
+        .def(py::init<int>(), py::arg("tt_bits") = 20)
+        .def("search", [](Expectimax_& engine, const Board_& board, double seconds, int max_depth, uint64_t max_nodes) {
+            Expectimax_::Result result;
+            {
+                py::gil_scoped_release release;
+                result = engine.search(board, seconds, max_depth, max_nodes);
+            }
+            py::dict ret;
+            ret["move"] = result.move;
+            ret["value"] = result.value;
+            ret["depth"] = result.depth;
+            ret["exact"] = result.exact;
+            ret["nodes"] = result.nodes;
+            ret["seconds"] = result.seconds;
+            return ret;
+        }, py::arg("board"), py::arg("seconds") = 1., py::arg("max_depth") = (int)Expectimax_::MAX_DEPTH, py::arg("max_nodes") = 0)
+        .def("clear", &Expectimax_::clear)
+    ;
+
+    py::class_<Tablebase_, std::shared_ptr<Tablebase_>>(m, "Tablebase")
+        .def(py::init<const std::string&>())
+        .def_static("generate", &Tablebase_::generate, py::call_guard<py::gil_scoped_release>(),
+            py::arg("path"), py::arg("max_pieces") = 3, py::arg("max_steps") = (int)Board_::DEFAULT_MAX_STEPS,
+            py::arg("threads") = std::max(1u, std::thread::hardware_concurrency()))
+        .def("probe", [](const Tablebase_& tablebase, const Board_& board) -> py::object {
+            int value;
+            if(!tablebase.probe(board, value)) {
+                return py::none();
+            }
+            return py::int_(value);
+        })
+        .def("__len__", &Tablebase_::size)
+        .def_property_readonly("max_pieces", &Tablebase_::max_pieces)
+        .def_property_readonly("max_steps", &Tablebase_::max_steps)
+    ;
+
+    py::class_<ReplayBuffer>(m, "ReplayBuffer")
+        .def(py::init<std::size_t>())
+        .def("add", [](ReplayBuffer& buffer, const Board_& board, py::array_t<double, py::array::c_style | py::array::forcecast> probs, double outcome) {
+            if(probs.size() != ReplayBuffer::POLICY_SIZE) {
+                throw std::invalid_argument("probs: wrong size");
+            }
+            buffer.add(PackedPosition::pack(board), probs.data(), outcome);
+        })
+        .def("extend", [](ReplayBuffer& buffer, const std::vector<Board_>& boards, py::array_t<double, py::array::c_style | py::array::forcecast> probs, py::array_t<double, py::array::c_style | py::array::forcecast> outcomes) {
+            if((std::size_t)probs.size() != boards.size() * ReplayBuffer::POLICY_SIZE || (std::size_t)outcomes.size() != boards.size()) {
+                throw std::invalid_argument("probs/outcomes: wrong size");
+            }
+            for(std::size_t i = 0; i < boards.size(); i++) {
+                buffer.add(PackedPosition::pack(boards[i]), probs.data() + i * ReplayBuffer::POLICY_SIZE, outcomes.data()[i]);
+            }
+        })
+        .def("sample_into", [](const ReplayBuffer& buffer, py::array board_states, py::array hiddens, py::array remaining_steps, py::array probs, py::array outcomes, bool augment) {
+            std::size_t batch_size = outcomes.size();
+            buffer.sample(batch_size,
+                writable_buffer<float>(board_states, batch_size * COMPACT_BOARD_SIZE, "board_states"),
+                writable_buffer<float>(hiddens, batch_size * COMPACT_HIDDENS_SIZE, "hiddens"),
+                writable_buffer<float>(remaining_steps, batch_size, "remaining_steps"),
+                writable_buffer<float>(probs, batch_size * ReplayBuffer::POLICY_SIZE, "probs"),
+                writable_buffer<float>(outcomes, batch_size, "outcomes"),
+                augment, &rng);
+        }, py::arg("board_states"), py::arg("hiddens"), py::arg("remaining_steps"), py::arg("probs"), py::arg("outcomes"), py::arg("augment") = true)
+        .def("sample", [](const ReplayBuffer& buffer, std::size_t batch_size, bool augment) {
+            py::array_t<float> board_states({ batch_size, (std::size_t)9, (std::size_t)4, (std::size_t)4 });
+            py::array_t<float> hiddens({ batch_size, (std::size_t)2, (std::size_t)4 });
+            py::array_t<float> remaining_steps({ batch_size, (std::size_t)1 });
+            py::array_t<float> probs({ batch_size, (std::size_t)ReplayBuffer::POLICY_SIZE });
+            py::array_t<float> outcomes({ batch_size });
+            buffer.sample(batch_size,
+                board_states.mutable_data(), hiddens.mutable_data(), remaining_steps.mutable_data(),
+                probs.mutable_data(), outcomes.mutable_data(),
+                augment, &rng);
+            return py::make_tuple(py::make_tuple(board_states, hiddens, remaining_steps), probs, outcomes);
+        }, py::arg("batch_size"), py::arg("augment") = true)
+        .def("clear", &ReplayBuffer::clear)
+        .def("__len__", &ReplayBuffer::size)
+        .def_property_readonly("capacity", &ReplayBuffer::capacity)
+    ;
+
+    typedef SelfPlayRunner<Board_> SelfPlayRunner_;
+
+    py::class_<SelfPlayRunner_>(m, "SelfPlayRunner")
+        .def(py::init([](BatchMCTS<Board_>& mcts, double temperature, int small_temp_after, double dirichlet_alpha, double dirichlet_weight) {
+            SelfPlayRunner_::Options options;
+            options.temperature = temperature;
+            options.small_temp_after = small_temp_after;
+            options.dirichlet_alpha = dirichlet_alpha;
+            options.dirichlet_weight = dirichlet_weight;
+            return new SelfPlayRunner_(mcts, options);
+        }), py::keep_alive<1, 2>(),
+            py::arg("mcts"), py::arg("temperature") = 1., py::arg("small_temp_after") = 10,
+            py::arg("dirichlet_alpha") = 0.03, py::arg("dirichlet_weight") = 0.25)
+        .def("play", [](SelfPlayRunner_& runner, std::size_t n_games, ReplayBuffer* buffer, GameRecordWriter* writer, py::object seed) {
+            // the module's generator is only touched under the GIL; the games draw from their own
+            prng::Xoshiro256 engine(seed.is_none() ? rng() : seed.cast<uint64_t>());
+            SelfPlayRunner_::Trajectories trajectories;
+            {
+                py::gil_scoped_release release;
+                trajectories = runner.play(n_games, Board_(), &engine, writer);
+            }
+            std::size_t n = trajectories.positions.size();
+            if(buffer != nullptr) {
+                for(std::size_t i = 0; i < n; i++) {
+                    buffer->add(trajectories.positions[i], trajectories.policies.data() + i * ReplayBuffer::POLICY_SIZE, trajectories.outcomes[i]);
+                }
+            }
+            py::array_t<float> board_states({ n, (std::size_t)9, (std::size_t)4, (std::size_t)4 });
+            py::array_t<float> hiddens({ n, (std::size_t)2, (std::size_t)4 });
+            py::array_t<float> remaining_steps({ n, (std::size_t)1 });
+            float* board_states_buf = board_states.mutable_data();
+            float* hiddens_buf = hiddens.mutable_data();
+            float* remaining_steps_buf = remaining_steps.mutable_data();
+            for(std::size_t i = 0; i < n; i++) {
+                trajectories.positions[i].unpack(
+                    board_states_buf + i * COMPACT_BOARD_SIZE,
+                    hiddens_buf + i * COMPACT_HIDDENS_SIZE,
+                    remaining_steps_buf + i
+                );
+            }
+            py::dict ret;
+            ret["board_states"] = board_states;
+            ret["hiddens"] = hiddens;
+            ret["remaining_steps"] = remaining_steps;
+            ret["probs"] = py::array_t<float>({ n, (std::size_t)ReplayBuffer::POLICY_SIZE }, trajectories.policies.data());
+            ret["outcomes"] = py::array_t<float>(n, trajectories.outcomes.data());
+            ret["game_indices"] = py::array_t<int>(n, trajectories.game_indices.data());
+            ret["winners"] = py::array_t<int>(trajectories.winners.size(), trajectories.winners.data());
+            return ret;
+        }, py::arg("n_games"), py::arg("buffer") = nullptr, py::arg("writer") = nullptr, py::arg("seed") = py::none())
+    ;
+
+    typedef Arena<Board_> Arena_;
+
+    py::class_<Arena_>(m, "Arena")
+        .def(py::init([](BatchMCTS<Board_>& first, BatchMCTS<Board_>& second, int sampled_plies) {
+            Arena_::Options options;
+            options.sampled_plies = sampled_plies;
+            return new Arena_(first, second, options);
+        }), py::keep_alive<1, 2>(), py::keep_alive<1, 3>(),
+            py::arg("first"), py::arg("second"), py::arg("sampled_plies") = 0)
+        .def("play", [](Arena_& arena, std::size_t n_pairs, py::object seed) {
+            prng::Xoshiro256 engine(seed.is_none() ? rng() : seed.cast<uint64_t>());
+            Arena_::Result result;
+            {
+                py::gil_scoped_release release;
+                result = arena.play(n_pairs, Board_(), &engine);
+            }
+            py::dict ret;
+            ret["wins"] = result.wins;
+            ret["draws"] = result.draws;
+            ret["losses"] = result.losses;
+            ret["score"] = result.score;
+            ret["score_margin"] = result.score_margin;
+            ret["elo"] = result.elo;
+            ret["elo_low"] = result.elo_low;
+            ret["elo_high"] = result.elo_high;
+            ret["winners"] = py::array_t<int>(result.winners.size(), result.winners.data());
+            ret["seeds"] = py::array_t<uint64_t>(result.seeds.size(), result.seeds.data());
+            return ret;
+        }, py::arg("n_pairs"), py::arg("seed") = py::none())
+    ;
+
+    typedef GameServer<Board_> GameServer_;
+
+    py::class_<GameServer_, std::unique_ptr<GameServer_, GameServerDeleter>>(m, "GameServer")
+        .def(py::init([](const PolicyNetworkF& policy_f, const std::string& host, int port, std::size_t search_threads, std::size_t max_queued,
+                unsigned int n_playout, double move_time, bool early_stop, double extension, double deadline, double c_puct,
+                std::shared_ptr<EvalCache_> eval_cache, py::object seed) {
+            MCTS<Board_>::PolicyFunction policy = make_network_policy(policy_f);
+            return new GameServer_(eval_cache ? cached<Board_>(policy, eval_cache) : policy,
+                make_server_options(host, port, search_threads, max_queued, n_playout, move_time, early_stop, extension, deadline, c_puct, seed));
+        }), py::arg("policy_value_function"), py::arg("host") = "127.0.0.1", py::arg("port") = 1027, py::arg("search_threads") = 4,
+            py::arg("max_queued") = 64, py::arg("n_playout") = 10000, py::arg("move_time") = 5., py::arg("early_stop") = true,
+            py::arg("extension") = 1.5, py::arg("deadline") = 0., py::arg("c_puct") = 5., py::arg("eval_cache") = nullptr, py::arg("seed") = py::none())
+        .def(py::init([](const std::string& evaluator, const std::string& host, int port, std::size_t search_threads, std::size_t max_queued,
+                unsigned int n_playout, double move_time, bool early_stop, double extension, double deadline, double c_puct,
+                int n_rollouts, py::object seed) {
+            return new GameServer_(make_native_evaluator(evaluator, n_rollouts),
+                make_server_options(host, port, search_threads, max_queued, n_playout, move_time, early_stop, extension, deadline, c_puct, seed));
+        }), py::arg("evaluator"), py::arg("host") = "127.0.0.1", py::arg("port") = 1027, py::arg("search_threads") = 4,
+            py::arg("max_queued") = 64, py::arg("n_playout") = 10000, py::arg("move_time") = 5., py::arg("early_stop") = true,
+            py::arg("extension") = 1.5, py::arg("deadline") = 0., py::arg("c_puct") = 5., py::arg("n_rollouts") = 8, py::arg("seed") = py::none())
+        .def("serve", &GameServer_::serve, py::call_guard<py::gil_scoped_release>())
+        .def("stop", &GameServer_::stop, py::call_guard<py::gil_scoped_release>())
+        .def("set_endgame_solver", [](GameServer_& server, int max_hidden, uint64_t max_nodes, std::shared_ptr<Tablebase_> tablebase) {
+            server.set_leaf_solver(make_endgame_solver(max_hidden, max_nodes, tablebase));
+        }, py::arg("max_hidden") = 0, py::arg("max_nodes") = 20000, py::arg("tablebase") = nullptr)
+        .def("stats", [](const GameServer_& server) {
+            GameServer_::Stats s = server.stats();
+            py::dict ret;
+            ret["games"] = s.games;
+            ret["connections"] = s.connections;
+            ret["queued"] = s.queued;
+            ret["running"] = s.running;
+            ret["completed"] = s.completed;
+            ret["rejected"] = s.rejected;
+            ret["expired"] = s.expired;
+            ret["failed"] = s.failed;
+            ret["mean_wait"] = s.mean_wait;
+            ret["max_wait"] = s.max_wait;
+            ret["mean_search"] = s.mean_search;
+            return ret;
+        })
+    ;
+
+    typedef BoardBatch<true> BoardBatch_;
+
+    py::class_<BoardBatch_>(m, "BoardBatch")
+        .def(py::init<std::size_t, int, std::size_t>(),
+            py::arg("n"), py::arg("max_steps") = (int)Board_::DEFAULT_MAX_STEPS, py::arg("n_threads") = 1)
+        .def(py::init<const std::vector<Board_>&, std::size_t>(), py::arg("boards"), py::arg("n_threads") = 1)
+        .def("__len__", &BoardBatch_::size)
+        .def_property_readonly("max_steps", &BoardBatch_::max_steps)
+        .def("board", [](const BoardBatch_& batch, std::size_t i) {
+            if(i >= batch.size()) {
+                throw py::index_error();
+            }
+            return batch.board(i);
+        })
+        .def("set_board", [](BoardBatch_& batch, std::size_t i, const Board_& board) {
+            if(i >= batch.size()) {
+                throw py::index_error();
+            }
+            batch.set_board(i, board);
+        })
+        .def("boards", &BoardBatch_::boards, py::call_guard<py::gil_scoped_release>())
+        .def("do_moves", [](BoardBatch_& batch, py::array_t<int, py::array::c_style | py::array::forcecast> move_indices) {
+            if((std::size_t)move_indices.size() != batch.size()) {
+                throw std::invalid_argument("move_indices: expected one per game");
+            }
+            py::array_t<bool> applied(batch.size());
+            static_assert(sizeof(bool) == sizeof(uint8_t), "applied is written as bytes");
+            uint8_t* applied_buf = reinterpret_cast<uint8_t*>(applied.mutable_data());
+            const int* indices = move_indices.data();
+            {
+                py::gil_scoped_release release;
+                batch.do_moves(indices, applied_buf);
+            }
+            return applied;
+        }, py::arg("move_indices"))
+        .def("env_step", [](BoardBatch_& batch, py::object seed) {
+            uint64_t s = seed.is_none() ? rng() : seed.cast<uint64_t>();
+            py::gil_scoped_release release;
+            batch.env_step(s);
+        }, py::arg("seed") = py::none())
+        .def("legal_masks", [](const BoardBatch_& batch) {
+            py::array_t<bool> ret({ batch.size(), (std::size_t)BoardBatch_::NUM_MOVE_INDICES });
+            uint8_t* buf = reinterpret_cast<uint8_t*>(ret.mutable_data());
+            py::gil_scoped_release release;
+            batch.legal_masks(buf);
+            return ret;
+        })
+        .def("winners", [](const BoardBatch_& batch) {
+            py::array_t<int> ret(batch.size());
+            int* buf = ret.mutable_data();
+            py::gil_scoped_release release;
+            batch.winners(buf);
+            return ret;
+        })
+        .def("current_players", [](const BoardBatch_& batch) {
+            py::array_t<int> ret(batch.size());
+            batch.current_players(ret.mutable_data());
+            return ret;
+        })
+        .def("encode", [](const BoardBatch_& batch) {
+            std::size_t n = batch.size();
+            py::array_t<float> board_states({ n, (std::size_t)9, (std::size_t)4, (std::size_t)4 });
+            py::array_t<float> hiddens({ n, (std::size_t)2, (std::size_t)4 });
+            py::array_t<float> remaining_steps({ n, (std::size_t)1 });
+            float* board_states_buf = board_states.mutable_data();
+            float* hiddens_buf = hiddens.mutable_data();
+            float* remaining_steps_buf = remaining_steps.mutable_data();
+            {
+                py::gil_scoped_release release;
+                batch.encode(board_states_buf, hiddens_buf, remaining_steps_buf);
+            }
+            return py::make_tuple(board_states, hiddens, remaining_steps);
+        })
+    ;
+
+    py::class_<GameRecordWriter>(m, "GameRecordWriter")
+        .def(py::init<const std::string&, int>(), py::arg("path"), py::arg("max_steps") = (int)Board_::DEFAULT_MAX_STEPS)
+        .def("append", [](GameRecordWriter& writer, uint64_t seed, const std::vector<Move>& moves, py::array_t<double, py::array::c_style | py::array::forcecast> probs, int winner) {
+            std::size_t n_decisions = std::count_if(moves.begin(), moves.end(), [](const Move& m) { return m.type != Move::Type::ENV_RAND; });
+            if((std::size_t)probs.size() != n_decisions * game_record::POLICY_SIZE) {
+                throw std::invalid_argument("probs: expected one 80-wide row per player move");
+            }
+            writer.append(seed, moves, probs.data(), winner);
+        }, py::arg("seed"), py::arg("moves"), py::arg("probs"), py::arg("winner"))
+        .def("flush", &GameRecordWriter::flush)
+        .def("close", &GameRecordWriter::close)
     ;
 
+    typedef GameRecordReader<Board_> GameRecordReader_;
+
+    py::class_<GameRecordReader_>(m, "GameRecordReader")
+        .def(py::init<const std::string&>())
+        .def("__len__", &GameRecordReader_::size)
+        .def("num_decisions", &GameRecordReader_::num_decisions)
+        .def("game_length", [](const GameRecordReader_& reader, std::size_t game) { return reader.header(game).n_plies; })
+        .def("winner", [](const GameRecordReader_& reader, std::size_t game) { return reader.header(game).winner; })
+        .def("seed", [](const GameRecordReader_& reader, std::size_t game) { return reader.header(game).seed; })
+        .def("moves", [](const GameRecordReader_& reader, std::size_t game) {
+            std::vector<Move> moves;
+            for(std::size_t i = 0; i < reader.header(game).n_plies; i++) {
+                moves.push_back(reader.ply(game, i));
+            }
+            return moves;
+        })
+        .def("position", &GameRecordReader_::position, py::arg("game"), py::arg("n_plies"))
+        .def("decision", [](const GameRecordReader_& reader, std::size_t game, std::size_t k) {
+            Board_ board;
+            py::array_t<double> probs(game_record::POLICY_SIZE);
+            double outcome = reader.decision(game, k, board, probs.mutable_data());
+            return py::make_tuple(board, probs, outcome);
+        }, py::arg("game"), py::arg("k"))
+        .def("fill_buffer", [](const GameRecordReader_& reader, ReplayBuffer& buffer, std::size_t start, std::size_t end) {
+            end = std::min(end, reader.size());
+            py::gil_scoped_release release;
+            for(std::size_t game = start; game < end; game++) {
+                reader.for_each_decision(game, [&buffer](const Board_& board, const float* policy, double outcome) {
+                    buffer.add(PackedPosition::pack(board), policy, outcome);
+                });
+            }
+        }, py::arg("buffer"), py::arg("start") = 0, py::arg("end") = std::numeric_limits<std::size_t>::max())
+    ;
+
+    m.def("seed", [](uint64_t seed) { rng.seed(seed); },
+        "seeds the flips and default seeds the module draws, e.g. for the searches and evaluators built next", py::arg("seed"));
+
+    m.def("set_ponder_cores", [](double cores) { ponder_cores() = cores; },
+        "cores shared by all pondering searches of the process", py::arg("cores"));
+
+    m.def("symmetry_move_map", [](int transform) {
+            if(transform < 0 || transform >= Symmetry::NUM_TRANSFORMS) {
+                throw py::index_error();
+            }
+            const int (&map)[Symmetry::NUM_MOVE_INDICES] = Symmetry::tables().move_index_map[transform];
+            return py::array_t<int>(Symmetry::NUM_MOVE_INDICES, map);
+        },
+        "where each of the 80 policy entries ends up under a transform, e.g. the one from Board.canonical_key", py::arg("transform"));
+
     m.def("move_probs_to_one_hot", 
     	[](const std::vector<Board_::Move>& moves, const std::vector<double>& probs) {
 			py::array_t<double> ret({5, 4, 4});
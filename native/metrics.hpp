@@ -0,0 +1,247 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+    Search instrumentation. Every search thread owns one ThreadMetrics slot and
+    is the only writer to it, so counters are bumped with relaxed load/store
+    pairs (no locked instructions) and can still be read from any thread.
+
+    Time is attributed with a per-thread phase state machine: entering a phase
+    charges the cycles since the last switch to the phase being left, so the
+    phases never overlap and nested scopes (e.g. encoding inside the policy
+    call) are subtracted from their parent.
+*/
+namespace metrics {
+
+enum Phase {
+    SELECTION,
+    EXPANSION,
+    ENCODING,
+    POLICY_WAIT,
+    BACKUP,
+    GIL_ACQUIRE,
+    LEAF_SOLVER,
+    NUM_PHASES,
+    IDLE = NUM_PHASES
+};
+
+static const char* const PHASE_NAMES[NUM_PHASES] = {
+    "selection", "expansion", "encoding", "policy_wait", "backup", "gil_acquire", "leaf_solver"
+};
+
+inline uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+class ThreadMetrics {
+public:
+    typedef std::atomic<uint64_t> Counter;
+
+    ThreadMetrics() { clear(); }
+
+    inline void add(Counter& counter, uint64_t n = 1) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    inline void observe_depth(uint64_t depth) {
+        if(depth > max_depth.load(std::memory_order_relaxed)) {
+            max_depth.store(depth, std::memory_order_relaxed);
+        }
+    }
+
+    /* Switches the running phase and returns the one that was left */
+    inline Phase enter(Phase phase) {
+        uint64_t now = cycles();
+        Phase prev = _phase;
+        if(prev != IDLE) {
+            add(phase_cycles[prev], now - _phase_start);
+        }
+        _phase = phase;
+        _phase_start = now;
+        return prev;
+    }
+
+    void clear() {
+        for(auto& c : phase_cycles) {
+            c.store(0, std::memory_order_relaxed);
+        }
+        for(Counter* c : { &playouts, &evaluated_leaves, &terminal_leaves, &collisions, &batches, &batch_slots, &nodes, &proven_nodes, &max_depth }) {
+            c->store(0, std::memory_order_relaxed);
+        }
+    }
+
+    Counter phase_cycles[NUM_PHASES];
+    Counter playouts;
+    Counter evaluated_leaves;   // leaves sent to the policy function
+    Counter terminal_leaves;    // leaves scored directly: finished games and solved subtrees
+    Counter collisions;         // evaluated leaves already expanded by an earlier slot of the batch
+    Counter batches;            // policy function calls
+    Counter batch_slots;        // leaves over all policy function calls
+    Counter nodes;              // tree nodes allocated, freed or not: a count of work, not of the tree size
+    Counter proven_nodes;       // nodes given an exact value by the solver
+    Counter max_depth;
+
+private:
+    // owned by the thread writing this slot
+    Phase _phase = IDLE;
+    uint64_t _phase_start = 0;
+
+    // keep neighbouring slots off each other's cache lines
+    char _padding[64];
+};
+
+/*
+    The slot bound to the calling thread, so code that does not see the search
+    object (the python policy wrappers) can still report into it.
+*/
+inline ThreadMetrics*& current() {
+    static thread_local ThreadMetrics* slot = nullptr;
+    return slot;
+}
+
+class ThreadBinding {
+public:
+    explicit ThreadBinding(ThreadMetrics* slot) : _prev(current()) {
+        current() = slot;
+    }
+    ~ThreadBinding() {
+        current() = _prev;
+    }
+private:
+    ThreadMetrics* _prev;
+};
+
+/*
+    Runs the enclosing scope as `phase` on the calling thread's slot and
+    switches back to the previous phase on exit. A no-op on unbound threads.
+*/
+class ScopedPhase {
+public:
+    explicit ScopedPhase(Phase phase) : ScopedPhase(current(), phase) { }
+
+    ScopedPhase(ThreadMetrics* slot, Phase phase) : _slot(slot) {
+        if(_slot != nullptr) {
+            _prev = _slot->enter(phase);
+        }
+    }
+
+    ~ScopedPhase() { exit(); }
+
+    inline void enter(Phase phase) {
+        if(_slot != nullptr) {
+            _slot->enter(phase);
+        }
+    }
+
+    inline void exit() {
+        if(_slot != nullptr) {
+            _slot->enter(_prev);
+            _slot = nullptr;
+        }
+    }
+
+private:
+    ThreadMetrics* _slot;
+    Phase _prev = IDLE;
+};
+
+class SearchMetrics {
+public:
+    typedef std::map<std::string, double> Snapshot;
+
+    SearchMetrics(std::size_t n_threads, std::size_t batch_capacity) :
+        _threads(n_threads),
+        _batch_capacity(batch_capacity)
+    {
+        clear();
+    }
+
+    inline ThreadMetrics* thread(std::size_t i) {
+        return &_threads[i];
+    }
+
+    inline void add_search_time(std::chrono::steady_clock::duration d) {
+        _search_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(), std::memory_order_relaxed);
+    }
+
+    /* Not safe against a concurrently running search */
+    void clear() {
+        for(auto& t : _threads) {
+            t.clear();
+        }
+        _search_ns.store(0, std::memory_order_relaxed);
+        _clock_start = std::chrono::steady_clock::now();
+        _cycles_start = cycles();
+    }
+
+    Snapshot snapshot() const {
+        Snapshot ret;
+        uint64_t phase_cycles[NUM_PHASES] = { 0 };
+        uint64_t playouts = 0, evaluated = 0, terminal = 0, collisions = 0, batches = 0, slots = 0, nodes = 0, proven = 0, max_depth = 0;
+        for(auto& t : _threads) {
+            for(int p = 0; p < NUM_PHASES; p++) {
+                phase_cycles[p] += t.phase_cycles[p].load(std::memory_order_relaxed);
+            }
+            playouts += t.playouts.load(std::memory_order_relaxed);
+            evaluated += t.evaluated_leaves.load(std::memory_order_relaxed);
+            terminal += t.terminal_leaves.load(std::memory_order_relaxed);
+            collisions += t.collisions.load(std::memory_order_relaxed);
+            batches += t.batches.load(std::memory_order_relaxed);
+            slots += t.batch_slots.load(std::memory_order_relaxed);
+            nodes += t.nodes.load(std::memory_order_relaxed);
+            proven += t.proven_nodes.load(std::memory_order_relaxed);
+            max_depth = std::max(max_depth, t.max_depth.load(std::memory_order_relaxed));
+        }
+        double search_seconds = _search_ns.load(std::memory_order_relaxed) * 1e-9;
+
+        // calibrate the cycle counter against the steady clock over the lifetime of the stats
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - _clock_start).count();
+        double cycles_per_second = elapsed > 1e-3 ? (cycles() - _cycles_start) / elapsed : 1e9;
+
+        for(int p = 0; p < NUM_PHASES; p++) {
+            ret[std::string(PHASE_NAMES[p]) + "_seconds"] = phase_cycles[p] / cycles_per_second;
+        }
+        ret["threads"] = _threads.size();
+        ret["search_seconds"] = search_seconds;
+        ret["playouts"] = playouts;
+        ret["playouts_per_sec"] = search_seconds > 0 ? playouts / search_seconds : 0.;
+        ret["evaluated_leaves"] = evaluated;
+        ret["terminal_leaves"] = terminal;
+        ret["terminal_ratio"] = evaluated + terminal > 0 ? (double)terminal / (evaluated + terminal) : 0.;
+        ret["collisions"] = collisions;
+        ret["batches"] = batches;
+        ret["batch_fill"] = batches > 0 ? (double)slots / (batches * _batch_capacity) : 0.;
+        ret["nodes_allocated"] = nodes;
+        ret["proven_nodes"] = proven;
+        ret["max_depth"] = max_depth;
+        return ret;
+    }
+
+private:
+    std::vector<ThreadMetrics> _threads;
+    std::size_t _batch_capacity;
+    std::atomic<uint64_t> _search_ns;
+    std::chrono::steady_clock::time_point _clock_start;
+    uint64_t _cycles_start;
+};
+
+}
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef PRNG_HPP
+#define PRNG_HPP
+
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <random>
+
+namespace prng {
+
+/* Advances state by one step of splitmix64 and returns its mixed output */
+inline uint64_t splitmix64(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/*
+    The seed of the stream named by ids under seed, e.g. (search, game,
+    playout): each id goes through a splitmix64 step of its own, so streams
+    differing in any id are unrelated, and a stream is found again from its
+    name alone, whichever thread asks for it.
+*/
+inline uint64_t derive(uint64_t seed, std::initializer_list<uint64_t> ids) {
+    uint64_t state = seed;
+    uint64_t z = splitmix64(state);
+    for(uint64_t id : ids) {
+        state = z ^ id;
+        z = splitmix64(state);
+    }
+    return z;
+}
+
+/*
+    xoshiro256++ (Blackman and Vigna): 32 bytes of state and a handful of
+    instructions per draw, against 2.5KB for std::mt19937. A standard
+    UniformRandomBitGenerator, so it goes wherever a RandomEngine does.
+*/
+class Xoshiro256 {
+public:
+    typedef uint64_t result_type;
+
+    explicit Xoshiro256(uint64_t seed_value = 0) {
+        seed(seed_value);
+    }
+
+    void seed(uint64_t seed_value) {
+        for(uint64_t& s : _s) {
+            s = splitmix64(seed_value);
+        }
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    inline result_type operator()() {
+        uint64_t result = rotl(_s[0] + _s[3], 23) + _s[0];
+        uint64_t t = _s[1] << 17;
+        _s[2] ^= _s[0];
+        _s[3] ^= _s[1];
+        _s[1] ^= _s[2];
+        _s[0] ^= _s[3];
+        _s[2] ^= t;
+        _s[3] = rotl(_s[3], 45);
+        return result;
+    }
+
+    /* Uniform in [0, 1), from the top 53 bits of a draw */
+    inline double uniform() {
+        return ((*this)() >> 11) * (1. / 9007199254740992.);
+    }
+
+    /* Uniform in [0, n) for n > 0, by multiply and shift (Lemire), unbiased */
+    inline uint64_t below(uint64_t n) {
+        unsigned __int128 m = (unsigned __int128)(*this)() * n;
+        uint64_t low = (uint64_t)m;
+        if(low < n) {
+            uint64_t threshold = (0 - n) % n;
+            while(low < threshold) {
+                m = (unsigned __int128)(*this)() * n;
+                low = (uint64_t)m;
+            }
+        }
+        return (uint64_t)(m >> 64);
+    }
+
+private:
+    static inline uint64_t rotl(uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t _s[4];
+};
+
+/* The generator of a named stream, see derive */
+inline Xoshiro256 stream(uint64_t seed, std::initializer_list<uint64_t> ids) {
+    return Xoshiro256(derive(seed, ids));
+}
+
+/*
+    Draws for code templated on its RandomEngine: the direct versions above
+    for Xoshiro256, the std distributions for any other engine.
+*/
+template<typename RandomEngine>
+inline uint64_t below(RandomEngine& engine, uint64_t n) {
+    return std::uniform_int_distribution<uint64_t>(0, n - 1)(engine);
+}
+
+inline uint64_t below(Xoshiro256& engine, uint64_t n) {
+    return engine.below(n);
+}
+
+template<typename RandomEngine>
+inline double uniform(RandomEngine& engine) {
+    return std::uniform_real_distribution<double>(0., 1.)(engine);
+}
+
+inline double uniform(Xoshiro256& engine) {
+    return engine.uniform();
+}
+
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef SEARCH_BUDGET_HPP
+#define SEARCH_BUDGET_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+
+namespace mcts {
+
+/*
+    How long a single get_move_probs may search. The defaults reproduce a fixed
+    n_playout search.
+*/
+struct SearchLimits {
+    std::size_t playouts = 0;   // 0: the n_playout the search was built with
+    double seconds = 0.;        // wall clock deadline, 0: none
+    // stop as soon as the most visited root move can no longer be overtaken
+    bool early_stop = false;
+    // when the budget runs out while the runner-up move has a better value than
+    // the most visited one, keep searching up to extension times the budget
+    double extension = 1.;
+};
+
+/*
+    Tracks the playouts spent on one root against SearchLimits.
+*/
+class SearchBudget {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    SearchBudget(const SearchLimits& limits, std::size_t default_playouts, clock::time_point start = clock::now()) :
+        _limits(limits),
+        _start(start),
+        _playouts(limits.playouts > 0 ? limits.playouts : default_playouts),
+        _extension(std::max(1., limits.extension))
+    { }
+
+    inline void add_playout() {
+        _done++;
+    }
+
+    inline std::size_t playouts() const {
+        return _done;
+    }
+
+    /*
+        root must provide visit_leaders(first, second), see TreeNode. Whatever
+        the limits, a search goes on until a root move has a visit, so that
+        its move probabilities are defined.
+    */
+    template<typename Node>
+    bool should_continue(const Node& root) const {
+        if(_within_limits(root)) {
+            return true;
+        }
+        unsigned int first = 0, second = 0;
+        root.visit_leaders(first, second);
+        return first == 0;
+    }
+
+private:
+
+    template<typename Node>
+    bool _within_limits(const Node& root) const {
+        bool timed = _limits.seconds > 0.;
+        double elapsed = timed ? std::chrono::duration<double>(clock::now() - _start).count() : 0.;
+        if(_done >= _playouts * _extension || (timed && elapsed >= _limits.seconds * _extension)) {
+            return false;
+        }
+        bool in_budget = _done < _playouts && (!timed || elapsed < _limits.seconds);
+        if(!_limits.early_stop && _extension == 1.) {
+            return in_budget;
+        }
+
+        unsigned int first = 0, second = 0;
+        bool unsettled = root.visit_leaders(first, second);
+        if(!in_budget && !unsettled) {
+            return false;
+        }
+        if(!_limits.early_stop || _done == 0) {
+            return true;
+        }
+
+        // playouts still available, estimated from the rate so far under a deadline
+        double playout_limit = in_budget ? _playouts : _playouts * _extension;
+        double remaining = playout_limit - _done;
+        if(timed && elapsed > 0.) {
+            double seconds_limit = in_budget ? _limits.seconds : _limits.seconds * _extension;
+            remaining = std::min(remaining, _done / elapsed * (seconds_limit - elapsed));
+        }
+        return first - second <= remaining;
+    }
+
+    SearchLimits _limits;
+    clock::time_point _start;
+    std::size_t _playouts;
+    double _extension;
+    std::size_t _done = 0;
+};
+
+}
+
+#endif
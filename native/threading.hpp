@@ -1,6 +1,14 @@
 #ifndef THREADING_HPP
 #define THREADING_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+
 namespace threading {
 
 class SpinLock {
@@ -20,6 +28,65 @@ void atomic_add(std::atomic<T> &f, T d) {
     while (!f.compare_exchange_weak(old, old + d));
 }
 
+/*
+    Hands out item ids (e.g. games of a batched search) to a fixed set of
+    consumers. An item is held by at most one consumer between pop() and
+    release(), and is either queued again or retired there; consumers block
+    while all unfinished items are held by others.
+*/
+class ReadyQueue {
+public:
+    void reset(std::size_t n_items, std::size_t n_consumers) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _ready.clear();
+        for(std::size_t i = 0; i < n_items; i++) {
+            _ready.push_back(i);
+        }
+        _active = n_items;
+        _n_consumers = n_consumers;
+    }
+
+    /*
+        Takes up to max_items, but no more than a fair share of the unfinished
+        items, into items. Returns false once every item is retired.
+    */
+    bool pop(std::vector<std::size_t>& items, std::size_t max_items) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _condvar.wait(lock, [this]{ return _active == 0 || !_ready.empty(); });
+        items.clear();
+        if(_active == 0) {
+            return false;
+        }
+        std::size_t share = (_active + _n_consumers - 1) / _n_consumers;
+        std::size_t n = std::min(_ready.size(), std::max<std::size_t>(1, std::min(max_items, share)));
+        items.assign(_ready.begin(), _ready.begin() + n);
+        _ready.erase(_ready.begin(), _ready.begin() + n);
+        return true;
+    }
+
+    /* Queues the items flagged in again and retires the rest */
+    void release(const std::vector<std::size_t>& items, const std::vector<bool>& again) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            for(std::size_t i = 0; i < items.size(); i++) {
+                if(again[i]) {
+                    _ready.push_back(items[i]);
+                } else {
+                    _active--;
+                }
+            }
+        }
+        _condvar.notify_all();
+    }
+
+private:
+    std::mutex _mutex;
+    std::condition_variable _condvar;
+    std::deque<std::size_t> _ready;
+    std::size_t _active = 0;
+    std::size_t _n_consumers = 1;
+};
+
 }
 
 #include "ThreadPool.h"